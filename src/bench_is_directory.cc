@@ -0,0 +1,170 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file bench_is_directory.cc Microbenchmark of is_directory.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Usage: bench_is_directory [IMAGE [BLOCKSIZE]]
+//
+// Calls is_directory (like stage 1 does) and may_be_directory_block on a corpus
+// of 4096 byte blocks: zeroes, pseudo random data, printable text and directory
+// blocks, and prints the throughput of each for every kind of block. If IMAGE is
+// given, the blocks of that file (of BLOCKSIZE bytes, default 4096) are used as
+// an additional corpus of real blocks.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "ext3.h"
+#include "debug.h"
+#endif
+
+#include "globals.h"
+#include "commandline.h"
+#include "load_meta_data.h"
+#include "forward_declarations.h"
+#include "is_blockdetection.h"
+
+// Used by is_blockdetection.cc.
+int commandline_block = -1;
+bool commandline_accept_all = false;
+
+// Not called by is_directory.
+void load_meta_data(int) { ASSERT(false); }
+bool is_journal(int) { ASSERT(false); return false; }
+bool is_indirect_block_in_journal(int) { ASSERT(false); return false; }
+int journal_block_contains_inodes(int) { ASSERT(false); return 0; }
+
+static size_t const corpus_size = 64 * 1024 * 1024;
+
+static double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Fill block with a directory block: a directory start block if start is set, otherwise an extended directory block.
+static void make_directory_block(unsigned char* block, bool start, unsigned int& seed)
+{
+  int offset = 0;
+  int entry = 0;
+  while (offset < block_size_)
+  {
+    ext3_dir_entry_2* dir_entry = reinterpret_cast<ext3_dir_entry_2*>(block + offset);
+    char name[32];
+    if (start && entry < 2)
+      std::strcpy(name, entry == 0 ? "." : "..");
+    else
+    {
+      seed = seed * 1103515245 + 12345;
+      std::sprintf(name, "file%u.txt", (seed >> 16) % 100000);
+    }
+    dir_entry->name_len = std::strlen(name);
+    std::memcpy(dir_entry->name, name, dir_entry->name_len);
+    dir_entry->inode = 12 + entry;
+    dir_entry->file_type = (start && entry < 2) ? EXT3_FT_DIR : EXT3_FT_REG_FILE;
+    dir_entry->rec_len = EXT3_DIR_REC_LEN(dir_entry->name_len);
+    if (offset + dir_entry->rec_len + EXT3_DIR_REC_LEN(16) > block_size_)
+      dir_entry->rec_len = block_size_ - offset;
+    offset += dir_entry->rec_len;
+    ++entry;
+  }
+}
+
+static void run(char const* name, std::vector<unsigned char>& corpus)
+{
+  size_t const number_of_blocks = corpus.size() / block_size_;
+  double start = now();
+  size_t candidates = 0;
+  for (size_t block = 0; block < number_of_blocks; ++block)
+    if (may_be_directory_block(&corpus[block * block_size_]))
+      ++candidates;
+  double prefilter_seconds = now() - start;
+  start = now();
+  size_t directories = 0;
+  for (size_t block = 0; block < number_of_blocks; ++block)
+  {
+    DirectoryBlockStats stats;
+    if (is_directory(&corpus[block * block_size_], block, stats, false, false) != isdir_no)
+      ++directories;
+  }
+  double seconds = now() - start;
+  std::cout << std::setw(10) << name << ": may_be_directory_block " << std::setw(8) << std::fixed << std::setprecision(1) <<
+      (corpus.size() / prefilter_seconds / (1024 * 1024)) << " MB/s (" << candidates << " candidates), is_directory " <<
+      std::setw(8) << (corpus.size() / seconds / (1024 * 1024)) << " MB/s (" << directories << " directories)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  progname = argv[0];
+  block_size_ = (argc > 2) ? strtoul(argv[2], NULL, 10) : 4096;
+  if (block_size_ < 1024 || block_size_ > EXT3_MAX_BLOCK_SIZE || (block_size_ & (block_size_ - 1)))
+  {
+    std::cerr << "Usage: " << argv[0] << " [IMAGE [BLOCKSIZE]]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  inode_count_ = 1 << 24;
+  feature_incompat_filetype = true;
+  size_t const number_of_blocks = corpus_size / block_size_;
+  std::vector<unsigned char> corpus(corpus_size);
+
+  run("zeroes", corpus);
+
+  unsigned int seed = 1;
+  for (size_t i = 0; i < corpus_size; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    corpus[i] = seed >> 16;
+  }
+  run("random", corpus);
+
+  for (size_t i = 0; i < corpus_size; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    corpus[i] = ((seed >> 16) % 10 == 0) ? ' ' : 'a' + (seed >> 16) % 26;
+  }
+  run("text", corpus);
+
+  for (size_t block = 0; block < number_of_blocks; ++block)
+    make_directory_block(&corpus[block * block_size_], block % 4 == 0, seed);
+  run("directory", corpus);
+
+  if (argc > 1)
+  {
+    FILE* image = std::fopen(argv[1], "rb");
+    if (!image)
+    {
+      std::cerr << argv[0] << ": failed to open " << argv[1] << std::endl;
+      return EXIT_FAILURE;
+    }
+    corpus.resize(std::fread(&corpus[0], 1, corpus_size, image) / block_size_ * block_size_);
+    std::fclose(image);
+    run("image", corpus);
+  }
+  return EXIT_SUCCESS;
+}
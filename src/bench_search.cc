@@ -0,0 +1,123 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file bench_search.cc Microbenchmark of the --search implementations.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Usage: bench_search [PATTERN [MEGABYTES]]
+//
+// Searches PATTERN in a buffer of MEGABYTES (default 256) of pseudo random
+// printable text, one 4096 byte block at a time (like --search does), with
+// the byte-by-byte loop that --search used before and with every supported
+// SearchPattern implementation, and prints the throughput of each.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <sys/time.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "debug.h"
+#endif
+
+#include "search.h"
+
+// Used by search.cc.
+char const* progname;
+
+static size_t const block_size = 4096;
+
+// The loop that was used by --search before SearchPattern existed.
+static bool old_loop(unsigned char const* block_buf, char const* pattern, size_t len)
+{
+  for (unsigned char const* ptr = block_buf; ptr < block_buf + block_size - len; ++ptr)
+  {
+    if (*ptr == *pattern &&
+	(len == 1 || (ptr[1] == pattern[1] &&
+	(len == 2 || (ptr[2] == pattern[2] && std::memcmp(ptr, pattern, len) == 0)))))
+      return true;
+  }
+  return false;
+}
+
+static double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void report(char const* name, double seconds, size_t size, size_t found)
+{
+  std::cout << std::setw(10) << name << ": " << std::setw(8) << std::fixed << std::setprecision(1) <<
+      (size / seconds / (1024 * 1024)) << " MB/s (" << found << " blocks found)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  progname = argv[0];
+  std::string pattern = (argc > 1) ? argv[1] : "needle";
+  size_t megabytes = (argc > 2) ? strtoul(argv[2], NULL, 10) : 256;
+  if (pattern.empty() || pattern.size() >= block_size || megabytes == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [PATTERN [MEGABYTES]]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  size_t const size = megabytes * 1024 * 1024;
+  size_t const number_of_blocks = size / block_size;
+  std::vector<unsigned char> buf(size);
+  // Text that contains the first and last character of the pattern regularly, and the pattern itself rarely.
+  unsigned int seed = 1;
+  for (size_t i = 0; i < size; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = 'a' + (seed >> 16) % 26;
+  }
+  for (size_t block = 0; block < number_of_blocks; block += 97)
+    std::memcpy(&buf[block * block_size + (block * 31) % (block_size - pattern.size())], pattern.data(), pattern.size());
+
+  double start = now();
+  size_t found = 0;
+  for (size_t block = 0; block < number_of_blocks; ++block)
+    if (old_loop(&buf[block * block_size], pattern.data(), pattern.size()))
+      ++found;
+  report("old loop", now() - start, size, found);
+
+  search_implementation const implementations[] = { search_portable, search_sse2, search_avx2 };
+  for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); ++i)
+  {
+    if (!search_implementation_supported(implementations[i]))
+    {
+      std::cout << std::setw(10) << search_implementation_name(implementations[i]) << ": not supported by this CPU" << std::endl;
+      continue;
+    }
+    SearchPattern search_pattern(pattern, implementations[i]);
+    start = now();
+    found = 0;
+    for (size_t block = 0; block < number_of_blocks; ++block)
+      if (search_pattern.find(&buf[block * block_size], block_size - 1))
+	++found;
+    report(search_implementation_name(implementations[i]), now() - start, size, found);
+  }
+  return EXIT_SUCCESS;
+}
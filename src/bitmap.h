@@ -58,4 +58,73 @@ inline bitmap_ptr get_bitmap_mask(unsigned int bit)
   return result;
 }
 
+// The functions below process whole bitmap_t words at a time. Because the least significant
+// bit of a byte comes first and ext3grep only runs on little endian machines (see configure.ac),
+// bit 'bit' of the bitmap is bit 'bit % bitmap_t_bits' of word 'bit / bitmap_t_bits'.
+
+// Number of bits in bitmap_t.
+unsigned int const bitmap_word_bits = 8 * sizeof(bitmap_t);
+
+// Return the bits of word 'index' of 'bitmap' that are equal to 'set', as set bits.
+inline bitmap_t bitmap_word(bitmap_t const* bitmap, unsigned int index, bool set)
+{
+  return set ? bitmap[index] : ~bitmap[index];
+}
+
+// Return the first bit in [bit, end_bit) of 'bitmap' that is equal to 'set', or end_bit if there is none.
+inline unsigned int bitmap_find(bitmap_t const* bitmap, unsigned int bit, unsigned int end_bit, bool set)
+{
+  if (bit >= end_bit)
+    return end_bit;
+  unsigned int index = bit / bitmap_word_bits;
+  // Ignore the bits before 'bit' in the first word.
+  bitmap_t word = bitmap_word(bitmap, index, set) & (~static_cast<bitmap_t>(0) << (bit % bitmap_word_bits));
+  unsigned int const end_index = (end_bit - 1) / bitmap_word_bits;
+  while (!word)
+  {
+    if (index == end_index)
+      return end_bit;
+    word = bitmap_word(bitmap, ++index, set);
+  }
+  unsigned int result = index * bitmap_word_bits + __builtin_ctzl(word);
+  return result < end_bit ? result : end_bit;
+}
+
+// Return the number of bits in [bit, end_bit) of 'bitmap' that are set.
+inline unsigned int bitmap_count(bitmap_t const* bitmap, unsigned int bit, unsigned int end_bit)
+{
+  unsigned int count = 0;
+  while (bit < end_bit)
+  {
+    unsigned int index = bit / bitmap_word_bits;
+    bitmap_t word = bitmap[index] >> (bit % bitmap_word_bits);
+    unsigned int bits = bitmap_word_bits - bit % bitmap_word_bits;
+    if (bits > end_bit - bit)
+    {
+      bits = end_bit - bit;
+      word &= (static_cast<bitmap_t>(1) << bits) - 1;
+    }
+    count += __builtin_popcountl(word);
+    bit += bits;
+  }
+  return count;
+}
+
+// Find the first run of bits in [bit, end_bit) of 'bitmap' that are equal to 'set'.
+// Returns false if there is none, otherwise the run is [run_begin, run_end).
+//
+// Usage:
+//
+//   unsigned int run_begin, run_end;
+//   for (unsigned int bit = 0; bitmap_next_run(bitmap, bit, end_bit, set, run_begin, run_end); bit = run_end)
+//     ...
+inline bool bitmap_next_run(bitmap_t const* bitmap, unsigned int bit, unsigned int end_bit, bool set, unsigned int& run_begin, unsigned int& run_end)
+{
+  run_begin = bitmap_find(bitmap, bit, end_bit, set);
+  if (run_begin == end_bit)
+    return false;
+  run_end = bitmap_find(bitmap, run_begin, end_bit, !set);
+  return true;
+}
+
 #endif // BITMAP_H
@@ -0,0 +1,245 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file block_cache.cc Implementation of the block cache and I/O statistics.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "debug.h"
+#endif
+
+#include "block_cache.h"
+#include "commandline.h"
+#include "globals.h"
+
+//-----------------------------------------------------------------------------
+//
+// I/O statistics
+//
+
+struct IOStats {
+  uint64_t reads;
+  uint64_t bytes_read;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+};
+
+static char const* io_stage_names[number_of_io_stages] = {
+  "other",
+  "metadata",
+  "journal",
+  "stage1",
+  "stage2",
+  "block2inode",
+  "blocktypes"
+};
+
+static IOStats io_stats[number_of_io_stages];
+static io_stage_type volatile io_current_stage = io_stage_other;
+
+IOStage::IOStage(io_stage_type stage) : M_previous(io_current_stage)
+{
+  io_current_stage = stage;
+}
+
+IOStage::~IOStage()
+{
+  io_current_stage = M_previous;
+}
+
+void io_stats_read(size_t size)
+{
+  IOStats& stats(io_stats[io_current_stage]);
+  __sync_fetch_and_add(&stats.reads, 1);
+  __sync_fetch_and_add(&stats.bytes_read, size);
+}
+
+void print_io_stats(void)
+{
+  std::cout << std::setfill(' ') << std::dec;
+  std::cout << "\nI/O statistics (block cache: " << commandline_cache_size << " MiB):\n";
+  std::cout << "Stage            Reads      Bytes read    Cache hits  Cache misses  Hit rate\n";
+  IOStats total;
+  std::memset(&total, 0, sizeof(total));
+  for (int stage = 0; stage <= number_of_io_stages; ++stage)
+  {
+    IOStats const& stats(stage < number_of_io_stages ? io_stats[stage] : total);
+    if (stage < number_of_io_stages)
+    {
+      total.reads += stats.reads;
+      total.bytes_read += stats.bytes_read;
+      total.cache_hits += stats.cache_hits;
+      total.cache_misses += stats.cache_misses;
+    }
+    std::cout << std::setw(12) << std::left << (stage < number_of_io_stages ? io_stage_names[stage] : "total") << std::right <<
+        std::setw(10) << stats.reads << std::setw(16) << stats.bytes_read <<
+        std::setw(14) << stats.cache_hits << std::setw(14) << stats.cache_misses;
+    uint64_t lookups = stats.cache_hits + stats.cache_misses;
+    if (lookups > 0)
+      std::cout << std::setw(9) << std::fixed << std::setprecision(1) << (100.0 * stats.cache_hits / lookups) << '%';
+    std::cout << '\n';
+  }
+  std::cout << std::flush;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Block cache
+//
+
+// The cache is split into shards, each with its own lock, CLOCK hand and index,
+// so that the worker threads of scan_groups rarely wait for each other.
+// Block b is stored in shard b % block_cache_number_of_shards.
+int const block_cache_max_shards = 16;
+
+struct BlockCacheShard {
+  pthread_mutex_t mutex;
+  size_t first_slot;			// The slots of this shard are [first_slot, first_slot + number_of_slots).
+  size_t number_of_slots;
+  size_t hand;				// The next slot that is considered for replacement.
+  int index_bits;			// The index has 1 << index_bits entries, at least twice the number of slots.
+  std::vector<uint32_t> index;		// Open addressed hash table (linear probing) of the cached blocks: slot + 1, or 0 if empty.
+};
+
+static pthread_once_t block_cache_once = PTHREAD_ONCE_INIT;
+static size_t block_cache_slots;			// The number of blocks that fit in the cache.
+static unsigned char* block_cache_data;			// block_cache_slots blocks of block_size_ bytes.
+static std::vector<int> block_cache_block;		// The block that is stored in each slot, or -1.
+static std::vector<unsigned char> block_cache_referenced;	// Set when a slot was used since the hand last passed it (not bool: shards write concurrently).
+static int block_cache_number_of_shards;
+static BlockCacheShard block_cache_shards[block_cache_max_shards];
+
+static void init_block_cache(void)
+{
+  block_cache_slots = (size_t)commandline_cache_size * 1024 * 1024 / block_size_;
+  if (block_cache_slots == 0)
+    return;
+  block_cache_data = new unsigned char [block_cache_slots * block_size_];
+  block_cache_block.resize(block_cache_slots, -1);
+  block_cache_referenced.resize(block_cache_slots, 0);
+  block_cache_number_of_shards = std::min(block_cache_slots, (size_t)block_cache_max_shards);
+  for (int i = 0; i < block_cache_number_of_shards; ++i)
+  {
+    BlockCacheShard& shard(block_cache_shards[i]);
+    pthread_mutex_init(&shard.mutex, NULL);
+    shard.first_slot = block_cache_slots * i / block_cache_number_of_shards;
+    shard.number_of_slots = block_cache_slots * (i + 1) / block_cache_number_of_shards - shard.first_slot;
+    shard.hand = shard.first_slot;
+    shard.index_bits = 1;
+    while (((size_t)1 << shard.index_bits) < 2 * shard.number_of_slots)
+      ++shard.index_bits;
+    shard.index.resize((size_t)1 << shard.index_bits, 0);
+  }
+}
+
+// Return the position in the index of 'shard' where the search for 'block' starts.
+static inline size_t block_cache_home(BlockCacheShard const& shard, int block)
+{
+  return ((uint32_t)block / block_cache_number_of_shards * 2654435769U) >> (32 - shard.index_bits);
+}
+
+// Return the position of 'block' in the index of 'shard', or the empty position where it would be added.
+// Must be called with the mutex of the shard locked.
+static size_t block_cache_find(BlockCacheShard const& shard, int block)
+{
+  size_t const mask = shard.index.size() - 1;
+  size_t position = block_cache_home(shard, block);
+  while (shard.index[position] && block_cache_block[shard.index[position] - 1] != block)
+    position = (position + 1) & mask;
+  return position;
+}
+
+// Remove the entry at 'position' from the index of 'shard', moving later entries of the same cluster back.
+// Must be called with the mutex of the shard locked.
+static void block_cache_erase(BlockCacheShard& shard, size_t position)
+{
+  size_t const mask = shard.index.size() - 1;
+  size_t hole = position;
+  for (size_t next = (position + 1) & mask; shard.index[next]; next = (next + 1) & mask)
+  {
+    size_t home = block_cache_home(shard, block_cache_block[shard.index[next] - 1]);
+    // The entry can be moved to the hole if the hole is not before its home position (cyclically).
+    if (((next - home) & mask) >= ((next - hole) & mask))
+    {
+      shard.index[hole] = shard.index[next];
+      hole = next;
+    }
+  }
+  shard.index[hole] = 0;
+}
+
+bool block_cache_lookup(int block, unsigned char* block_buf)
+{
+  pthread_once(&block_cache_once, init_block_cache);
+  if (block_cache_slots == 0)
+    return false;
+  IOStats& stats(io_stats[io_current_stage]);
+  BlockCacheShard& shard(block_cache_shards[(uint32_t)block % block_cache_number_of_shards]);
+  pthread_mutex_lock(&shard.mutex);
+  uint32_t entry = shard.index[block_cache_find(shard, block)];
+  if (entry)
+  {
+    size_t slot = entry - 1;
+    block_cache_referenced[slot] = 1;
+    std::memcpy(block_buf, block_cache_data + slot * block_size_, block_size_);
+  }
+  pthread_mutex_unlock(&shard.mutex);
+  __sync_fetch_and_add(entry ? &stats.cache_hits : &stats.cache_misses, 1);
+  return entry;
+}
+
+void block_cache_insert(int block, unsigned char const* block_buf)
+{
+  pthread_once(&block_cache_once, init_block_cache);
+  if (block_cache_slots == 0)
+    return;
+  BlockCacheShard& shard(block_cache_shards[(uint32_t)block % block_cache_number_of_shards]);
+  pthread_mutex_lock(&shard.mutex);
+  // Another thread might have read and inserted the same block in the meantime.
+  if (!shard.index[block_cache_find(shard, block)])
+  {
+    size_t const end_slot = shard.first_slot + shard.number_of_slots;
+    // Advance the hand to the first slot that was not referenced, clearing the reference bits on the way.
+    while (block_cache_referenced[shard.hand])
+    {
+      block_cache_referenced[shard.hand] = 0;
+      if (++shard.hand == end_slot)
+	shard.hand = shard.first_slot;
+    }
+    size_t slot = shard.hand;
+    if (++shard.hand == end_slot)
+      shard.hand = shard.first_slot;
+    if (block_cache_block[slot] != -1)
+      block_cache_erase(shard, block_cache_find(shard, block_cache_block[slot]));
+    block_cache_block[slot] = block;
+    // Find the position again: erasing might have moved the empty position.
+    shard.index[block_cache_find(shard, block)] = slot + 1;
+    std::memcpy(block_cache_data + slot * block_size_, block_buf, block_size_);
+  }
+  pthread_mutex_unlock(&shard.mutex);
+}
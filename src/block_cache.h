@@ -0,0 +1,82 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file block_cache.h Declaration of the block cache and I/O statistics.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#ifndef USE_PCH
+#include <stdint.h>	// Needed for uint64_t
+#include <cstddef>	// Needed for size_t
+#endif
+
+// The block cache.
+//
+// get_block() first looks up the requested block in a bounded cache
+// of commandline_cache_size MiB, replacing blocks with the CLOCK algorithm
+// (a block that was used since the hand last passed it gets a second chance).
+// Bulk reads (get_blocks, ReadAhead) bypass the cache: they stream over
+// large parts of the device and would only evict blocks that are reused.
+//
+// The cache is safe to use from multiple threads; it is split into shards
+// with a lock each, so that threads that read different blocks rarely wait.
+
+// Copy block into block_buf and return true if it is in the cache.
+bool block_cache_lookup(int block, unsigned char* block_buf);
+
+// Add block, just read from the device into block_buf, to the cache.
+void block_cache_insert(int block, unsigned char const* block_buf);
+
+// I/O statistics.
+//
+// Every read from the device, and every lookup in the block cache, is
+// counted for the stage that the program is in at that moment (see
+// class IOStage). The totals are printed at exit when --stats is given.
+
+enum io_stage_type {
+  io_stage_other,		// Anything not covered by one of the stages below.
+  io_stage_metadata,		// Loading the group descriptors, bitmaps and inode tables.
+  io_stage_journal,		// Loading the journal descriptors.
+  io_stage_stage1,		// Finding all directory blocks (stage 1).
+  io_stage_stage2,		// Determining the inode of each directory block (stage 2).
+  io_stage_block_to_inode,	// Building the block to inode index.
+  io_stage_block_types,		// Building the block type map.
+  number_of_io_stages
+};
+
+// Count a read of size bytes from the device.
+void io_stats_read(size_t size);
+
+// Set the current stage for the life time of the object, restoring the previous stage when it is destructed.
+class IOStage {
+  private:
+    io_stage_type M_previous;
+
+  public:
+    IOStage(io_stage_type stage);
+    ~IOStage();
+};
+
+// Print the I/O statistics to std::cout.
+void print_io_stats(void);
+
+#endif // BLOCK_CACHE_H
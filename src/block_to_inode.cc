@@ -0,0 +1,226 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file block_to_inode.cc Implementation of the reverse block to inode index.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include "debug.h"
+#endif
+
+#include "block_to_inode.h"
+#include "cache_file.h"
+#include "globals.h"
+#include "indirect_blocks.h"
+#include "inode.h"
+#include "is_blockdetection.h"
+#include "block_cache.h"
+
+//-----------------------------------------------------------------------------
+//
+// block_to_inode
+//
+// The index is a list of runs of consecutive blocks that are referenced by
+// the same inode, sorted by first block. Since files are mostly contiguous,
+// this is orders of magnitude smaller than a table with an entry per block.
+//
+// Runs of different inodes can overlap (when a block is referenced by more
+// than one inode). Therefore we also store, for every run, the largest end
+// block of that and all previous runs; a lookup finds the last run that
+// starts at or before the block with a binary search, and then only has to
+// walk back over runs whose running maximum end lies beyond the block.
+
+struct BlockRun {
+  uint32_t first_block;
+  uint32_t count;
+  uint32_t inode;
+};
+
+struct BlockRunOrder {
+  bool operator()(BlockRun const& run1, BlockRun const& run2) const
+      { return run1.first_block < run2.first_block || (run1.first_block == run2.first_block && run1.inode < run2.inode); }
+};
+
+// The index, either in memory or mmapped from the cache file.
+static BlockRun const* block_runs;
+static uint32_t const* block_runs_max_end;
+static size_t number_of_block_runs;
+// Inodes whose block list contains a corrupt (or reused) indirect block; only the blocks before it are in the index.
+static uint32_t const* corrupt_inodes;
+static size_t number_of_corrupt_inodes;
+
+static std::vector<BlockRun> block_runs_vector;
+static std::vector<uint32_t> block_runs_max_end_vector;
+static std::vector<uint32_t> corrupt_inodes_vector;
+static CacheFileReader block_to_inode_cache;
+
+struct build_block_runs_data_st {
+  std::vector<BlockRun>* runs;
+  uint32_t inode;
+};
+
+static void build_block_runs_action(int blocknr, int, void* ptr)
+{
+  build_block_runs_data_st& data(*reinterpret_cast<build_block_runs_data_st*>(ptr));
+  std::vector<BlockRun>& runs(*data.runs);
+  if (!runs.empty() && runs.back().inode == data.inode && runs.back().first_block + runs.back().count == (uint32_t)blocknr)
+    ++runs.back().count;
+  else
+  {
+    BlockRun run;
+    run.first_block = blocknr;
+    run.count = 1;
+    run.inode = data.inode;
+    runs.push_back(run);
+  }
+}
+
+#ifdef CPPGRAPH
+void iterate_over_all_blocks_of__with__build_block_runs_action(void) { build_block_runs_action(0, 0, NULL); }
+#endif
+
+// Iterate over the block lists of all inodes, in one pass.
+static void build_block_to_inode(void)
+{
+  build_block_runs_data_st data;
+  data.runs = &block_runs_vector;
+  for (uint32_t inode = 1; inode <= inode_count_; ++inode)
+  {
+    InodePointer ino = get_inode(inode);
+    if (is_symlink(ino))
+      continue;		// Does not refer to any block, and indirect blocks to run over.
+    data.inode = inode;
+#ifdef CPPGRAPH
+    // Tell cppgraph that we call build_block_runs_action from here.
+    iterate_over_all_blocks_of__with__build_block_runs_action();
+#endif
+    if (iterate_over_all_blocks_of(ino, inode, build_block_runs_action, &data))
+      corrupt_inodes_vector.push_back(inode);
+    if (inode % inodes_per_group_ == 0)
+      std::cout << '.' << std::flush;
+  }
+  std::sort(block_runs_vector.begin(), block_runs_vector.end(), BlockRunOrder());
+  block_runs_max_end_vector.resize(block_runs_vector.size());
+  uint32_t max_end = 0;
+  for (size_t i = 0; i < block_runs_vector.size(); ++i)
+  {
+    max_end = std::max(max_end, block_runs_vector[i].first_block + block_runs_vector[i].count);
+    block_runs_max_end_vector[i] = max_end;
+  }
+}
+
+// Return true if the runs in block_to_inode_cache are sorted and every running maximum end block
+// is what build_block_to_inode computes, so that block_to_inode can rely on it when it walks back.
+static bool block_to_inode_cache_is_valid(void)
+{
+  if (!block_to_inode_cache.has_sections(3))
+    return block_to_inode_cache.corrupt();
+  size_t count, number_of_max_end;
+  BlockRun const* runs = block_to_inode_cache.section<BlockRun>(0, count);
+  uint32_t const* max_end = block_to_inode_cache.section<uint32_t>(1, number_of_max_end);
+  if (number_of_max_end != count)
+    return block_to_inode_cache.corrupt();
+  uint32_t expected_max_end = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    expected_max_end = std::max(expected_max_end, runs[i].first_block + runs[i].count);
+    if (max_end[i] != expected_max_end || (i > 0 && BlockRunOrder()(runs[i], runs[i - 1])))
+      return block_to_inode_cache.corrupt();
+  }
+  return true;
+}
+
+void init_block_to_inode(void)
+{
+  static bool initialized = false;
+  if (initialized)
+    return;
+  initialized = true;
+
+  IOStage io_stage(io_stage_block_to_inode);
+  std::string cache_block2inode = cache_filename("block2inode");
+  struct stat sb;
+  bool have_cache = !(stat(cache_block2inode.c_str(), &sb) == -1);
+  if (have_cache)
+    have_cache = block_to_inode_cache.open(cache_block2inode, "blk2ino") && block_to_inode_cache_is_valid();
+  else if (errno != ENOENT)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to open \"" << cache_block2inode << "\": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (have_cache)
+  {
+    std::cout << "Loading " << cache_block2inode << "...\n";
+    size_t number_of_max_end;
+    block_runs = block_to_inode_cache.section<BlockRun>(0, number_of_block_runs);
+    block_runs_max_end = block_to_inode_cache.section<uint32_t>(1, number_of_max_end);
+    corrupt_inodes = block_to_inode_cache.section<uint32_t>(2, number_of_corrupt_inodes);
+    return;
+  }
+  std::cout << "Building block to inode index" << std::flush;
+  build_block_to_inode();
+  std::cout << " done\n";
+  std::cout << "Writing index to '" << cache_block2inode << "'. Delete that file if you want to build it again.\n";
+  CacheFileWriter cache(cache_block2inode, "blk2ino");
+  cache.add_section(block_runs_vector.empty() ? NULL : &block_runs_vector[0], block_runs_vector.size() * sizeof(BlockRun));
+  cache.add_section(block_runs_max_end_vector.empty() ? NULL : &block_runs_max_end_vector[0], block_runs_max_end_vector.size() * sizeof(uint32_t));
+  cache.add_section(corrupt_inodes_vector.empty() ? NULL : &corrupt_inodes_vector[0], corrupt_inodes_vector.size() * sizeof(uint32_t));
+  cache.commit();
+  number_of_block_runs = block_runs_vector.size();
+  block_runs = block_runs_vector.empty() ? NULL : &block_runs_vector[0];
+  block_runs_max_end = block_runs_max_end_vector.empty() ? NULL : &block_runs_max_end_vector[0];
+  number_of_corrupt_inodes = corrupt_inodes_vector.size();
+  corrupt_inodes = corrupt_inodes_vector.empty() ? NULL : &corrupt_inodes_vector[0];
+}
+
+void block_to_inode(int block, std::vector<uint32_t>& inodes)
+{
+  init_block_to_inode();
+  inodes.clear();
+  BlockRun key;
+  key.first_block = block;
+  key.count = 0;
+  key.inode = std::numeric_limits<uint32_t>::max();
+  // Find the first run that starts after block.
+  size_t i = std::upper_bound(block_runs, block_runs + number_of_block_runs, key, BlockRunOrder()) - block_runs;
+  while (i > 0 && block_runs_max_end[i - 1] > (uint32_t)block)
+  {
+    --i;
+    if (block_runs[i].first_block + block_runs[i].count > (uint32_t)block)
+      inodes.push_back(block_runs[i].inode);
+  }
+  std::sort(inodes.begin(), inodes.end());
+  inodes.erase(std::unique(inodes.begin(), inodes.end()), inodes.end());
+}
+
+void block_to_inode_incomplete_inodes(std::vector<uint32_t>& inodes)
+{
+  init_block_to_inode();
+  inodes.assign(corrupt_inodes, corrupt_inodes + number_of_corrupt_inodes);
+}
@@ -0,0 +1,45 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file block_to_inode.h Declaration of the reverse block to inode index.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BLOCK_TO_INODE_H
+#define BLOCK_TO_INODE_H
+
+#ifndef USE_PCH
+#include <stdint.h>	// Needed for uint32_t
+#include <vector>
+#endif
+
+// Build the index of which inodes refer to which blocks, or load it from
+// the cache file <device>.ext3grep.block2inode when that exists.
+void init_block_to_inode(void);
+
+// Set 'inodes' to the (sorted) inodes whose block list contains 'block'.
+// The block lists are iterated over like iterate_over_all_blocks_of does
+// (direct blocks only, indirect blocks themselves are not included).
+void block_to_inode(int block, std::vector<uint32_t>& inodes);
+
+// Set 'inodes' to the inodes whose block list contains a reused or corrupt indirect block.
+// Only the blocks before that indirect block are in the index.
+void block_to_inode_incomplete_inodes(std::vector<uint32_t>& inodes);
+
+#endif // BLOCK_TO_INODE_H
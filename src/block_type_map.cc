@@ -0,0 +1,204 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file block_type_map.cc Implementation of the block type map.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "debug.h"
+#endif
+
+#include "block_type_map.h"
+#include "globals.h"
+#include "superblock.h"
+#include "read_ahead.h"
+#include "scan_groups.h"
+#include "cache_file.h"
+#include "block_cache.h"
+#include "is_blockdetection.h"
+#include "forward_declarations.h"
+
+//-----------------------------------------------------------------------------
+//
+// The block type map
+//
+// Stage 1 only needs to read the blocks that is_directory could accept. The
+// block type map finds those once, in a single parallel scan of every block
+// of the device, so that stage 1 (also after a checkpoint or after --accept
+// changed) only has to read the candidates.
+//
+// The map stores the block_type of every block in four bits; block 2n in
+// the low and block 2n+1 in the high nibble of byte n. It is stored in the
+// cache file <device>.ext3grep.btypes as a single section. While the map
+// is built, the types of every classified group are appended to the checkpoint
+// file <device>.ext3grep.btypes.partial, so that an interrupted run (and with
+// it stage 1) can be resumed.
+
+// The map, pointing into block_type_map_data or into block_type_map_cache.
+static unsigned char const* block_types;
+static std::vector<unsigned char> block_type_map_data;
+static CacheFileReader block_type_map_cache;
+
+// Return the type of block 'block' with content block_ptr.
+static block_type classify_block(unsigned char* block_ptr, int block)
+{
+  DirectoryBlockStats stats;
+  stats.set_classify();
+  // Not certainly linked: stage 1 prints the warnings about zero inodes when it looks at the block.
+  is_directory_type isdir = is_directory(block_ptr, block, stats, false, false);
+  // accept_filename checks the names from the last entry back to the first, so unlikely names
+  // can have been counted before an earlier entry rejected the block.
+  if (isdir == isdir_no)
+    return block_type_unknown;
+  if (stats.number_of_unlikely_entries() > 0)
+    return block_type_directory_unlikely;
+  return isdir == isdir_start ? block_type_directory_start : block_type_directory_extended;
+}
+
+// The state of the classification scan.
+struct BlockTypeScan {
+  std::vector<std::vector<unsigned char> > groups;	// The types of the blocks of each group, one byte per block, until they are committed.
+  CheckpointFile checkpoint;				// The types of all committed groups, so that the scan can be resumed.
+  int next_group;					// The first group that wasn't classified yet.
+};
+
+// Classify all blocks of a group. Called from a worker thread.
+static void block_type_process_group(int group, int, void* data)
+{
+  std::vector<unsigned char>& types(static_cast<BlockTypeScan*>(data)->groups[group]);
+  int first_block = first_data_block(super_block) + group * blocks_per_group(super_block);
+  int last_block = std::min(first_block + blocks_per_group(super_block), block_count(super_block));
+  types.resize(last_block - first_block);
+  ReadAhead read_ahead;
+  read_ahead.add_range(first_block, last_block);
+  read_ahead.start();
+  int block;
+  unsigned char* block_ptr;
+  while ((block_ptr = read_ahead.next_block(block)))
+    types[block - first_block] = classify_block(block_ptr, block);
+}
+
+// Store the types of the 'size' blocks of a group in the map.
+static void store_group_types(int group, unsigned char const* types, size_t size)
+{
+  int first_block = first_data_block(super_block) + group * blocks_per_group(super_block);
+  for (size_t i = 0; i < size; ++i)
+  {
+    int block = first_block + i;
+    block_type_map_data[block >> 1] |= types[i] << ((block & 1) << 2);
+  }
+}
+
+// Store the types of the blocks of a group in the map and append them to the checkpoint file. Called in group order.
+static void block_type_commit_group(int group, void* data)
+{
+  BlockTypeScan& scan(*static_cast<BlockTypeScan*>(data));
+  std::vector<unsigned char>& types(scan.groups[group]);
+  store_group_types(group, &types[0], types.size());
+  scan.checkpoint.append(group, &types[0], types.size());
+  std::vector<unsigned char>().swap(types);
+  std::cout << '.' << std::flush;
+}
+
+// Store the types of the blocks of a group that was committed before the scan was interrupted.
+// Called for every record of the checkpoint file, in order.
+static bool block_type_resume_group(uint32_t group, char const* data, size_t size, void* user_data)
+{
+  BlockTypeScan& scan(*static_cast<BlockTypeScan*>(user_data));
+  if (group != (uint32_t)scan.next_group)
+    return false;
+  int first_block = first_data_block(super_block) + group * blocks_per_group(super_block);
+  int last_block = std::min(first_block + blocks_per_group(super_block), block_count(super_block));
+  if (size != (size_t)(last_block - first_block))
+    return false;
+  unsigned char const* types = reinterpret_cast<unsigned char const*>(data);
+  for (size_t i = 0; i < size; ++i)
+    if (types[i] >= number_of_block_types)
+      return false;
+  store_group_types(group, types, size);
+  ++scan.next_group;
+  return true;
+}
+
+void init_block_type_map(void)
+{
+  if (block_types)
+    return;
+
+  IOStage io_stage(io_stage_block_types);
+  size_t const map_size = (block_count(super_block) + 1) / 2;
+  std::string cache_block_types = cache_filename("btypes");
+  struct stat sb;
+  bool have_cache = !(stat(cache_block_types.c_str(), &sb) == -1);
+  if (have_cache)
+    have_cache = block_type_map_cache.open(cache_block_types, "btypes");
+  else if (errno != ENOENT)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to open \"" << cache_block_types << "\": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (have_cache)
+  {
+    size_t count = 0;
+    unsigned char const* cached_block_types = NULL;
+    if (block_type_map_cache.has_sections(1))
+      cached_block_types = block_type_map_cache.section<unsigned char>(0, count);
+    if (count == map_size)
+    {
+      std::cout << "Loading " << cache_block_types << "...\n";
+      block_types = cached_block_types;
+      return;
+    }
+    // Classify the blocks again.
+    block_type_map_cache.corrupt();
+  }
+  std::cout << "Classifying all blocks" << std::flush;
+  block_type_map_data.resize(map_size);
+  BlockTypeScan scan;
+  scan.groups.resize(groups_);
+  scan.next_group = 0;
+  std::string checkpoint_block_types = cache_block_types + ".partial";
+  scan.checkpoint.open(checkpoint_block_types, "btypes", block_type_resume_group, &scan);
+  if (scan.next_group > 0)
+    std::cout << " (resuming from '" << checkpoint_block_types << "': groups 0 through " << (scan.next_group - 1) << " were already classified)" << std::flush;
+  scan_groups(scan.next_group, groups_, block_type_process_group, block_type_commit_group, &scan);
+  std::cout << " done\n";
+  std::cout << "Writing block type map to '" << cache_block_types << "'. Delete that file if you want to build it again.\n";
+  CacheFileWriter cache(cache_block_types, "btypes");
+  add_vector_section(cache, block_type_map_data);
+  cache.commit();
+  scan.checkpoint.remove();
+  block_types = &block_type_map_data[0];
+}
+
+block_type get_block_type(int block)
+{
+  ASSERT(block_types && block >= 0 && block < block_count(super_block));
+  return static_cast<block_type>((block_types[block >> 1] >> ((block & 1) << 2)) & 0xf);
+}
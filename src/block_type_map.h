@@ -0,0 +1,50 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file block_type_map.h Declaration of the block type map.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BLOCK_TYPE_MAP_H
+#define BLOCK_TYPE_MAP_H
+
+// The type of a block, as far as stage 1 is concerned: whether is_directory
+// accepts it, and how. The map is a filter of the blocks that stage 1 reads.
+enum block_type {
+  block_type_unknown,			// Not a directory block.
+  block_type_directory_start,		// is_directory returns isdir_start.
+  block_type_directory_extended,	// is_directory returns isdir_extended.
+  block_type_directory_unlikely,	// A directory block, but only when the unlikely characters of some entry are accepted (see --accept).
+  number_of_block_types
+};
+
+// Find all possible directory blocks with a single scan, or load the block
+// type map from the cache file <device>.ext3grep.btypes when that exists.
+void init_block_type_map(void);
+
+// Return the type of 'block'. init_block_type_map must have been called.
+block_type get_block_type(int block);
+
+// Return true if 'type' is one of the directory types.
+inline bool is_directory_block_type(block_type type)
+{
+  return type == block_type_directory_start || type == block_type_directory_extended || type == block_type_directory_unlikely;
+}
+
+#endif // BLOCK_TYPE_MAP_H
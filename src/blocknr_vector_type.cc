@@ -28,23 +28,27 @@
 #include "blocknr_vector_type.h"
 
 blocknr_vector_type& blocknr_vector_type::operator=(std::vector<uint32_t> const& vec)
+{
+  assign(vec.empty() ? NULL : &vec[0], vec.size());
+  return *this;
+}
+
+void blocknr_vector_type::assign(uint32_t const* blocks, uint32_t size)
 {
   if (!empty())
     erase();
-  uint32_t size = vec.size();
   if (size > 0)
   {
     if (size == 1)
-      blocknr = (vec[0] << 1) | 1; 
+      blocknr = (blocks[0] << 1) | 1; 
     else
     {
       blocknr_vector = new uint32_t [size + 1]; 
       blocknr_vector[0] = size;
       for (uint32_t i = 0; i < size; ++i)
-        blocknr_vector[i + 1] = vec[i];
+        blocknr_vector[i + 1] = blocks[i];
     }
   }
-  return *this;
 }
 
 void blocknr_vector_type::push_back(uint32_t bnr)
@@ -42,6 +42,7 @@ union blocknr_vector_type {
   void remove(uint32_t blocknr);
   void erase(void) { if (is_vector()) delete [] blocknr_vector; blocknr = 0; }
   blocknr_vector_type& operator=(std::vector<uint32_t> const& vec);
+  void assign(uint32_t const* blocks, uint32_t size);
 
   bool empty(void) const { return blocknr == 0; }
   // The rest is only valid if empty() returned false.
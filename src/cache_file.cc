@@ -0,0 +1,413 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file cache_file.cc Implementation of the binary cache file format.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <iostream>
+#include "ext3.h"
+#include "debug.h"
+#endif
+
+#include "cache_file.h"
+#include "globals.h"
+#include "superblock.h"
+#include "journal_overlay.h"
+
+static char const cache_file_magic[8] = { 'e', 'x', 't', '3', 'g', 'r', 'e', 'p' };
+
+std::string cache_filename(char const* stage)
+{
+  std::string device_name_basename = device_name.substr(device_name.find_last_of('/') + 1);
+  if (journal_overlay_active)
+  {
+    // The contents of the file depend on the state of the file system that was used.
+    std::ostringstream as_of;
+    as_of << device_name_basename << ".ext3grep.as-of-" << journal_overlay_sequence << '.' << stage;
+    return as_of.str();
+  }
+  return device_name_basename + ".ext3grep." + stage;
+}
+
+bool is_binary_cache_file(std::string const& filename)
+{
+  std::ifstream cache;
+  cache.open(filename.c_str());
+  char magic[sizeof(cache_file_magic)];
+  cache.read(magic, sizeof(magic));
+  bool binary = cache.good() && std::memcmp(magic, cache_file_magic, sizeof(magic)) == 0;
+  cache.close();
+  return binary;
+}
+
+// Fill header with the values of the current file system.
+static void init_header(CacheFileHeader& header, char const* stage)
+{
+  std::memset(&header, 0, sizeof(CacheFileHeader));
+  std::memcpy(header.magic, cache_file_magic, sizeof(header.magic));
+  header.version = cache_file_version;
+  header.byte_order = 0x01020304;
+  ASSERT(strlen(stage) < sizeof(header.stage));
+  strncpy(header.stage, stage, sizeof(header.stage));
+  std::memcpy(header.uuid, super_block.s_uuid, sizeof(header.uuid));
+  header.wtime = super_block.s_wtime;
+  header.mtime = super_block.s_mtime;
+  header.block_size = block_size_;
+  header.blocks_count = block_count(super_block);
+  header.inodes_count = inode_count_;
+}
+
+// Return NULL if header is a valid header of a 'stage' cache file of the current file system, or the reason why not.
+static char const* check_header(CacheFileHeader const& header, char const* stage)
+{
+  CacheFileHeader expected;
+  init_header(expected, stage);
+  if (std::memcmp(header.magic, expected.magic, sizeof(expected.magic)) != 0)
+    return "it is not a binary cache file";
+  if (header.byte_order != expected.byte_order)
+    return "it was written on a machine with a different byte order";
+  if (header.version != expected.version)
+    return "it was written by a different version of ext3grep";
+  if (std::memcmp(header.stage, expected.stage, sizeof(expected.stage)) != 0)
+    return "it contains the data of a different stage";
+  if (std::memcmp(header.uuid, expected.uuid, sizeof(expected.uuid)) != 0 ||
+      header.block_size != expected.block_size ||
+      header.blocks_count != expected.blocks_count ||
+      header.inodes_count != expected.inodes_count)
+    return "it belongs to a different file system";
+  if (header.wtime != expected.wtime || header.mtime != expected.mtime)
+    return "the file system was mounted or written to after it was created";
+  if (header.number_of_sections > (uint32_t)cache_file_max_sections)
+    return "it is corrupt";
+  return NULL;
+}
+
+// Write size bytes of data at offset to fd. Returns false (with errno set) if that failed.
+static bool write_at(int fd, void const* data, size_t size, uint64_t offset)
+{
+  char const* ptr = static_cast<char const*>(data);
+  while (size > 0)
+  {
+    ssize_t res = pwrite(fd, ptr, size, offset);
+    if (res == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    ptr += res;
+    offset += res;
+    size -= res;
+  }
+  return true;
+}
+
+CacheFileWriter::CacheFileWriter(std::string const& filename, char const* stage) :
+    M_filename(filename), M_tmp_filename(filename + ".tmp"), M_offset(sizeof(CacheFileHeader))
+{
+  init_header(M_header, stage);
+  M_fd = ::open(M_tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (M_fd == -1)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << "WARNING: failed to open \"" << M_tmp_filename << "\" for writing: " << strerror(error) <<
+        ". Continuing without writing \"" << M_filename << "\"." << std::endl;
+  }
+}
+
+CacheFileWriter::~CacheFileWriter()
+{
+  if (M_fd != -1)	// Not committed?
+  {
+    close(M_fd);
+    unlink(M_tmp_filename.c_str());
+  }
+}
+
+// Print a warning about the failed operation 'what' and give up on writing the cache file.
+void CacheFileWriter::fail(char const* what)
+{
+  int error = errno;
+  std::cout << std::flush;
+  std::cerr << "WARNING: failed to " << what << " \"" << M_tmp_filename << "\": " << strerror(error) <<
+      ". Continuing without writing \"" << M_filename << "\"." << std::endl;
+  close(M_fd);
+  M_fd = -1;
+  unlink(M_tmp_filename.c_str());
+}
+
+void CacheFileWriter::add_section(void const* data, size_t size)
+{
+  if (M_fd == -1)
+    return;
+  ASSERT(M_header.number_of_sections < (uint32_t)cache_file_max_sections);
+  CacheFileSection& section(M_header.section[M_header.number_of_sections++]);
+  section.offset = M_offset;
+  section.size = size;
+  if (size > 0 && !write_at(M_fd, data, size, M_offset))
+  {
+    fail("write to");
+    return;
+  }
+  // Align the next section at 8 bytes.
+  M_offset += (size + 7) & ~(uint64_t)7;
+}
+
+void CacheFileWriter::commit(void)
+{
+  if (M_fd == -1)
+    return;
+  // Make sure the file has the size of the aligned last section.
+  if (ftruncate(M_fd, M_offset) == -1)
+  {
+    fail("truncate");
+    return;
+  }
+  if (!write_at(M_fd, &M_header, sizeof(CacheFileHeader), 0))
+  {
+    fail("write to");
+    return;
+  }
+  // The data must be on disk before the file gets its final name, or after a power loss
+  // that name could refer to a file that was never completely written.
+  if (fsync(M_fd) == -1)
+  {
+    fail("sync");
+    return;
+  }
+  close(M_fd);
+  M_fd = -1;
+  if (rename(M_tmp_filename.c_str(), M_filename.c_str()) == -1)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << "WARNING: failed to rename \"" << M_tmp_filename << "\" to \"" << M_filename << "\": " << strerror(error) << std::endl;
+    unlink(M_tmp_filename.c_str());
+  }
+}
+
+CacheFileReader::~CacheFileReader()
+{
+  if (M_map)
+    munmap(M_map, M_size);
+  if (M_fd != -1)
+    close(M_fd);
+}
+
+bool CacheFileReader::open(std::string const& filename, char const* stage)
+{
+  ASSERT(M_fd == -1);
+  M_filename = filename;
+  M_fd = ::open(filename.c_str(), O_RDONLY);
+  if (M_fd == -1)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to open \"" << filename << "\": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  struct stat sb;
+  if (fstat(M_fd, &sb) == -1)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to stat \"" << filename << "\": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  M_size = sb.st_size;
+  if (M_size < sizeof(CacheFileHeader))
+  {
+    std::cout << "Ignoring \"" << filename << "\": the file is truncated.\n";
+    return false;
+  }
+  void* map = mmap(NULL, M_size, PROT_READ, MAP_PRIVATE, M_fd, 0);
+  if (map == MAP_FAILED)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to mmap \"" << filename << "\": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  M_map = static_cast<char*>(map);
+  M_header = reinterpret_cast<CacheFileHeader const*>(M_map);
+  char const* reason = check_header(*M_header, stage);
+  if (!reason)
+  {
+    for (uint32_t i = 0; i < M_header->number_of_sections; ++i)
+      if (M_header->section[i].offset < sizeof(CacheFileHeader) || M_header->section[i].offset % 8 != 0 ||
+          M_header->section[i].offset > M_size || M_header->section[i].size > M_size - M_header->section[i].offset)
+	reason = "it is corrupt";
+  }
+  if (reason)
+  {
+    std::cout << "Ignoring \"" << filename << "\": " << reason << ".\n";
+    return false;
+  }
+  return true;
+}
+
+bool CacheFileReader::corrupt(void) const
+{
+  std::cout << "Ignoring \"" << M_filename << "\": it is corrupt.\n";
+  return false;
+}
+
+// FNV-1a hash of a record.
+static uint32_t record_checksum(uint32_t key, uint32_t size, char const* data)
+{
+  uint32_t hash = 2166136261U;
+  uint32_t const header[2] = { key, size };
+  unsigned char const* ptr = reinterpret_cast<unsigned char const*>(header);
+  for (size_t i = 0; i < sizeof(header); ++i)
+    hash = (hash ^ ptr[i]) * 16777619U;
+  ptr = reinterpret_cast<unsigned char const*>(data);
+  for (uint32_t i = 0; i < size; ++i)
+    hash = (hash ^ ptr[i]) * 16777619U;
+  return hash;
+}
+
+CheckpointFile::~CheckpointFile()
+{
+  if (M_fd != -1)
+    close(M_fd);
+}
+
+void CheckpointFile::open(std::string const& filename, char const* stage,
+    bool (*read_record)(uint32_t key, char const* data, size_t size, void* user_data), void* user_data)
+{
+  ASSERT(M_fd == -1);
+  M_filename = filename;
+  M_fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (M_fd == -1)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << "WARNING: failed to open \"" << filename << "\": " << strerror(error) <<
+        ". Continuing without checkpoints; an interrupted run will have to start over." << std::endl;
+    return;
+  }
+  CacheFileHeader header;
+  ssize_t len = pread(M_fd, &header, sizeof(CacheFileHeader), 0);
+  if (len == (ssize_t)sizeof(CacheFileHeader))
+  {
+    char const* reason = check_header(header, stage);
+    if (reason)
+      std::cout << "Ignoring \"" << filename << "\": " << reason << ".\n";
+    else
+    {
+      M_offset = sizeof(CacheFileHeader);
+      // The size of a torn record at the end can be anything; never read past the end of the file.
+      struct stat sb;
+      uint64_t file_size = (fstat(M_fd, &sb) == -1) ? 0 : sb.st_size;
+      std::vector<char> data;
+      CheckpointRecordHeader record;
+      while (pread(M_fd, &record, sizeof(record), M_offset) == (ssize_t)sizeof(record))
+      {
+        if (M_offset + sizeof(record) + record.size > file_size)
+	  break;
+        data.resize((size_t)record.size + 1);
+	if (pread(M_fd, &data[0], record.size, M_offset + sizeof(record)) != (ssize_t)record.size ||
+	    record_checksum(record.key, record.size, &data[0]) != record.checksum ||
+	    !read_record(record.key, &data[0], record.size, user_data))
+	  break;
+	M_offset += sizeof(record) + ((record.size + 7) & ~(uint64_t)7);
+      }
+    }
+  }
+  if (M_offset == 0)
+  {
+    // Start a new checkpoint file.
+    init_header(header, stage);
+    if (!write_at(M_fd, &header, sizeof(CacheFileHeader), 0))
+    {
+      fail("write to");
+      return;
+    }
+    M_offset = sizeof(CacheFileHeader);
+  }
+  // Drop everything after the last valid record.
+  if (ftruncate(M_fd, M_offset) == -1)
+  {
+    fail("truncate");
+    return;
+  }
+  M_last_sync = time(NULL);
+}
+
+// Print a warning about the failed operation 'what' and stop writing checkpoints.
+void CheckpointFile::fail(char const* what)
+{
+  int error = errno;
+  std::cout << std::flush;
+  std::cerr << "WARNING: failed to " << what << " \"" << M_filename << "\": " << strerror(error) <<
+      ". Continuing without checkpoints; an interrupted run will have to start over." << std::endl;
+  close(M_fd);
+  M_fd = -1;
+  unlink(M_filename.c_str());
+}
+
+void CheckpointFile::append(uint32_t key, void const* data, size_t size)
+{
+  if (M_fd == -1)
+    return;
+  static char const padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  CheckpointRecordHeader record;
+  record.key = key;
+  record.size = size;
+  record.checksum = record_checksum(key, size, static_cast<char const*>(data));
+  record.padding = 0;
+  if (!write_at(M_fd, &record, sizeof(record), M_offset) ||
+      !write_at(M_fd, data, size, M_offset + sizeof(record)) ||
+      !write_at(M_fd, padding, ((size + 7) & ~(size_t)7) - size, M_offset + sizeof(record) + size))
+  {
+    fail("write to");
+    return;
+  }
+  M_offset += sizeof(record) + ((size + 7) & ~(uint64_t)7);
+  time_t now = time(NULL);
+  if (now - M_last_sync >= checkpoint_sync_interval)
+  {
+    fdatasync(M_fd);
+    M_last_sync = now;
+  }
+}
+
+void CheckpointFile::remove(void)
+{
+  if (M_fd == -1)
+    return;
+  close(M_fd);
+  M_fd = -1;
+  unlink(M_filename.c_str());
+}
@@ -0,0 +1,214 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file cache_file.h Declaration of the binary cache file format and related functions.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#ifndef USE_PCH
+#include <stdint.h>	// Needed for uint32_t and uint64_t
+#include <string>	// Needed for std::string
+#include <cstddef>	// Needed for size_t
+#include <ctime>	// Needed for time_t
+#include <vector>	// Needed for std::vector
+#include "debug.h"
+#endif
+
+// The format of newly written stage* cache files (--cache-format).
+enum cache_format_type {
+  cache_format_binary,
+  cache_format_text
+};
+
+// Return the name of the cache file for 'stage' (ie, "stage1").
+// When --as-of seq is in effect the name is <device>.ext3grep.as-of-seq.<stage>.
+std::string cache_filename(char const* stage);
+
+// Return true if the file 'filename' starts with the magic of a binary cache file.
+bool is_binary_cache_file(std::string const& filename);
+
+//-----------------------------------------------------------------------------
+//
+// Binary cache files
+//
+// A binary cache file starts with a CacheFileHeader, followed by a number of
+// sections. Each section is a packed array of fixed size records (or characters)
+// and starts at a multiple of 8 bytes. All values are in host byte order.
+//
+// The header contains the UUID, write time and mount time of the file system,
+// so that we don't use a cache file of another file system (or of the same file
+// system after it was changed). The file is written under a temporary name and
+// renamed when it is complete, so an existing cache file is always complete.
+
+// Increment this whenever the layout of the header or of any section changes.
+uint32_t const cache_file_version = 3;
+
+int const cache_file_max_sections = 24;
+
+struct CacheFileSection {
+  uint64_t offset;		// Offset of the section from the start of the file.
+  uint64_t size;		// Size of the section in bytes.
+};
+
+struct CacheFileHeader {
+  char magic[8];		// "ext3grep"
+  uint32_t version;		// cache_file_version.
+  uint32_t byte_order;		// 0x01020304, in host byte order.
+  char stage[8];		// The stage, for example "stage1" (zero padded).
+  uint8_t uuid[16];		// Copy of super_block.s_uuid.
+  uint32_t wtime;		// Copy of super_block.s_wtime.
+  uint32_t mtime;		// Copy of super_block.s_mtime.
+  uint32_t block_size;
+  uint32_t blocks_count;
+  uint32_t inodes_count;
+  uint32_t number_of_sections;
+  CacheFileSection section[cache_file_max_sections];
+};
+
+// Write a binary cache file.
+class CacheFileWriter {
+  private:
+    std::string M_filename;
+    std::string M_tmp_filename;
+    int M_fd;
+    uint64_t M_offset;		// The size of the file written so far.
+    CacheFileHeader M_header;
+
+    void fail(char const* what);
+
+  public:
+    // Writing a cache file is best-effort: if the file can't be written, a warning is printed
+    // and add_section and commit do nothing.
+    CacheFileWriter(std::string const& filename, char const* stage);
+    ~CacheFileWriter();
+
+    // Return true if the file can still be written.
+    bool is_open(void) const { return M_fd != -1; }
+
+    // Append the next section.
+    void add_section(void const* data, size_t size);
+
+    // Write the header and rename the file to its final name.
+    void commit(void);
+};
+
+// Read a binary cache file.
+class CacheFileReader {
+  private:
+    std::string M_filename;
+    int M_fd;
+    char* M_map;
+    size_t M_size;
+    CacheFileHeader const* M_header;
+
+  public:
+    CacheFileReader(void) : M_fd(-1), M_map(NULL), M_size(0), M_header(NULL) { }
+    ~CacheFileReader();
+
+    // Map the file 'filename' into memory and check that it is a valid 'stage' cache file of the current file system.
+    // Returns false (after printing the reason) if it is not.
+    bool open(std::string const& filename, char const* stage);
+
+    // Return true if the file has at least 'count' sections.
+    bool has_sections(int count) const { return (int)M_header->number_of_sections >= count; }
+
+    // Print that the file is ignored because its contents are corrupt and return false.
+    bool corrupt(void) const;
+
+    // Return section 'index' as an array of T and set 'count' to the number of elements.
+    template<typename T>
+    T const* section(int index, size_t& count) const
+    {
+      ASSERT(index < (int)M_header->number_of_sections);
+      count = M_header->section[index].size / sizeof(T);
+      return reinterpret_cast<T const*>(M_map + M_header->section[index].offset);
+    }
+};
+
+// Append column as the next section of cache.
+template<typename T>
+void add_vector_section(CacheFileWriter& cache, std::vector<T> const& column)
+{
+  cache.add_section(column.empty() ? NULL : &column[0], column.size() * sizeof(T));
+}
+
+// Copy section 'index' of cache into column.
+template<typename T>
+void load_vector_section(CacheFileReader const& cache, int index, std::vector<T>& column)
+{
+  size_t count;
+  T const* data = cache.section<T>(index, count);
+  column.assign(data, data + count);
+}
+
+//-----------------------------------------------------------------------------
+//
+// Checkpoint files
+//
+// A checkpoint file stores the results of an unfinished stage, so that the
+// stage can be resumed after ext3grep was interrupted. It starts with a
+// CacheFileHeader without sections, followed by records that are appended
+// as the stage makes progress. Each record is a CheckpointRecordHeader
+// followed by the data of the record, padded to a multiple of 8 bytes.
+//
+// Records are written immediately (so they survive a crash or kill of the
+// process) and are flushed to disk at most every checkpoint_sync_interval
+// seconds (so that at most that much work is lost after a power failure).
+// A record that was only partially written is detected and dropped.
+
+int const checkpoint_sync_interval = 10;
+
+struct CheckpointRecordHeader {
+  uint32_t key;			// Identifies the record (ie, the group number).
+  uint32_t size;		// The size of the data in bytes.
+  uint32_t checksum;		// Checksum of key, size and the data.
+  uint32_t padding;
+};
+
+class CheckpointFile {
+  private:
+    std::string M_filename;
+    int M_fd;
+    uint64_t M_offset;		// The size of the valid part of the file.
+    time_t M_last_sync;
+
+    void fail(char const* what);
+
+  public:
+    CheckpointFile(void) : M_fd(-1), M_offset(0), M_last_sync(0) { }
+    ~CheckpointFile();
+
+    // Open the checkpoint file 'filename' of 'stage' and call read_record(key, data, size, user_data)
+    // for every record in it, in order, until read_record returns false. Subsequent records are
+    // discarded. The file is (re)created if it doesn't exist or belongs to another file system.
+    // If it can't be written, a warning is printed and append and remove do nothing.
+    void open(std::string const& filename, char const* stage,
+        bool (*read_record)(uint32_t key, char const* data, size_t size, void* user_data), void* user_data);
+
+    // Append a record.
+    void append(uint32_t key, void const* data, size_t size);
+
+    // Delete the checkpoint file, because the stage was finished.
+    void remove(void);
+};
+
+#endif // CACHE_FILE_H
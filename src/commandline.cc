@@ -59,6 +59,9 @@ bool commandline_zeroed_inodes = false;
 bool commandline_show_path_inodes = false;
 std::string commandline_search;
 std::string commandline_search_start;
+std::string commandline_search_file;
+std::string commandline_search_regex;
+std::string commandline_search_hex;
 int commandline_search_inode = -1;
 hist_type commandline_histogram = hist_none;
 std::string commandline_inode_dirblock_table;
@@ -71,6 +74,14 @@ bool commandline_debug = false;
 bool commandline_debug_malloc = false;
 bool commandline_custom = false;
 bool commandline_accept_all = false;
+int commandline_threads = 0;
+cache_format_type commandline_cache_format = cache_format_binary;
+int commandline_cache_size = 64;
+bool commandline_stats = false;
+int commandline_as_of = -1;
+int commandline_mmap_budget = 0;
+int commandline_journal_inode_cache = 16;
+bool commandline_metadata_snapshot = false;
 
 //-----------------------------------------------------------------------------
 //
@@ -94,7 +105,28 @@ static void print_usage(std::ostream& os)
   os << "                         BOTH stage* files!\n";
   os << "  --accept-all           Simply accept everything as filename.\n";
   os << "  --journal              Show content of journal.\n";
+  os << "  --as-of seq            Use the state of the file system as of journal\n";
+  os << "                         transaction 'seq': every block is read from its\n";
+  os << "                         newest copy in the journal at or before 'seq'.\n";
   os << "  --show-path-inodes     Show the inode of each directory component in paths.\n";
+  os << "  --threads n            Use 'n' threads for scanning all groups. The default\n";
+  os << "                         is the number of online processors.\n";
+  os << "  --cache-format=[binary|text]\n";
+  os << "                         The format of newly written stage* files. The\n";
+  os << "                         default is binary. Both formats can be loaded.\n";
+  os << "  --cache-size mb        Use a block cache of 'mb' MiB. The default is 64.\n";
+  os << "                         Use 0 to disable the cache.\n";
+  os << "  --stats                Print I/O and block cache statistics per stage.\n";
+  os << "  --mmap-budget mb       Map at most 'mb' MiB of inode tables at a time.\n";
+  os << "                         The default is 1024 on 32-bit and unlimited on\n";
+  os << "                         64-bit machines.\n";
+  os << "  --journal-inode-cache mb\n";
+  os << "                         Keep the inode copies in the journal in memory,\n";
+  os << "                         in addition to the block cache, if they take at\n";
+  os << "                         most 'mb' MiB. The default is 16. Use 0 to read\n";
+  os << "                         them from the journal when needed.\n";
+  os << "  --metadata-snapshot    Keep a copy of all group bitmaps in a cache file and\n";
+  os << "                         load them from there the next time.\n";
 #ifdef CWDEBUG
   os << "  --debug                Turn on printing of debug output.\n";
   os << "  --debug-malloc         Turn on debugging of memory allocations.\n";
@@ -130,8 +162,11 @@ static void print_usage(std::ostream& os)
   os << "                         of the directory.\n";
   os << "                         If you do not use --ls then --print is implied.\n";
 //       012345678901234567890123456789012345678901234567890123456789012345678901234567890
-  os << "  --histogram=[atime|ctime|mtime|dtime|group]\n";
+  os << "  --histogram=[atime|ctime|mtime|dtime|group|all]\n";
   os << "                         Generate a histogram based on the given specs.\n";
+  os << "                         'all' prints all of them. The histograms are\n";
+  os << "                         computed from an index of all inodes, stored in\n";
+  os << "                         <device>.ext3grep.inodes.\n";
   os << "                         Using atime, ctime or mtime will change the\n";
   os << "                         meaning of --after and --before to those times.\n";
   os << "  --journal-block jblk   Show info on journal block 'jblk'.\n";
@@ -141,6 +176,12 @@ static void print_usage(std::ostream& os)
   os << "                         This implies --ls but suppresses it's output.\n";
   os << "  --search-start str     Find blocks that start with the fixed string 'str'.\n";
   os << "  --search str           Find blocks that contain the fixed string 'str'.\n";
+  os << "  --search-file file     Find blocks that contain any of the fixed strings in\n";
+  os << "                         'file' (one per line), in a single pass.\n";
+  os << "  --search-regex re      Find blocks that contain a match of the regular\n";
+  os << "                         expression 're'.\n";
+  os << "  --search-hex hex       Find blocks that contain the bytes 'hex', for example\n";
+  os << "                         \"4d 5a ?? 0?\" where '?' matches any hex digit.\n";
   os << "  --search-inode blk     Find inodes that refer to block 'blk'.\n";
   os << "  --search-zeroed-inodes Return allocated inode table entries that are zeroed.\n";
 //       012345678901234567890123456789012345678901234567890123456789012345678901234567890
@@ -207,6 +248,9 @@ enum opts {
   opt_journal_transaction,
   opt_search,
   opt_search_start,
+  opt_search_file,
+  opt_search_regex,
+  opt_search_hex,
   opt_search_inode,
   opt_search_zeroed_inodes,
   opt_inode_to_block,
@@ -221,7 +265,15 @@ enum opts {
   opt_help,
   opt_debug,
   opt_debug_malloc,
-  opt_custom
+  opt_custom,
+  opt_threads,
+  opt_cache_format,
+  opt_cache_size,
+  opt_stats,
+  opt_as_of,
+  opt_mmap_budget,
+  opt_journal_inode_cache,
+  opt_metadata_snapshot
 };
 
 void decode_commandline_options(int& argc, char**& argv)
@@ -254,6 +306,9 @@ void decode_commandline_options(int& argc, char**& argv)
     {"journal-transaction", 1, &long_option, opt_journal_transaction},
     {"search", 1, &long_option, opt_search},
     {"search-start", 1, &long_option, opt_search_start},
+    {"search-file", 1, &long_option, opt_search_file},
+    {"search-regex", 1, &long_option, opt_search_regex},
+    {"search-hex", 1, &long_option, opt_search_hex},
     {"search-inode", 1, &long_option, opt_search_inode},
     {"search-zeroed-inodes", 0, &long_option, opt_search_zeroed_inodes},
     {"inode-to-block", 1, &long_option, opt_inode_to_block},
@@ -268,6 +323,14 @@ void decode_commandline_options(int& argc, char**& argv)
     {"debug", 0, &long_option, opt_debug},
     {"debug-malloc", 0, &long_option, opt_debug_malloc},
     {"custom", 0, &long_option, opt_custom},
+    {"threads", 1, &long_option, opt_threads},
+    {"cache-format", 1, &long_option, opt_cache_format},
+    {"cache-size", 1, &long_option, opt_cache_size},
+    {"stats", 0, &long_option, opt_stats},
+    {"as-of", 1, &long_option, opt_as_of},
+    {"mmap-budget", 1, &long_option, opt_mmap_budget},
+    {"journal-inode-cache", 1, &long_option, opt_journal_inode_cache},
+    {"metadata-snapshot", 0, &long_option, opt_metadata_snapshot},
     {NULL, 0, NULL, 0}
   };
 
@@ -362,6 +425,18 @@ void decode_commandline_options(int& argc, char**& argv)
             commandline_search_start = optarg;
 	    ++exclusive2;
 	    break;
+	  case opt_search_file:
+            commandline_search_file = optarg;
+	    ++exclusive2;
+	    break;
+	  case opt_search_regex:
+            commandline_search_regex = optarg;
+	    ++exclusive2;
+	    break;
+	  case opt_search_hex:
+            commandline_search_hex = optarg;
+	    ++exclusive2;
+	    break;
 	  case opt_inode_dirblock_table:
 	    commandline_inode_dirblock_table = optarg;
 	    break;
@@ -453,6 +528,72 @@ void decode_commandline_options(int& argc, char**& argv)
 	  case opt_journal_transaction:
             commandline_journal_transaction = atoi(optarg);
 	    break;
+	  case opt_threads:
+	    commandline_threads = atoi(optarg);
+	    if (commandline_threads < 1)
+	    {
+	      std::cout << std::flush;
+	      std::cerr << progname << ": --threads: cannot use less than one thread." << std::endl;
+	      exit(EXIT_FAILURE);
+	    }
+	    break;
+	  case opt_cache_format:
+	  {
+	    std::string cache_format_arg(optarg);
+	    if (cache_format_arg == "binary")
+	      commandline_cache_format = cache_format_binary;
+	    else if (cache_format_arg == "text")
+	      commandline_cache_format = cache_format_text;
+	    else
+	    {
+	      std::cout << std::flush;
+	      std::cerr << progname << ": --cache-format: " << cache_format_arg << ": unknown format." << std::endl;
+	      exit(EXIT_FAILURE);
+	    }
+	    break;
+	  }
+	  case opt_cache_size:
+	    commandline_cache_size = atoi(optarg);
+	    if (commandline_cache_size < 0)
+	    {
+	      std::cout << std::flush;
+	      std::cerr << progname << ": --cache-size: the size cannot be negative." << std::endl;
+	      exit(EXIT_FAILURE);
+	    }
+	    break;
+	  case opt_stats:
+	    commandline_stats = true;
+	    break;
+	  case opt_metadata_snapshot:
+	    commandline_metadata_snapshot = true;
+	    break;
+	  case opt_mmap_budget:
+	    commandline_mmap_budget = atoi(optarg);
+	    if (commandline_mmap_budget < 1)
+	    {
+	      std::cout << std::flush;
+	      std::cerr << progname << ": --mmap-budget: the budget must be at least 1 MiB." << std::endl;
+	      exit(EXIT_FAILURE);
+	    }
+	    break;
+	  case opt_journal_inode_cache:
+	    commandline_journal_inode_cache = atoi(optarg);
+	    if (commandline_journal_inode_cache < 0)
+	    {
+	      std::cout << std::flush;
+	      std::cerr << progname << ": --journal-inode-cache: the size cannot be negative." << std::endl;
+	      exit(EXIT_FAILURE);
+	    }
+	    break;
+	  case opt_as_of:
+	    commandline_as_of = atoi(optarg);
+	    if (commandline_as_of < 0)
+	    {
+	      std::cout << std::flush;
+	      std::cerr << progname << ": --as-of: the sequence number cannot be negative." << std::endl;
+	      exit(EXIT_FAILURE);
+	    }
+	    break;
 	  case opt_histogram:
 	  {
 	    hist_arg = optarg;
@@ -466,6 +607,8 @@ void decode_commandline_options(int& argc, char**& argv)
 	      commandline_histogram = hist_dtime;
 	    else if (hist_arg == "group")
 	      commandline_histogram = hist_group;
+	    else if (hist_arg == "all")
+	      commandline_histogram = hist_all;
 	    else
 	    {
 	      std::cout << std::flush;
@@ -529,6 +672,9 @@ void decode_commandline_options(int& argc, char**& argv)
        commandline_histogram ||
        !commandline_search.empty() ||
        !commandline_search_start.empty() ||
+       !commandline_search_file.empty() ||
+       !commandline_search_regex.empty() ||
+       !commandline_search_hex.empty() ||
        commandline_search_inode != -1||
        commandline_search_zeroed_inodes ||
        commandline_inode_to_block != -1 ||
@@ -545,7 +691,8 @@ void decode_commandline_options(int& argc, char**& argv)
   if ((commandline_histogram == hist_atime ||
        commandline_histogram == hist_ctime ||
        commandline_histogram == hist_mtime ||
-       commandline_histogram == hist_dtime) &&
+       commandline_histogram == hist_dtime ||
+       commandline_histogram == hist_all) &&
       !(commandline_before && commandline_after))
   {
     if (!commandline_before)
@@ -31,6 +31,7 @@
 #endif
 
 #include "histogram.h"		// Needed for hist_type
+#include "cache_file.h"		// Needed for cache_format_type
 
 // Commandline options.
 extern bool commandline_superblock;
@@ -58,6 +59,9 @@ extern bool commandline_zeroed_inodes;
 extern bool commandline_show_path_inodes;
 extern std::string commandline_search;
 extern std::string commandline_search_start;
+extern std::string commandline_search_file;
+extern std::string commandline_search_regex;
+extern std::string commandline_search_hex;
 extern int commandline_search_inode;
 extern hist_type commandline_histogram;
 extern std::string commandline_inode_dirblock_table;
@@ -70,5 +74,13 @@ extern bool commandline_debug;
 extern bool commandline_debug_malloc;
 extern bool commandline_custom;
 extern bool commandline_accept_all;
+extern int commandline_threads;
+extern cache_format_type commandline_cache_format;
+extern int commandline_cache_size;
+extern bool commandline_stats;
+extern int commandline_as_of;
+extern int commandline_mmap_budget;
+extern int commandline_journal_inode_cache;
+extern bool commandline_metadata_snapshot;
 
 #endif // COMMANDLINE_H
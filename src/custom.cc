@@ -25,6 +25,7 @@
 #include "sys.h"
 #include <sys/types.h>
 #include <sys/time.h>
+#include <fstream>
 #include "ext3.h"
 #include "debug.h"
 #endif
@@ -0,0 +1,580 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file dfa_search.cc Implementation of class DFASearch.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include "debug.h"
+#endif
+
+#include "dfa_search.h"
+
+// Limits that keep a pathological expression from using all memory.
+static int const max_repeat = 1000;		// The maximum value of m and n in {m,n}.
+static size_t const max_nfa_states = 100000;
+static size_t const max_dfa_states = 4096;	// The DFA is thrown away and rebuilt when it gets larger.
+
+// A node of the parse tree of a regular expression.
+struct DFASearch::Node {
+  enum type_type {
+    bytes,		// One byte out of 'set'.
+    empty,		// The empty string.
+    concatenation,	// The children, one after another.
+    alternation,	// One of the children.
+    repeat		// The only child, min through max times (max == -1 means unbounded).
+  };
+  type_type type;
+  std::bitset<256> set;
+  std::vector<Node> children;
+  int min;
+  int max;
+
+  Node(type_type t) : type(t), min(0), max(0) { }
+};
+
+//-----------------------------------------------------------------------------
+//
+// Parser
+
+class DFASearch::Parser {
+  private:
+    std::string const& M_regex;
+    size_t M_pos;
+    std::string& M_error;
+
+  public:
+    Parser(std::string const& regex, std::string& error) : M_regex(regex), M_pos(0), M_error(error) { }
+
+    bool at_end(void) const { return M_pos == M_regex.size(); }
+    bool accept(char c) { if (!at_end() && M_regex[M_pos] == c) { ++M_pos; return true; } return false; }
+    bool failed(void) const { return !M_error.empty(); }
+
+    Node parse_alternation(void);
+
+  private:
+    Node parse_concatenation(void);
+    Node parse_repeat(void);
+    Node parse_atom(void);
+    Node parse_class(void);
+    void parse_escape(std::bitset<256>& set);
+    int parse_number(void);
+    void fail(char const* error);
+};
+
+void DFASearch::Parser::fail(char const* error)
+{
+  if (M_error.empty())
+  {
+    M_error = error;
+    M_pos = M_regex.size();	// Stop parsing.
+  }
+}
+
+DFASearch::Node DFASearch::Parser::parse_alternation(void)
+{
+  Node first = parse_concatenation();
+  if (at_end() || M_regex[M_pos] != '|')
+    return first;
+  Node node(Node::alternation);
+  node.children.push_back(first);
+  while (accept('|'))
+    node.children.push_back(parse_concatenation());
+  return node;
+}
+
+DFASearch::Node DFASearch::Parser::parse_concatenation(void)
+{
+  Node node(Node::concatenation);
+  while (!at_end() && M_regex[M_pos] != '|' && M_regex[M_pos] != ')')
+    node.children.push_back(parse_repeat());
+  if (node.children.empty())
+    return Node(Node::empty);
+  if (node.children.size() == 1)
+    return node.children[0];
+  return node;
+}
+
+int DFASearch::Parser::parse_number(void)
+{
+  if (at_end() || !std::isdigit(M_regex[M_pos]))
+  {
+    fail("expected a number in {m,n}");
+    return 0;
+  }
+  int number = 0;
+  while (!at_end() && std::isdigit(M_regex[M_pos]))
+  {
+    number = number * 10 + (M_regex[M_pos++] - '0');
+    if (number > max_repeat)
+    {
+      fail("repeat count in {m,n} is too large");
+      return 0;
+    }
+  }
+  return number;
+}
+
+DFASearch::Node DFASearch::Parser::parse_repeat(void)
+{
+  Node atom = parse_atom();
+  for (;;)
+  {
+    int min, max;
+    if (accept('*'))
+    {
+      min = 0;
+      max = -1;
+    }
+    else if (accept('+'))
+    {
+      min = 1;
+      max = -1;
+    }
+    else if (accept('?'))
+    {
+      min = 0;
+      max = 1;
+    }
+    else if (accept('{'))
+    {
+      min = max = parse_number();
+      if (accept(','))
+        max = (!at_end() && M_regex[M_pos] == '}') ? -1 : parse_number();
+      if (!accept('}'))
+	fail("missing '}'");
+      else if (max != -1 && max < min)
+        fail("invalid range in {m,n}");
+    }
+    else
+      break;
+    Node node(Node::repeat);
+    node.children.push_back(atom);
+    node.min = min;
+    node.max = max;
+    atom = node;
+  }
+  return atom;
+}
+
+// Parse the escape sequence after a backslash and add the byte(s) it stands for to 'set'.
+void DFASearch::Parser::parse_escape(std::bitset<256>& set)
+{
+  if (at_end())
+  {
+    fail("trailing backslash");
+    return;
+  }
+  char c = M_regex[M_pos++];
+  switch (c)
+  {
+    case 'x':
+    {
+      if (M_pos + 2 > M_regex.size() || !std::isxdigit(M_regex[M_pos]) || !std::isxdigit(M_regex[M_pos + 1]))
+      {
+	fail("\\x must be followed by two hex digits");
+	return;
+      }
+      set.set(strtol(M_regex.substr(M_pos, 2).c_str(), NULL, 16));
+      M_pos += 2;
+      return;
+    }
+    case 'n':
+      set.set('\n');
+      return;
+    case 'r':
+      set.set('\r');
+      return;
+    case 't':
+      set.set('\t');
+      return;
+    case '0':
+      set.set(0);
+      return;
+    case 'd':
+    case 'D':
+    case 'w':
+    case 'W':
+    case 's':
+    case 'S':
+    {
+      std::bitset<256> class_set;
+      for (int b = 0; b < 256; ++b)
+	if ((c == 'd' || c == 'D') ? std::isdigit(b) :
+	    (c == 'w' || c == 'W') ? (std::isalnum(b) || b == '_') : std::isspace(b))
+	  class_set.set(b);
+      if (std::isupper(c))
+        class_set.flip();
+      set |= class_set;
+      return;
+    }
+    default:
+      set.set(static_cast<unsigned char>(c));
+      return;
+  }
+}
+
+DFASearch::Node DFASearch::Parser::parse_class(void)
+{
+  Node node(Node::bytes);
+  bool negate = accept('^');
+  bool first = true;
+  while (!at_end() && (first || M_regex[M_pos] != ']'))
+  {
+    first = false;
+    std::bitset<256> item;
+    unsigned char c = M_regex[M_pos++];
+    if (c == '\\')
+    {
+      parse_escape(item);
+      if (item.count() != 1)
+      {
+        node.set |= item;	// A class like \d can't be the start of a range.
+	continue;
+      }
+      for (c = 0; !item.test(c); ++c);
+    }
+    if (M_pos + 1 < M_regex.size() && M_regex[M_pos] == '-' && M_regex[M_pos + 1] != ']')
+    {
+      ++M_pos;
+      std::bitset<256> end_item;
+      unsigned char end = M_regex[M_pos++];
+      if (end == '\\')
+      {
+        parse_escape(end_item);
+	if (end_item.count() != 1)
+	{
+	  fail("invalid range in [...]");
+	  break;
+	}
+	for (end = 0; !end_item.test(end); ++end);
+      }
+      if (end < c)
+      {
+        fail("invalid range in [...]");
+	break;
+      }
+      for (int b = c; b <= end; ++b)
+        node.set.set(b);
+    }
+    else
+      node.set.set(c);
+  }
+  if (!accept(']'))
+    fail("missing ']'");
+  if (negate)
+    node.set.flip();
+  return node;
+}
+
+DFASearch::Node DFASearch::Parser::parse_atom(void)
+{
+  ASSERT(!at_end());
+  char c = M_regex[M_pos++];
+  switch (c)
+  {
+    case '(':
+    {
+      Node node = parse_alternation();
+      if (!accept(')'))
+        fail("missing ')'");
+      return node;
+    }
+    case '[':
+      return parse_class();
+    case '.':
+    {
+      Node node(Node::bytes);
+      node.set.set();
+      return node;
+    }
+    case '\\':
+    {
+      Node node(Node::bytes);
+      parse_escape(node.set);
+      return node;
+    }
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      fail("nothing to repeat");
+      break;
+    case '^':
+      fail("'^' is only supported at the start of the expression");
+      break;
+  }
+  Node node(Node::bytes);
+  node.set.set(static_cast<unsigned char>(c));
+  return node;
+}
+
+//-----------------------------------------------------------------------------
+//
+// NFA
+
+int DFASearch::new_nfa_state(void)
+{
+  M_nfa.push_back(NfaState());
+  M_nfa.back().target = -1;
+  return M_nfa.size() - 1;
+}
+
+// Add the NFA states for 'node', starting at state 'from' (which has no byte transition yet).
+// Returns the state where the match of 'node' ends (which has no transitions yet).
+int DFASearch::compile_node(Node const& node, int from)
+{
+  if (M_nfa.size() > max_nfa_states)
+    return from;		// finish() will fail.
+  switch (node.type)
+  {
+    case Node::bytes:
+    {
+      int to = new_nfa_state();
+      M_nfa[from].bytes = node.set;
+      M_nfa[from].target = to;
+      return to;
+    }
+    case Node::empty:
+      return from;
+    case Node::concatenation:
+      for (std::vector<Node>::const_iterator iter = node.children.begin(); iter != node.children.end(); ++iter)
+        from = compile_node(*iter, from);
+      return from;
+    case Node::alternation:
+    {
+      int end = new_nfa_state();
+      for (std::vector<Node>::const_iterator iter = node.children.begin(); iter != node.children.end(); ++iter)
+      {
+        int start = new_nfa_state();
+	M_nfa[from].epsilon.push_back(start);
+	M_nfa[compile_node(*iter, start)].epsilon.push_back(end);
+      }
+      return end;
+    }
+    case Node::repeat:
+    {
+      Node const& child(node.children[0]);
+      for (int i = 0; i < node.min; ++i)
+        from = compile_node(child, from);
+      if (node.max == -1)
+      {
+        int loop = new_nfa_state();
+	M_nfa[from].epsilon.push_back(loop);
+	int start = new_nfa_state();
+	M_nfa[loop].epsilon.push_back(start);
+	M_nfa[compile_node(child, start)].epsilon.push_back(loop);
+	int end = new_nfa_state();
+	M_nfa[loop].epsilon.push_back(end);
+	return end;
+      }
+      int end = new_nfa_state();
+      for (int i = node.min; i < node.max; ++i)
+      {
+	M_nfa[from].epsilon.push_back(end);
+	int start = new_nfa_state();
+	M_nfa[from].epsilon.push_back(start);
+	from = compile_node(child, start);
+      }
+      M_nfa[from].epsilon.push_back(end);
+      return end;
+    }
+  }
+  return from;
+}
+
+void DFASearch::finish(Node const& root)
+{
+  M_nfa.clear();
+  M_nfa_start = new_nfa_state();
+  M_nfa_accept = compile_node(root, M_nfa_start);
+  M_dfa_index.clear();
+  M_dfa_states.clear();
+  M_dfa_accepting.clear();
+  M_dfa_transitions.clear();
+  nfa_set_type start(1, M_nfa_start);
+  M_dfa_start = dfa_state(start);
+}
+
+bool DFASearch::compile_regex(std::string const& regex, std::string& error)
+{
+  error.clear();
+  Parser parser(regex, error);
+  M_anchored = parser.accept('^');
+  Node root = parser.parse_alternation();
+  if (!parser.failed() && !parser.at_end())
+    error = "unmatched ')'";
+  if (!error.empty())
+    return false;
+  finish(root);
+  if (M_nfa.size() > max_nfa_states)
+  {
+    error = "the expression is too large";
+    return false;
+  }
+  return true;
+}
+
+bool DFASearch::compile_hex(std::string const& hex, std::string& error)
+{
+  error.clear();
+  Node root(Node::concatenation);
+  std::string digits;
+  for (std::string::const_iterator iter = hex.begin(); iter != hex.end(); ++iter)
+  {
+    if (std::isspace(*iter))
+      continue;
+    if (!std::isxdigit(*iter) && *iter != '?')
+    {
+      error = "invalid character '" + std::string(1, *iter) + "'";
+      return false;
+    }
+    digits += *iter;
+    if (digits.size() < 2)
+      continue;
+    // Add all bytes that match the two digits.
+    Node node(Node::bytes);
+    for (int b = 0; b < 256; ++b)
+    {
+      static char const hex_digits[] = "0123456789abcdef";
+      if ((digits[0] == '?' || std::tolower(digits[0]) == hex_digits[b >> 4]) &&
+          (digits[1] == '?' || std::tolower(digits[1]) == hex_digits[b & 15]))
+	node.set.set(b);
+    }
+    root.children.push_back(node);
+    digits.clear();
+  }
+  if (!digits.empty())
+  {
+    error = "odd number of hex digits";
+    return false;
+  }
+  if (root.children.empty())
+  {
+    error = "empty pattern";
+    return false;
+  }
+  M_anchored = false;
+  finish(root);
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// DFA
+
+// Replace 'set' with its epsilon closure, keeping only the states that matter for the DFA:
+// those with a byte transition, and the accepting state.
+void DFASearch::closure(nfa_set_type& set) const
+{
+  std::vector<bool> seen(M_nfa.size(), false);
+  std::vector<int> stack(set);
+  set.clear();
+  while (!stack.empty())
+  {
+    int state = stack.back();
+    stack.pop_back();
+    if (seen[state])
+      continue;
+    seen[state] = true;
+    NfaState const& nfa_state(M_nfa[state]);
+    if (nfa_state.target != -1 || state == M_nfa_accept)
+      set.push_back(state);
+    for (std::vector<int>::const_iterator iter = nfa_state.epsilon.begin(); iter != nfa_state.epsilon.end(); ++iter)
+      stack.push_back(*iter);
+  }
+  std::sort(set.begin(), set.end());
+}
+
+// Return the DFA state for the closure of 'set'.
+int DFASearch::dfa_state(nfa_set_type& set)
+{
+  closure(set);
+  std::map<nfa_set_type, int>::iterator iter = M_dfa_index.find(set);
+  if (iter != M_dfa_index.end())
+    return iter->second;
+  int state = M_dfa_states.size();
+  M_dfa_index.insert(std::map<nfa_set_type, int>::value_type(set, state));
+  M_dfa_states.push_back(set);
+  M_dfa_accepting.push_back(std::binary_search(set.begin(), set.end(), M_nfa_accept));
+  M_dfa_transitions.resize(M_dfa_transitions.size() + 256, -1);
+  return state;
+}
+
+// Calculate the transition of DFA state 'state' for 'byte', and return the next state.
+int DFASearch::add_transition(int state, unsigned char byte)
+{
+  nfa_set_type next;
+  nfa_set_type const& set(M_dfa_states[state]);
+  for (nfa_set_type::const_iterator iter = set.begin(); iter != set.end(); ++iter)
+    if (M_nfa[*iter].target != -1 && M_nfa[*iter].bytes.test(byte))
+      next.push_back(M_nfa[*iter].target);
+  // When not anchored, a new match can start at every position.
+  if (!M_anchored)
+    next.push_back(M_nfa_start);
+  if (M_dfa_states.size() >= max_dfa_states)
+  {
+    // Throw away the DFA calculated so far; the current state is all we need.
+    M_dfa_index.clear();
+    M_dfa_states.clear();
+    M_dfa_accepting.clear();
+    M_dfa_transitions.clear();
+    nfa_set_type start(1, M_nfa_start);
+    M_dfa_start = dfa_state(start);
+    return dfa_state(next);
+  }
+  int next_state = dfa_state(next);
+  M_dfa_transitions[state * 256 + byte] = next_state;
+  return next_state;
+}
+
+bool DFASearch::search(unsigned char const* buf, size_t size, bool resume)
+{
+  ASSERT(M_dfa_start != -1);
+  // An anchored expression must match at the start of the buffer.
+  if (M_anchored)
+    resume = false;
+  int state = resume ? M_state : M_dfa_start;
+  // When resuming, an accepting state means that a match ended at the end of the previous buffer.
+  bool found = !resume && M_dfa_accepting[state];
+  for (size_t i = 0; i < size; ++i)
+  {
+    int next = M_dfa_transitions[state * 256 + buf[i]];
+    if (next == -1)
+      next = add_transition(state, buf[i]);
+    state = next;
+    if (M_dfa_accepting[state])
+    {
+      found = true;
+      // Continue to the end of the buffer, in order to know the state to resume with, unless that state isn't needed.
+      if (M_anchored)
+        break;
+    }
+    // An anchored expression that can't match anymore.
+    if (M_anchored && M_dfa_states[state].empty())
+      break;
+  }
+  M_state = state;
+  return found;
+}
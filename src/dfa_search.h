@@ -0,0 +1,107 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file dfa_search.h Declaration of class DFASearch.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DFA_SEARCH_H
+#define DFA_SEARCH_H
+
+#ifndef USE_PCH
+#include <bitset>
+#include <cstddef>	// Needed for size_t
+#include <map>
+#include <string>
+#include <vector>
+#endif
+
+// class DFASearch
+//
+// A regular expression (--search-regex) or a hex byte pattern (--search-hex)
+// that can be searched for in a buffer in linear time.
+//
+// The pattern is compiled into an NFA (Thompson construction), which is turned
+// into a DFA lazily while searching: a DFA state (a set of NFA states) and its
+// transitions are only calculated the first time they are needed. Therefore every
+// byte costs a single table lookup once the states that occur in practise exist.
+//
+// Supported regular expression syntax:
+//
+//   c          The byte c.
+//   .          Any byte.
+//   [...]      A set of bytes, with ranges (a-z) and negation ([^...]).
+//   \xHH       The byte with hex value HH.
+//   \n \r \t \0, \d \D \w \W \s \S, and \c for any other special character c.
+//   (...)      Grouping.
+//   a|b        Alternation.
+//   * + ? {m} {m,} {m,n}
+//              Repetition.
+//   ^          Only at the start of the expression: the match must start at the start of the buffer.
+//
+// Hex patterns are a sequence of two-digit hex bytes, optionally separated by white space,
+// where a '?' can be used as wildcard for a single digit (ie, "4d 5a ?? 0?").
+
+class DFASearch {
+  private:
+    // The NFA.
+    struct NfaState {
+      std::bitset<256> bytes;		// The bytes for which there is a transition to 'target'.
+      int target;			// -1 if there is no byte transition.
+      std::vector<int> epsilon;		// Epsilon transitions.
+    };
+    std::vector<NfaState> M_nfa;
+    int M_nfa_start;
+    int M_nfa_accept;
+    bool M_anchored;			// The match must start at the start of the buffer.
+
+    // The part of the DFA that was calculated so far.
+    typedef std::vector<int> nfa_set_type;	// Sorted NFA states.
+    std::map<nfa_set_type, int> M_dfa_index;
+    std::vector<nfa_set_type> M_dfa_states;
+    std::vector<bool> M_dfa_accepting;
+    std::vector<int> M_dfa_transitions;	// M_dfa_transitions[state * 256 + byte], or -1 if not calculated yet.
+    int M_dfa_start;
+    int M_state;			// The state at the end of the last search.
+
+  public:
+    DFASearch(void) : M_nfa_start(-1), M_nfa_accept(-1), M_anchored(false), M_dfa_start(-1), M_state(-1) { }
+
+    // Compile a regular expression. Returns false and sets 'error' if 'regex' isn't valid.
+    bool compile_regex(std::string const& regex, std::string& error);
+
+    // Compile a hex byte pattern. Returns false and sets 'error' if 'hex' isn't valid.
+    bool compile_hex(std::string const& hex, std::string& error);
+
+    // Return true if a match ends in [buf, buf + size). If 'resume' is true, the buffer is the continuation
+    // of the buffer of the previous call, and a match may start in that (or an earlier) buffer.
+    bool search(unsigned char const* buf, size_t size, bool resume = false);
+
+  private:
+    struct Node;
+    class Parser;
+    int new_nfa_state(void);
+    int compile_node(Node const& node, int from);
+    void finish(Node const& root);
+    void closure(nfa_set_type& set) const;
+    int dfa_state(nfa_set_type& set);
+    int add_transition(int state, unsigned char byte);
+};
+
+#endif // DFA_SEARCH_H
@@ -35,11 +35,17 @@
 #include "globals.h"
 #include "superblock.h"
 #include "get_block.h"
+#include "block_cache.h"
+#include "read_ahead.h"
+#include "scan_groups.h"
+#include "cache_file.h"
+#include "commandline.h"
 #include "is_blockdetection.h"
 #include "forward_declarations.h"
 #include "print_inode_to.h"
 #include "directories.h"
 #include "journal.h"
+#include "block_type_map.h"
 
 //-----------------------------------------------------------------------------
 //
@@ -76,6 +82,294 @@ bool does_not_end_on_END(std::string const& cachename)
   return does_not;
 }
 
+// A directory block found in stage 1.
+struct Stage1Block {
+  int block;
+  is_directory_type result;		// isdir_start or isdir_extended.
+  uint32_t inode;			// The inode of '.', if result is isdir_start.
+  size_t warnings_end;			// The number of warnings that must be printed before this block is committed.
+};
+
+// The result of stage 1 for a single group.
+struct Stage1Group {
+  std::vector<Stage1Block> blocks;
+  DeferredWarnings warnings;
+};
+
+// The state of the stage 1 scan.
+struct Stage1Scan {
+  std::vector<Stage1Group> groups;
+  CheckpointFile checkpoint;		// The results of all committed groups, so that the scan can be resumed.
+  int next_group;			// The first group that wasn't scanned yet.
+};
+
+// A directory block, as stored in the stage 1 checkpoint file.
+struct Stage1CheckpointBlock {
+  int32_t block;
+  uint32_t inode;			// The inode of '.', or 0 for an extended directory block.
+};
+
+// Add a directory block that was found in stage 1 to dir_inode_to_block_cache or extended_blocks.
+static void stage1_add_block(int block, uint32_t inode)
+{
+  if (inode)
+    dir_inode_to_block_cache[inode].push_back(block);
+  else
+    extended_blocks.push_back(block);
+}
+
+// Find all directory blocks of a group. Called from a worker thread.
+static void stage1_process_group(int group, int, void* data)
+{
+  Stage1Group& result(static_cast<Stage1Scan*>(data)->groups[group]);
+  int first_block = first_data_block(super_block) + group * blocks_per_group(super_block);
+  int last_block = std::min(first_block + blocks_per_group(super_block), block_count(super_block));
+  // Stream the blocks of the group that the block type map marks as (possible) directory blocks from disk.
+  ReadAhead read_ahead;
+  for (int block = first_block; block < last_block; ++block)
+    if (is_directory_block_type(get_block_type(block)))
+      read_ahead.add_block(block);
+  read_ahead.start();
+  int block;
+  unsigned char* block_ptr;
+  while ((block_ptr = read_ahead.next_block(block)))
+  {
+    if (!is_directory_block_type(get_block_type(block)))
+      continue;
+#if !INCLUDE_JOURNAL
+    if (is_journal(block))
+      continue;
+#endif
+    DirectoryBlockStats stats;
+    stats.defer_warnings_to(&result.warnings);
+    is_directory_type isdir = is_directory(block_ptr, block, stats, false);
+    if (isdir != isdir_no)
+    {
+      Stage1Block directory_block;
+      directory_block.block = block;
+      directory_block.result = isdir;
+      directory_block.inode = 0;
+      if (isdir == isdir_start)
+      {
+	ext3_dir_entry_2* dir_entry = reinterpret_cast<ext3_dir_entry_2*>(block_ptr);
+	ASSERT(dir_entry->name_len == 1 && dir_entry->name[0] == '.');
+	directory_block.inode = dir_entry->inode;
+      }
+      directory_block.warnings_end = result.warnings.size();
+      result.blocks.push_back(directory_block);
+    }
+  }
+}
+
+// Add the directory blocks of a group to dir_inode_to_block_cache and extended_blocks,
+// and append them to the checkpoint file. Called in group order.
+static void stage1_commit_group(int group, void* data)
+{
+  Stage1Scan& scan(*static_cast<Stage1Scan*>(data));
+  Stage1Group& result(scan.groups[group]);
+  std::cout << "\nSearching group " << group << ": " << std::flush;
+  std::vector<Stage1CheckpointBlock> checkpoint_blocks(result.blocks.size());
+  size_t warnings_printed = 0;
+  for (std::vector<Stage1Block>::iterator iter = result.blocks.begin(); iter != result.blocks.end(); ++iter)
+  {
+    result.warnings.print(warnings_printed, iter->warnings_end);
+    warnings_printed = iter->warnings_end;
+    Stage1CheckpointBlock& checkpoint_block(checkpoint_blocks[iter - result.blocks.begin()]);
+    checkpoint_block.block = iter->block;
+    checkpoint_block.inode = 0;
+    if (iter->result == isdir_start)
+    {
+      if (dir_inode_to_block_cache[iter->inode].empty())
+	std::cout << 'D' << std::flush;
+      else
+	std::cout << '+' << std::flush;
+      checkpoint_block.inode = iter->inode;
+    }
+    else
+      std::cout << 'd' << std::flush;
+    stage1_add_block(checkpoint_block.block, checkpoint_block.inode);
+  }
+  result.warnings.print(warnings_printed, result.warnings.size());
+  scan.checkpoint.append(group, checkpoint_blocks.empty() ? NULL : &checkpoint_blocks[0],
+      checkpoint_blocks.size() * sizeof(Stage1CheckpointBlock));
+  // Free the memory.
+  std::vector<Stage1Block>().swap(result.blocks);
+  result.warnings.clear();
+}
+
+// Add the directory blocks of a group that was committed before stage 1 was interrupted.
+// Called for every record of the checkpoint file, in order.
+static bool stage1_resume_group(uint32_t group, char const* data, size_t size, void* user_data)
+{
+  Stage1Scan& scan(*static_cast<Stage1Scan*>(user_data));
+  if (group != (uint32_t)scan.next_group || size % sizeof(Stage1CheckpointBlock) != 0)
+    return false;
+  Stage1CheckpointBlock const* blocks = reinterpret_cast<Stage1CheckpointBlock const*>(data);
+  size_t const number_of_blocks = size / sizeof(Stage1CheckpointBlock);
+  for (size_t i = 0; i < number_of_blocks; ++i)
+    if (blocks[i].inode > inode_count_ || blocks[i].block < 0 || blocks[i].block >= block_count(super_block))
+      return false;
+  for (size_t i = 0; i < number_of_blocks; ++i)
+    stage1_add_block(blocks[i].block, blocks[i].inode);
+  ++scan.next_group;
+  return true;
+}
+
+// Write the result of stage 1 as text.
+static void write_stage1_text(std::string const& cache_stage1)
+{
+  std::ofstream cache;
+  cache.open(cache_stage1.c_str());
+  cache << "# Stage 1 data for " << device_name << ".\n";
+  cache << "# Inodes and directory start blocks that use it for dir entry '.'.\n";
+  cache << "# INODE : BLOCK [BLOCK ...]\n";
+  for (uint32_t i = 1; i <= inode_count_; ++i)
+  {
+    blocknr_vector_type const bv = dir_inode_to_block_cache[i];
+    if (bv.empty())
+      continue;
+    cache << i << " :";
+    uint32_t const size = bv.size();
+    for (uint32_t j = 0; j < size; ++j)
+      cache << ' ' << bv[j];
+    cache << '\n';
+  }
+  cache << "# Extended directory blocks.\n";
+  for (std::vector<int>::iterator iter = extended_blocks.begin(); iter != extended_blocks.end(); ++iter)
+    cache << *iter << '\n';
+  cache << "# END\n";
+  cache.close();
+}
+
+// Write the result of stage 1 as binary cache file.
+// Section 0: the inodes that have directory start blocks (uint32_t).
+// Section 1: for each of those inodes the index of its first block in section 2, plus a terminating index (uint32_t).
+// Section 2: the directory start blocks (uint32_t).
+// Section 3: the extended directory blocks (int).
+static void write_stage1_binary(std::string const& cache_stage1)
+{
+  std::vector<uint32_t> inodes;
+  std::vector<uint32_t> first;
+  std::vector<uint32_t> blocks;
+  for (uint32_t i = 1; i <= inode_count_; ++i)
+  {
+    blocknr_vector_type const bv = dir_inode_to_block_cache[i];
+    if (bv.empty())
+      continue;
+    inodes.push_back(i);
+    first.push_back(blocks.size());
+    uint32_t const size = bv.size();
+    for (uint32_t j = 0; j < size; ++j)
+      blocks.push_back(bv[j]);
+  }
+  first.push_back(blocks.size());
+  CacheFileWriter cache(cache_stage1, "stage1");
+  cache.add_section(inodes.empty() ? NULL : &inodes[0], inodes.size() * sizeof(uint32_t));
+  cache.add_section(&first[0], first.size() * sizeof(uint32_t));
+  cache.add_section(blocks.empty() ? NULL : &blocks[0], blocks.size() * sizeof(uint32_t));
+  cache.add_section(extended_blocks.empty() ? NULL : &extended_blocks[0], extended_blocks.size() * sizeof(int));
+  cache.commit();
+}
+
+// Load the result of stage 1 from a text file.
+static void load_stage1_text(std::string const& cache_stage1)
+{
+  std::ifstream cache;
+  cache.open(cache_stage1.c_str());
+  if (!cache.is_open())
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to open " << cache_stage1 << ": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  int inode;
+  int block;
+  char c;
+  for(;;)
+  {
+    cache.get(c);
+    if (c == '#')
+      cache.ignore(std::numeric_limits<int>::max(), '\n');
+    else
+    {
+      cache.putback(c);
+      break;
+    }
+  }
+  while (cache >> inode)
+  {
+    cache >> c;
+    if (cache.eof())
+      break;
+    ASSERT(c == ':');
+    std::vector<uint32_t> blocknr;
+    while(cache >> block)
+    {
+      blocknr.push_back(block);
+      c = cache.get();
+      if (c != ' ')
+      {
+	ASSERT(c == '\n');
+	break;
+      }
+    }
+    dir_inode_to_block_cache[inode] = blocknr;
+  }
+  cache.clear();
+  for(;;)
+  {
+    cache.get(c);
+    if (c == '#')
+      cache.ignore(std::numeric_limits<int>::max(), '\n');
+    else
+    {
+      cache.putback(c);
+      break;
+    }
+  }
+  while (cache >> block)
+    extended_blocks.push_back(block);
+  cache.close();
+}
+
+// Return true if the binary stage 1 cache file is consistent. Otherwise print why it is ignored and return false.
+static bool stage1_binary_is_valid(CacheFileReader const& cache)
+{
+  if (!cache.has_sections(4))
+    return cache.corrupt();
+  size_t number_of_inodes, number_of_first, number_of_blocks, number_of_extended_blocks;
+  uint32_t const* inodes = cache.section<uint32_t>(0, number_of_inodes);
+  uint32_t const* first = cache.section<uint32_t>(1, number_of_first);
+  uint32_t const* blocks = cache.section<uint32_t>(2, number_of_blocks);
+  int const* extended = cache.section<int>(3, number_of_extended_blocks);
+  if (number_of_first != number_of_inodes + 1 || first[0] != 0 || first[number_of_inodes] != number_of_blocks)
+    return cache.corrupt();
+  for (size_t i = 0; i < number_of_inodes; ++i)
+    if (inodes[i] == 0 || inodes[i] > inode_count_ || first[i] > first[i + 1])
+      return cache.corrupt();
+  for (size_t b = 0; b < number_of_blocks; ++b)
+    if (blocks[b] >= block_count_)
+      return cache.corrupt();
+  for (size_t b = 0; b < number_of_extended_blocks; ++b)
+    if (extended[b] < 0 || (uint32_t)extended[b] >= block_count_)
+      return cache.corrupt();
+  return true;
+}
+
+// Load the result of stage 1 from a binary cache file that passed stage1_binary_is_valid.
+static void load_stage1_binary(CacheFileReader const& cache)
+{
+  size_t number_of_inodes, number_of_first, number_of_blocks, number_of_extended_blocks;
+  uint32_t const* inodes = cache.section<uint32_t>(0, number_of_inodes);
+  uint32_t const* first = cache.section<uint32_t>(1, number_of_first);
+  uint32_t const* blocks = cache.section<uint32_t>(2, number_of_blocks);
+  int const* extended = cache.section<int>(3, number_of_extended_blocks);
+  for (size_t i = 0; i < number_of_inodes; ++i)
+    dir_inode_to_block_cache[inodes[i]].assign(blocks + first[i], first[i + 1] - first[i]);
+  extended_blocks.assign(extended, extended + number_of_extended_blocks);
+}
+
 void init_dir_inode_to_block_cache(void)
 {
   if (dir_inode_to_block_cache)
@@ -83,18 +377,24 @@ void init_dir_inode_to_block_cache(void)
 
   DoutEntering(dc::notice, "init_dir_inode_to_block_cache()");
 
+  IOStage io_stage(io_stage_stage1);
+
   ASSERT(sizeof(size_t) == sizeof(uint32_t*));	// Used in blocknr_vector_type.
   ASSERT(sizeof(size_t) == sizeof(blocknr_vector_type));
 
   dir_inode_to_block_cache = new blocknr_vector_type [inode_count_ + 1];
   std::memset(dir_inode_to_block_cache, 0, sizeof(blocknr_vector_type) * (inode_count_ + 1));
-  std::string device_name_basename = device_name.substr(device_name.find_last_of('/') + 1);
-  std::string cache_stage1 = device_name_basename + ".ext3grep.stage1";
+  std::string cache_stage1 = cache_filename("stage1");
+  CacheFileReader binary_cache;
   struct stat sb;
   bool have_cache = !(stat(cache_stage1.c_str(), &sb) == -1);
+  bool is_binary = false;
   if (have_cache)
   {
-    if (does_not_end_on_END(cache_stage1))
+    is_binary = is_binary_cache_file(cache_stage1);
+    if (is_binary)
+      have_cache = binary_cache.open(cache_stage1, "stage1") && stage1_binary_is_valid(binary_cache);
+    else if (does_not_end_on_END(cache_stage1))
       have_cache = false;
   }
   else if (errno != ENOENT)
@@ -106,125 +406,33 @@ void init_dir_inode_to_block_cache(void)
   }
   if (!have_cache)
   {
+    init_block_type_map();
     std::cout << "Finding all blocks that might be directories.\n";
     std::cout << "D: block containing directory start, d: block containing more directory entries.\n";
     std::cout << "Each plus represents a directory start that references the same inode as a directory start that we found previously.\n";
-    static unsigned char block_buf[EXT3_MAX_BLOCK_SIZE];
-    for (int group = 0; group < groups_; ++group)
-    {
-      std::cout << "\nSearching group " << group << ": " << std::flush;
-      int first_block = first_data_block(super_block) + group * blocks_per_group(super_block);
-      int last_block = std::min(first_block + blocks_per_group(super_block), block_count(super_block));
-      for (int block = first_block; block < last_block; ++block)
-      {
-#if !INCLUDE_JOURNAL
-	if (is_journal(block))
-	  continue;
-#endif
-	unsigned char* block_ptr = get_block(block, block_buf);
-	DirectoryBlockStats stats;
-	is_directory_type result = is_directory(block_ptr, block, stats, false);
-	if (result == isdir_start)
-	{
-	  ext3_dir_entry_2* dir_entry = reinterpret_cast<ext3_dir_entry_2*>(block_ptr);
-	  ASSERT(dir_entry->name_len == 1 && dir_entry->name[0] == '.');
-	  if (dir_inode_to_block_cache[dir_entry->inode].empty())
-	    std::cout << 'D' << std::flush;
-	  else
-	    std::cout << '+' << std::flush;
-	  dir_inode_to_block_cache[dir_entry->inode].push_back(block);
-	}
-	else if (result == isdir_extended)
-	{
-	  std::cout << 'd' << std::flush;
-	  extended_blocks.push_back(block);
-        }
-      }
-    }
+    Stage1Scan scan;
+    scan.groups.resize(groups_);
+    scan.next_group = 0;
+    std::string checkpoint_stage1 = cache_stage1 + ".partial";
+    scan.checkpoint.open(checkpoint_stage1, "stage1", stage1_resume_group, &scan);
+    if (scan.next_group > 0)
+      std::cout << "Resuming from '" << checkpoint_stage1 << "': groups 0 through " << (scan.next_group - 1) << " were already searched.";
+    scan_groups(scan.next_group, groups_, stage1_process_group, stage1_commit_group, &scan);
     std::cout << '\n';
     std::cout << "Writing analysis so far to '" << cache_stage1 << "'. Delete that file if you want to do this stage again.\n";
-    std::ofstream cache;
-    cache.open(cache_stage1.c_str());
-    cache << "# Stage 1 data for " << device_name << ".\n";
-    cache << "# Inodes and directory start blocks that use it for dir entry '.'.\n";
-    cache << "# INODE : BLOCK [BLOCK ...]\n";
-    for (uint32_t i = 1; i <= inode_count_; ++i)
-    {
-      blocknr_vector_type const bv = dir_inode_to_block_cache[i];
-      if (bv.empty())
-	continue;
-      cache << i << " :";
-      uint32_t const size = bv.size();
-      for (uint32_t j = 0; j < size; ++j)
-	cache << ' ' << bv[j];
-      cache << '\n';
-    }
-    cache << "# Extended directory blocks.\n";
-    for (std::vector<int>::iterator iter = extended_blocks.begin(); iter != extended_blocks.end(); ++iter)
-      cache << *iter << '\n';
-    cache << "# END\n";
-    cache.close();
+    if (commandline_cache_format == cache_format_binary)
+      write_stage1_binary(cache_stage1);
+    else
+      write_stage1_text(cache_stage1);
+    scan.checkpoint.remove();
   }
   else
   {
     std::cout << "Loading " << cache_stage1 << "...\n";
-    std::ifstream cache;
-    cache.open(cache_stage1.c_str());
-    if (!cache.is_open())
-    {
-      int error = errno;
-      std::cout << std::flush;
-      std::cerr << progname << ": failed to open " << cache_stage1 << ": " << strerror(error) << std::endl;
-      exit(EXIT_FAILURE);
-    }
-    int inode;
-    int block;
-    char c;
-    for(;;)
-    {
-      cache.get(c);
-      if (c == '#')
-        cache.ignore(std::numeric_limits<int>::max(), '\n');
-      else
-      {
-        cache.putback(c);
-        break;
-      }
-    }
-    while (cache >> inode)
-    {
-      cache >> c;
-      if (cache.eof())
-	break;
-      ASSERT(c == ':');
-      std::vector<uint32_t> blocknr;
-      while(cache >> block)
-      {
-	blocknr.push_back(block);
-	c = cache.get();
-	if (c != ' ')
-	{
-	  ASSERT(c == '\n');
-	  break;
-	}
-      }
-      dir_inode_to_block_cache[inode] = blocknr;
-    }
-    cache.clear();
-    for(;;)
-    {
-      cache.get(c);
-      if (c == '#')
-        cache.ignore(std::numeric_limits<int>::max(), '\n');
-      else
-      {
-        cache.putback(c);
-        break;
-      }
-    }
-    while (cache >> block)
-      extended_blocks.push_back(block);
-    cache.close();
+    if (is_binary)
+      load_stage1_binary(binary_cache);
+    else
+      load_stage1_text(cache_stage1);
   }
   int inc = 0, sinc = 0, ainc = 0, asinc = 0, cinc = 0;
   for (uint32_t i = 1; i <= inode_count_; ++i)
@@ -335,10 +543,10 @@ void init_dir_inode_to_block_cache(void)
       if (is_journal(iter->block()))
       {
         ++journal_block_count;
-	block_in_journal_to_descriptors_map_type::iterator iter2 = block_in_journal_to_descriptors_map.find(iter->block());
-	if (iter2 != block_in_journal_to_descriptors_map.end())
+	Descriptor descriptor;
+	if (block_in_journal_to_descriptor(iter->block(), descriptor))
 	{
-	  uint32_t sequence = iter2->second->sequence();
+	  uint32_t sequence = descriptor.sequence();
 	  highest_sequence = std::max(highest_sequence, sequence);
 	}
 	else
@@ -360,7 +568,8 @@ void init_dir_inode_to_block_cache(void)
       {
         if (need_keep_one_journal)
 	{
-	  block_in_journal_to_descriptors_map_type::iterator iter2 = block_in_journal_to_descriptors_map.find(iter->block());
+	  Descriptor descriptor;
+	  bool has_descriptor = block_in_journal_to_descriptor(iter->block(), descriptor);
 	  if (highest_sequence == 0 && iter->block() == min_block)
 	  {
 	    std::cout << std::flush;
@@ -370,7 +579,7 @@ void init_dir_inode_to_block_cache(void)
 		" but we're disregarding it because ext3grep can't deal with journal blocks without a descriptor block.";
 	    std::cerr << std::endl;
 	  }
-	  if (iter2 != block_in_journal_to_descriptors_map.end() && iter2->second->sequence() == highest_sequence)
+	  if (has_descriptor && descriptor.sequence() == highest_sequence)
 	  {
 	    ++iter;
 	    continue;
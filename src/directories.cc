@@ -69,6 +69,56 @@ void iterate_over_directory__with__read_block_action(void) { (void)read_block_ac
 #endif
 bool init_directories_action(ext3_dir_entry_2 const& dir_entry, Inode const&, bool, bool, bool, bool, bool, bool, Parent* parent, void*);
 
+// Calculate allocated, reallocated and filtered for a (non-zero) inode of a dir entry with file type file_type,
+// and update deleted with the deleted state of the inode. On entry, deleted must be true if the dir entry isn't linked.
+static void calculate_dir_entry_flags(InodePointer const& inode, uint32_t inode_number, int file_type,
+    bool& deleted, bool& allocated, bool& reallocated, bool& filtered)
+{
+  allocated = is_allocated(inode_number);
+  reallocated = (deleted && allocated) || (deleted && !inode->is_deleted()) || (feature_incompat_filetype && mode_map[file_type] != (inode->mode() & 0xf000));
+  deleted = deleted || inode->is_deleted();
+  filtered = !(
+      (!commandline_allocated || allocated) &&
+      (!commandline_unallocated || !allocated) &&
+      (!commandline_deleted || deleted) &&
+      (!commandline_directory || is_directory(inode)) &&
+      (!reallocated || commandline_reallocated) &&
+      (reallocated ||
+	  (!inode->is_deleted() && !commandline_deleted) ||
+	  (inode->has_valid_dtime() && commandline_after <= (time_t)inode->dtime() && (!commandline_before || (time_t)inode->dtime() < commandline_before))));
+}
+
+// Block pointers are erased on ext3 on deletion (that is the whole point of writing this tool!),
+// however - in the case of symlinks, the name of the symlink is (still) in this place.
+// Only printing this for regular files and directories, as also char/block devices seem to
+// sometimes have a non-zero block list, and we don't "recover" those anyway.
+static void note_dtime_with_block_list(InodePointer const& inode, uint32_t inode_number)
+{
+  if (inode->has_valid_dtime() && inode->block()[0] != 0 && (is_regular_file(inode) || is_directory(inode)))
+  {
+    time_t dtime = inode->dtime();
+    std::string dtime_str(std::ctime(&dtime));
+    std::cout << "Note: Inode " << inode_number << " has non-zero dtime (" << inode->dtime() <<
+	"  " << dtime_str.substr(0, dtime_str.length() - 1) << ") but non-zero block list (" << inode->block()[0] <<
+	") [ext3grep does" << (inode->is_deleted() ? "" : " not") << " consider this inode to be deleted]\n";
+  }
+}
+
+void DirEntry::calculate_flags(void)
+{
+  zero_inode = (M_inode == 0);
+  filtered = (zero_inode && !commandline_zeroed_inodes);
+  deleted = !linked;
+  allocated = false;
+  reallocated = false;
+  if (!zero_inode)
+  {
+    InodePointer inode(get_inode(M_inode));
+    calculate_dir_entry_flags(inode, M_inode, M_file_type, deleted, allocated, reallocated, filtered);
+    note_dtime_with_block_list(inode, M_inode);
+  }
+}
+
 static void filter_dir_entry(ext3_dir_entry_2 const& dir_entry,
                              bool deleted, bool linked,
 			     bool (*action)(ext3_dir_entry_2 const&, Inode const&, bool, bool, bool, bool, bool, bool, Parent*, void*),
@@ -83,30 +133,8 @@ static void filter_dir_entry(ext3_dir_entry_2 const& dir_entry,
   if (!zero_inode)
   {
     inode = get_inode(dir_entry.inode);
-    allocated = is_allocated(dir_entry.inode);
-    reallocated = (deleted && allocated) || (deleted && !inode->is_deleted()) || (feature_incompat_filetype && mode_map[file_type] != (inode->mode() & 0xf000));
-    deleted = deleted || inode->is_deleted();
-    // Block pointers are erased on ext3 on deletion (that is the whole point of writing this tool!),
-    // however - in the case of symlinks, the name of the symlink is (still) in this place.
-    // Only printing this for regular files and directories, as also char/block devices seem to
-    // sometimes have a non-zero block list, and we don't "recover" those anyway.
-    if (inode->has_valid_dtime() && inode->block()[0] != 0 && (is_regular_file(inode) || is_directory(inode)))
-    {
-      time_t dtime = inode->dtime();
-      std::string dtime_str(std::ctime(&dtime));
-      std::cout << "Note: Inode " << dir_entry.inode << " has non-zero dtime (" << inode->dtime() <<
-	  "  " << dtime_str.substr(0, dtime_str.length() - 1) << ") but non-zero block list (" << inode->block()[0] <<
-	  ") [ext3grep does" << (inode->is_deleted() ? "" : " not") << " consider this inode to be deleted]\n";
-    }
-    filtered = !(
-	(!commandline_allocated || allocated) &&
-	(!commandline_unallocated || !allocated) &&
-	(!commandline_deleted || deleted) &&
-	(!commandline_directory || is_directory(inode)) &&
-	(!reallocated || commandline_reallocated) &&
-	(reallocated ||
-	    (!inode->is_deleted() && !commandline_deleted) ||
-	    (inode->has_valid_dtime() && commandline_after <= (time_t)inode->dtime() && (!commandline_before || (time_t)inode->dtime() < commandline_before))));
+    calculate_dir_entry_flags(inode, dir_entry.inode, file_type, deleted, allocated, reallocated, filtered);
+    note_dtime_with_block_list(inode, dir_entry.inode);
   }
   if (no_filtering)	// Also no recursion.
     // inode is dereferenced here in good faith that no reference to it is kept (since there are no structs or classes that do so).
@@ -233,16 +261,13 @@ void iterate_over_directory(unsigned char* block, int blocknr,
   }
 
   // Search for deleted entries.
+  DirectoryChains chains(block, blocknr);
   offset = block_size_ - EXT3_DIR_REC_LEN(1);
   while (offset > 0)
   {
     dir_entry = reinterpret_cast<ext3_dir_entry_2 const*>(block + offset);
-    if (!map[offset / EXT3_DIR_PAD])
-    {
-      DirectoryBlockStats stats;
-      if (is_directory(block, blocknr, stats, false, false, offset))
-        filter_dir_entry(*dir_entry, true, false, action, parent, data);
-    }
+    if (!map[offset / EXT3_DIR_PAD] && chains.is_directory(offset))
+      filter_dir_entry(*dir_entry, true, false, action, parent, data);
     offset -= EXT3_DIR_PAD;
   }
 
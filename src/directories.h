@@ -59,6 +59,9 @@ struct DirEntry {
 
   bool exactly_equal(DirEntry const& de) const;
   void print(void) const;
+  // Calculate deleted, allocated, reallocated, zero_inode and filtered from M_inode, M_file_type and linked
+  // (and print the same notes as filter_dir_entry would).
+  void calculate_flags(void);
 };
 
 class DirectoryBlock {
@@ -67,6 +70,8 @@ class DirectoryBlock {
     std::vector<DirEntry> M_dir_entry;
   public:
     void read_block(int block, std::list<DirectoryBlock>::iterator iter);
+    // Used instead of read_block when the dir entries are restored from the stage2 cache.
+    void set_block(int block) { M_block = block; }
     void read_dir_entry(ext3_dir_entry_2 const& dir_entry, Inode const& inode,
         bool deleted, bool allocated, bool reallocated, bool zero_inode, bool linked, bool filtered, std::list<DirectoryBlock>::iterator iter);
 
@@ -63,8 +63,16 @@
 #include "indirect_blocks.h"
 #include "restore.h"
 #include "get_block.h"
+#include "read_ahead.h"
+#include "search.h"
+#include "dfa_search.h"
+#include "block_to_inode.h"
 #include "init_consts.h"
 #include "print_inode_to.h"
+#include "block_cache.h"
+#include "journal.h"
+#include "inode_scan.h"
+#include "inode_index.h"
 
 //-----------------------------------------------------------------------------
 //
@@ -77,6 +85,76 @@ extern char const* svn_revision;
 
 extern void custom(void);
 
+// The block that is being searched for --search-file.
+struct search_file_hit_st {
+  MultiPatternSearch const* search;
+  int block;
+  bool allocated;		// Print "(allocated)" behind each hit in this block.
+};
+
+// Print a single --search-file hit. A negative offset means that the match started in a previous block.
+// Patterns can be longer than a block, so that can be any number of blocks back.
+static void print_search_file_hit(long offset, int index, void* data)
+{
+  search_file_hit_st& hit(*reinterpret_cast<search_file_hit_st*>(data));
+  int block = hit.block;
+  bool allocated = hit.allocated;
+  if (offset < 0)
+  {
+    while (offset < 0)
+    {
+      offset += block_size_;
+      --block;
+    }
+    // The blocks before hit.block were searched too, so the bitmap of their group is loaded.
+    int group = block_to_group(super_block, block);
+    bitmap_ptr bmp = get_bitmap_mask(block - group_to_block(super_block, group));
+    allocated = !commandline_allocated && (block_bitmap[group][bmp.index] & bmp.mask);
+  }
+  std::cout << block << ' ' << offset << ' ' << hit.search->id(index) << " \"" << hit.search->pattern(index) << '"';
+  if (allocated)
+    std::cout << " (allocated)";
+  std::cout << '\n';
+}
+
+// Print the histogram of 'type', computed from the inode index.
+static void print_histogram(hist_type type)
+{
+  if (commandline_deleted || type == hist_dtime)
+    std::cout << "Only showing deleted entries.\n";
+  if (type == hist_group)
+    hist_init(0, groups_);
+  else
+    hist_init(commandline_after, commandline_before);
+  std::vector<int> counts(histsize, 0);
+  inode_index_histogram(type, counts);
+  hist_merge(counts);
+  hist_print(type);
+}
+
+// Find the allocated inodes of a group that are filled with zeroes (--search-zeroed-inodes). Called from a worker thread.
+static void zeroed_inodes_process_group(int group, unsigned char const* inode_table, int, void* data)
+{
+  std::vector<uint32_t>& zeroed_inodes((*static_cast<std::vector<std::vector<uint32_t> >*>(data))[group]);
+  static char const zeroes[sizeof(Inode)] = {0, };
+  // Only look at the allocated inodes.
+  unsigned int run_begin, run_end;
+  for (unsigned int bit = 0; bitmap_next_run(inode_bitmap[group], bit, inodes_per_group_, true, run_begin, run_end); bit = run_end)
+    for (unsigned int inode = run_begin; inode < run_end; ++inode)
+      if (std::memcmp(&inode_table_entry(inode_table, inode), zeroes, sizeof(zeroes)) == 0)
+	zeroed_inodes.push_back(group * inodes_per_group_ + inode + 1);
+}
+
+// Print the zeroed inodes of a group, in group order.
+static void zeroed_inodes_commit_group(int group, void* data)
+{
+  std::vector<uint32_t>& zeroed_inodes((*static_cast<std::vector<std::vector<uint32_t> >*>(data))[group]);
+  for (std::vector<uint32_t>::iterator iter = zeroed_inodes.begin(); iter != zeroed_inodes.end(); ++iter)
+    std::cout << ' ' << *iter;
+  std::cout << std::flush;
+  std::vector<uint32_t>().swap(zeroed_inodes);
+}
+
 void run_program(void)
 {
   Debug(if (!commandline_debug) dc::notice.off());
@@ -103,11 +181,8 @@ void run_program(void)
     int first_block = journal_inode->block()[0];
     ASSERT(first_block);
     // Read the first superblock.
-    device.seekg(block_to_offset(first_block));
-    ASSERT(device.good());
     // journal_super_block is initialized here.
-    device.read(reinterpret_cast<char*>(&journal_super_block), sizeof(journal_superblock_s));
-    ASSERT(device.good());
+    read_device(block_to_offset(first_block), &journal_super_block, sizeof(journal_superblock_s));
     if (commandline_superblock && commandline_journal)
     {
       // Print contents of superblock.
@@ -127,6 +202,12 @@ void run_program(void)
     std::cerr << progname << ": --journal: The journal is on an external device. Please add support for it." << std::endl;
     exit(EXIT_FAILURE);
   }
+  if (commandline_as_of != -1 && !super_block.s_journal_inum)
+  {
+    std::cout << std::flush;
+    std::cerr << progname << ": --as-of: The journal is on an external device. Please add support for it." << std::endl;
+    exit(EXIT_FAILURE);
+  }
   if (commandline_custom)
   {
     custom();
@@ -206,16 +287,15 @@ void run_program(void)
   {
     if (commandline_inode_to_block != -1)
       commandline_group = inode_to_group(super_block, commandline_inode_to_block);
+    IOStage io_stage(io_stage_metadata);
     if (!commandline_group)
       std::cout << "Loading group metadata.." << std::flush;
-    for (int group = 0; group < groups_; ++group)
-    {
-      if (commandline_group != -1 && group != commandline_group)
-	continue;
-      if (!commandline_group)
-	std::cout << '.' << std::flush;
-      load_meta_data(group);
-    }
+    if (!commandline_group)
+      std::cout << '.' << std::flush;
+    if (commandline_group == -1)
+      load_meta_data(0, groups_);
+    else
+      load_meta_data(commandline_group, commandline_group + 1);
     if (!commandline_group)
       std::cout << " done\n";
   }
@@ -223,6 +303,14 @@ void run_program(void)
   // Needed here?
   init_journal();
 
+  // Handle --as-of
+  if (commandline_as_of != -1)
+  {
+    init_journal_as_of(commandline_as_of);
+    // Replace the metadata that was already loaded with its state as of that transaction.
+    reload_meta_data();
+  }
+
   // Handle --inode
   if (commandline_inode != -1)
   {
@@ -279,10 +367,7 @@ void run_program(void)
       }
       else
       {
-	device.seekg(block_to_offset(commandline_block));
-	ASSERT(device.good());
-	device.read(reinterpret_cast<char*>(block), block_size_);
-	ASSERT(device.good());
+	get_block(commandline_block, block);
       }
       if (commandline_print)
       {
@@ -521,87 +606,48 @@ void run_program(void)
   // Handle --histogram
   if (commandline_histogram)
   {
+    init_inode_index();
     std::cout << '\n';
     if (commandline_group != -1)
       std::cout << "Only showing histogram of group " << commandline_group << '\n';
     print_restrictions();
-    if (commandline_deleted || commandline_histogram == hist_dtime)
-      std::cout << "Only showing deleted entries.\n";
-    if (commandline_histogram == hist_atime ||
-        commandline_histogram == hist_ctime ||
-	commandline_histogram == hist_mtime ||
-	commandline_histogram == hist_dtime)
-      hist_init(commandline_after, commandline_before);
-    else if (commandline_histogram == hist_group)
-      hist_init(0, groups_);
-    // Run over all (requested) groups.
-    for (int group = 0, ibase = 0; group < groups_; ++group, ibase += inodes_per_group_)
+    if (commandline_histogram == hist_all)
     {
-      if (commandline_group != -1 && group != commandline_group)
-	continue;
-      // Run over all inodes.
-      for (int bit = 0, inode_number = ibase + 1; bit < inodes_per_group_; ++bit, ++inode_number)
+      static hist_type const types[] = { hist_atime, hist_ctime, hist_mtime, hist_dtime, hist_group };
+      static char const* const names[] = { "atime", "ctime", "mtime", "dtime", "group" };
+      for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
       {
-	InodePointer inode(get_inode(inode_number));
-	if (commandline_deleted && !inode->is_deleted())
-	  continue;
-	if ((commandline_histogram == hist_dtime || commandline_histogram == hist_group) && !inode->has_valid_dtime())
-          continue;
-	if (commandline_directory && !is_directory(inode))
-	  continue;
-	if (commandline_allocated || commandline_unallocated)
-	{
-	  bitmap_ptr bmp = get_bitmap_mask(bit);
-	  bool allocated = (inode_bitmap[group][bmp.index] & bmp.mask);
-	  if (commandline_allocated && !allocated)
-	    continue;
-	  if (commandline_unallocated && allocated)
-	    continue;
-	}
-	time_t xtime = 0;
-	if (commandline_histogram == hist_dtime)
-	  xtime = inode->dtime();
-	else if (commandline_histogram == hist_atime)
-	{
-	  xtime = inode->atime();
-	  if (xtime == 0)
-	    continue;
-        }
-	else if (commandline_histogram == hist_ctime)
-	{
-	  xtime = inode->ctime();
-	  if (xtime == 0)
-	    continue;
-	}
-	else if (commandline_histogram == hist_mtime)
-	{
-	  xtime = inode->mtime();
-	  if (xtime == 0)
-	    continue;
-        }
-	if (xtime && commandline_after <= xtime && xtime < commandline_before)
-	  hist_add(xtime);
-	if (commandline_histogram == hist_group)
-	{
-	  if (commandline_after && commandline_after > (time_t)inode->dtime())
-	    continue;
-	  if (commandline_before && (time_t)inode->dtime() >= commandline_before)
-	    continue;
-	  hist_add(group);
-        }
+	std::cout << "\nHistogram of " << names[i] << ":\n";
+	print_histogram(types[i]);
       }
     }
-    hist_print();
+    else
+      print_histogram(commandline_histogram);
   }
-  // Handle --search and --search-start
-  if (!commandline_search_start.empty() || !commandline_search.empty())
+  // Handle --search, --search-start, --search-file, --search-regex and --search-hex
+  if (!commandline_search_start.empty() || !commandline_search.empty() || !commandline_search_file.empty() ||
+      !commandline_search_regex.empty() || !commandline_search_hex.empty())
   {
     bool start = !commandline_search_start.empty();
-    size_t len = start ? commandline_search_start.length() : commandline_search.length();
-    ASSERT(len <= (size_t)block_size_);
-    char* pattern = new char [len];
-    strncpy(pattern, start ? commandline_search_start.data() : commandline_search.data(), len);
-    static unsigned char block_buf[EXT3_MAX_BLOCK_SIZE];
+    bool multi = !commandline_search_file.empty();
+    bool regex = !commandline_search_regex.empty();
+    bool hex = !commandline_search_hex.empty();
+    std::string pattern = start ? commandline_search_start :
+        regex ? commandline_search_regex : hex ? commandline_search_hex : commandline_search;
+    size_t len = pattern.length();
+    ASSERT(len <= (size_t)block_size_ || regex || hex);
+    MultiPatternSearch multi_pattern_search;
+    if (multi)
+      load_search_patterns(commandline_search_file, multi_pattern_search);
+    DFASearch dfa_search;
+    std::string error;
+    if ((regex && !dfa_search.compile_regex(pattern, error)) ||
+        (hex && !dfa_search.compile_hex(pattern, error)))
+    {
+      std::cout << std::flush;
+      std::cerr << progname << ": " << (regex ? "--search-regex" : "--search-hex") << ": \"" << pattern << "\": " << error << '.' << std::endl;
+      exit(EXIT_FAILURE);
+    }
     if (commandline_allocated && commandline_unallocated)
       commandline_allocated = commandline_unallocated = false;
     if (commandline_allocated)
@@ -610,8 +656,17 @@ void run_program(void)
       std::cout << "Unallocated blocks ";
     else
       std::cout << "Blocks ";
-    std::cout << (start ? "starting with" : "containing") << " \"" << std::string(pattern, len) << "\":" << std::flush;
+    if (multi)
+      std::cout << "containing any of the " << multi_pattern_search.size() << " patterns in \"" << commandline_search_file << "\"" <<
+          " (BLOCK OFFSET LINE \"PATTERN\"):\n" << std::flush;
+    else if (regex || hex)
+      std::cout << "matching " << (regex ? "regular expression" : "hex pattern") << " \"" << pattern << "\":" << std::flush;
+    else
+      std::cout << (start ? "starting with" : "containing") << " \"" << pattern << "\":" << std::flush;
     ASSERT((inodes_per_group_ * inode_size_) % block_size_ == 0);
+    SearchPattern search_pattern(pattern);
+    // Stream all blocks of all groups, except the inode tables, from disk.
+    ReadAhead read_ahead;
     for (int group = 0; group < groups_; ++group)
     {
       int first_block = group_to_block(super_block, group);  
@@ -619,99 +674,124 @@ void run_program(void)
       // Skip inodes.
       int inode_table = group_descriptor_table[group].bg_inode_table;
       first_block = inode_table + inodes_per_group_ * inode_size_ / block_size_;
-      unsigned int bit = first_block - first_data_block(super_block) - group * blocks_per_group(super_block);
-      for (int block = first_block; block < last_block; ++block, ++bit)
+      if (!commandline_allocated && !commandline_unallocated)
+      {
+	read_ahead.add_range(first_block, last_block);
+	continue;
+      }
+      // Only read the runs of blocks that pass the filter.
+      int const group_block = group_to_block(super_block, group);
+      unsigned int const first_bit = first_block - group_block;
+      unsigned int const end_bit = last_block - group_block;
+      // Skip groups that are fully allocated (--unallocated) or fully unallocated (--allocated).
+      unsigned int const allocated_blocks = bitmap_count(block_bitmap[group], first_bit, end_bit);
+      if (allocated_blocks == (commandline_allocated ? 0 : end_bit - first_bit))
+	continue;
+      unsigned int run_begin, run_end;
+      for (unsigned int bit = first_bit;
+          bitmap_next_run(block_bitmap[group], bit, end_bit, commandline_allocated, run_begin, run_end); bit = run_end)
+	read_ahead.add_blocks(group_block + run_begin, group_block + run_end);
+      // Don't read the inode table of the next group to fill a gap.
+      read_ahead.end_range();
+    }
+    read_ahead.start();
+    int block;
+    unsigned char* block_buf;
+    search_file_hit_st hit;
+    hit.search = &multi_pattern_search;
+    hit.allocated = false;
+    // A match may continue in the next block, if that block is also searched.
+    int previous_block = -2;
+    // The last len - 1 bytes of the previous block, followed by the first len - 1 bytes of the current block.
+    std::vector<unsigned char> boundary(2 * len);
+    while ((block_buf = read_ahead.next_block(block)))
+    {
+      int group = block_to_group(super_block, block);
+      unsigned int bit = block - group_to_block(super_block, group);
+      bitmap_ptr bmp = get_bitmap_mask(bit);
+      bool allocated = (block_bitmap[group][bmp.index] & bmp.mask);
+      if (commandline_allocated && !allocated)
+	continue;
+      if (commandline_unallocated && allocated)
+	continue;
+      bool resume = (block == previous_block + 1);
+      previous_block = block;
+      if (multi)
+      {
+	hit.block = block;
+	hit.allocated = !commandline_allocated && allocated;
+	multi_pattern_search.find_all(block_buf, block_size_, print_search_file_hit, &hit, resume);
+	continue;
+      }
+      bool found = false;
+      int starts_in = -1;	// The previous block, if the only match found started there.
+      if (regex || hex)
+	found = dfa_search.search(block_buf, block_size_, resume);
+      else if (start)
       {
-	bitmap_ptr bmp = get_bitmap_mask(bit);
-	bool allocated = (block_bitmap[group][bmp.index] & bmp.mask);
-	if (commandline_allocated && !allocated)
-	  continue;
-	if (commandline_unallocated && allocated)
-	  continue;
-	bool found = false;
-        get_block(block, block_buf);
-        if (start)
-	{
 #if 1
-	  if (std::memcmp(block_buf, pattern, len) == 0)
-	    found = true;
+	if (std::memcmp(block_buf, pattern.data(), len) == 0)
+	  found = true;
 #else
-          if (std::isdigit(block_buf[0]) && std::isdigit(block_buf[1]) && std::isdigit(block_buf[2]) && block_buf[3] == ' ' && std::isdigit(block_buf[4]) &&
-	      std::isdigit(block_buf[5]) && block_buf[9] == 0 && block_buf[10] == 0 && block_buf[11] == 0 && block_buf[12] == 0 &&
-	      block_buf[13] == 0 && block_buf[14] == 0 && block_buf[15] == 0 && block_buf[16] == 0)
-	    std::cout << block << " : " << block_buf << '\n';
+	if (std::isdigit(block_buf[0]) && std::isdigit(block_buf[1]) && std::isdigit(block_buf[2]) && block_buf[3] == ' ' && std::isdigit(block_buf[4]) &&
+	    std::isdigit(block_buf[5]) && block_buf[9] == 0 && block_buf[10] == 0 && block_buf[11] == 0 && block_buf[12] == 0 &&
+	    block_buf[13] == 0 && block_buf[14] == 0 && block_buf[15] == 0 && block_buf[16] == 0)
+	  std::cout << block << " : " << block_buf << '\n';
 #endif
-	}
-        else
+      }
+      else
+      {
+	if (search_pattern.find(block_buf, block_size_))
+	  found = true;
+	else if (resume && len > 1)
 	{
-	  for (unsigned char* ptr = block_buf; ptr < block_buf + block_size_ - len; ++ptr)
+	  // Look for a match that starts at the end of the previous block.
+	  std::memcpy(&boundary[len - 1], block_buf, len - 1);
+	  if (search_pattern.find(&boundary[0], 2 * (len - 1)))
 	  {
-	    if (*ptr == *pattern &&
-	        (len == 1 || (ptr[1] == pattern[1] &&
-		(len == 2 || (ptr[2] == pattern[2] && std::memcmp(ptr, pattern, len) == 0)))))
-	    {
-	      found = true;
-	      break;
-	    }
+	    found = true;
+	    starts_in = block - 1;
 	  }
 	}
-	if (found)
-	{
-	  if (!commandline_allocated && allocated)
-	    std::cout << ' ' << block << " (allocated)" << std::flush;
-          else
-	    std::cout << ' ' << block << std::flush;
-        }
+	if (len > 1)
+	  std::memcpy(&boundary[0], block_buf + block_size_ - (len - 1), len - 1);
+      }
+      if (found)
+      {
+	std::cout << ' ' << block;
+	if (!commandline_allocated && allocated)
+	  std::cout << " (allocated)";
+	if (starts_in != -1)
+	  std::cout << " (starts in " << starts_in << ')';
+	std::cout << std::flush;
       }
     }
-    delete [] pattern;
-    std::cout << '\n';
+    if (!multi)
+      std::cout << '\n';
   }
   // Handle --search-inode
   if (commandline_search_inode != -1)
   {
-    std::cout << "Inodes refering to block " << commandline_search_inode << ':' << std::flush;
-    for (uint32_t inode = 1; inode <= inode_count_; ++inode)
-    {
-      InodePointer ino = get_inode(inode);
-      if (is_symlink(ino))
-        continue;		// Does not refer to any block, and indirect blocks to run over.
-      find_block_data_st data;
-      data.block_looking_for = commandline_search_inode;
-      data.found_block = false;
-#ifdef CPPGRAPH
-      // Tell cppgraph that we call find_block_action from here.
-      iterate_over_all_blocks_of__with__find_block_action();
-#endif
-      bool reused_or_corrupted_indirect_block2 = iterate_over_all_blocks_of(ino, inode, find_block_action, &data);
-      if (reused_or_corrupted_indirect_block2)
-      {
-	std::cout << "\nWARNING: while iterating over all blocks of inode " << inode <<
-	    " a reused or corrupt indirect block was encountered; search aborted.\n";
-        std::cout << "Inodes refering to block " << commandline_search_inode << " (cont):" << std::flush;
-      }
-      if (data.found_block)
-        std::cout << ' ' << inode << std::flush;
-    }
+    init_block_to_inode();
+    std::vector<uint32_t> inodes;
+    block_to_inode_incomplete_inodes(inodes);
+    for (std::vector<uint32_t>::iterator iter = inodes.begin(); iter != inodes.end(); ++iter)
+      std::cout << "WARNING: while iterating over all blocks of inode " << *iter <<
+	  " a reused or corrupt indirect block was encountered; the remaining blocks of this inode were not searched.\n";
+    std::cout << "Inodes refering to block " << commandline_search_inode << ':';
+    block_to_inode(commandline_search_inode, inodes);
+    for (std::vector<uint32_t>::iterator iter = inodes.begin(); iter != inodes.end(); ++iter)
+      std::cout << ' ' << *iter;
     std::cout << '\n';
   }
   // Handle --search-zeroed-inodes
   if (commandline_search_zeroed_inodes)
   {
     std::cout << "Allocated inodes filled with zeroes:" << std::flush;
-    for (uint32_t inode = 1; inode <= inode_count_; ++inode)
-    {
-      if (commandline_group != -1)
-      {
-	int group = (inode - 1) / inodes_per_group_;
-	if (group != commandline_group)
-	  continue;
-      }
-      InodePointer ino = get_inode(inode);
-      static char zeroes[128] = {0, };
-      if (is_allocated(inode) && std::memcmp(&ino, zeroes, sizeof(zeroes)) == 0)
-        std::cout << ' ' << inode << std::flush;
-    }
+    int first_group = (commandline_group != -1) ? commandline_group : 0;
+    int end_group = (commandline_group != -1) ? commandline_group + 1 : groups_;
+    std::vector<std::vector<uint32_t> > zeroed_inodes(groups_);
+    scan_inode_tables(first_group, end_group, zeroed_inodes_process_group, zeroed_inodes_commit_group, &zeroed_inodes);
     std::cout << '\n';
   }
   // Handle --inode-to-block
@@ -815,51 +895,34 @@ int main(int argc, char* argv[])
   }
 
   // Open the device.
-  device.open(*argv);
-  if (!device.good())
-  {
-    int error = errno;
-    std::cout << std::flush;
-    std::cerr << progname << ": failed to read-only open device \"" << *argv << "\": " << strerror(error) << std::endl;
-    exit(EXIT_FAILURE);
-  }
-#if USE_MMAP
   device_fd = open(*argv, O_RDONLY);
   if (device_fd == -1)
   {
     int error = errno;
     std::cout << std::flush;
-    std::cerr << progname << ": failed to open device \"" << *argv << "\" for reading: " << strerror(error) << std::endl;
+    std::cerr << progname << ": failed to read-only open device \"" << *argv << "\": " << strerror(error) << std::endl;
     exit(EXIT_FAILURE);
   }
-#endif
+  device_name = *argv;
 
   // Read the first superblock.
 
   // The size of a super block is 1024 bytes.
   assert(sizeof(ext3_super_block) == 1024);
-  device.seekg(SUPER_BLOCK_OFFSET);
-  if (!device.good())
-  {
-    int error = errno;
-    std::cout << std::flush;
-    std::cerr << progname << ": failed to seek to position " << SUPER_BLOCK_OFFSET << " of \"" << *argv << "\": " << strerror(error) << std::endl;
-    exit(EXIT_FAILURE);
-  }
   // super_block is initialized here.
-  device.read(reinterpret_cast<char*>(&super_block), sizeof(ext3_super_block));
-  if (!device.good())
-  {
-    int error = errno;
-    std::cout << std::flush;
-    std::cerr << progname << ": failed to read first superblock from \"" << *argv << "\": " << strerror(error) << std::endl;
-    exit(EXIT_FAILURE);
-  }
+  read_device(SUPER_BLOCK_OFFSET, &super_block, sizeof(ext3_super_block));
 
   // Initialize global constants.
-  device_name = *argv;
   init_consts();
 
+  if (commandline_stats)
+  {
+#if USE_MMAP
+    atexit(print_inode_mmap_stats);
+#endif
+    atexit(print_io_stats);
+  }
+
   try
   {
     run_program();
@@ -877,8 +940,5 @@ int main(int argc, char* argv[])
     exit(EXIT_FAILURE);
   }
 
-  device.close();
-#if USE_MMAP
   close(device_fd);
-#endif
 }
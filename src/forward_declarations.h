@@ -27,9 +27,11 @@
 #ifndef USE_PCH
 #include <iosfwd>		// Needed for std::ostream
 #include <string>		// Needed for std::string
+#include <vector>		// Needed for std::vector
 #endif
 
 #include "is_blockdetection.h"	// Needed for is_directory_type
+#include "histogram.h"		// Needed for hist_type
 
 // Forward declarations.
 struct Parent;
@@ -44,7 +46,8 @@ void iterate_over_existing_directory_action(int blocknr, int, void* data);
 void iterate_over_journal(
     bool (*action_tag)(uint32_t block, uint32_t sequence, journal_block_tag_t*, void* data),
     bool (*action_revoke)(uint32_t block, uint32_t sequence, journal_revoke_header_t*, void* data),
-    bool (*action_commit)(uint32_t block, uint32_t sequence, void* data), void* data);
+    bool (*action_commit)(uint32_t block, uint32_t sequence, void* data), void* data,
+    bool (*action_tag_data)(uint32_t block, uint32_t block_nr, unsigned char const* block_buf, void* data) = NULL);
 void print_directory(unsigned char* block, int blocknr);
 void print_restrictions(void);
 bool is_directory(Inode const& inode);
@@ -57,7 +60,10 @@ bool is_indirect_block_in_journal(int blocknr);
 bool is_symlink(Inode const& inode);
 void hist_init(size_t min, size_t max);
 void hist_add(size_t val);
+int hist_bucket(size_t val);
+void hist_merge(std::vector<int> const& counts);
 void hist_print(void);
+void hist_print(hist_type type);
 int dir_inode_to_block(uint32_t inode);
 int journal_block_to_real_block(int blocknr);
 void init_journal(void);
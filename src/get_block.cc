@@ -1,6 +1,6 @@
 // ext3grep -- An ext3 file system investigation and undelete tool
 //
-//! @file get_block.cc Implementation of the get_block function.
+//! @file get_block.cc Implementation of the block device I/O functions.
 //
 // Copyright (C) 2008, by
 // 
@@ -23,17 +23,119 @@
 
 #ifndef USE_PCH
 #include "sys.h"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
 #include "debug.h"
 #endif
 
+#include "get_block.h"
+#include "block_cache.h"
+#include "journal_overlay.h"
 #include "globals.h"
 #include "conversion.h"
 
-unsigned char* get_block(int block, unsigned char* block_buf)
+static void read_error(off_t offset, size_t size, ssize_t res, int error)
 {
-  device.seekg(block_to_offset(block));
-  ASSERT(device.good());
-  device.read((char*)block_buf, block_size_);
-  ASSERT(device.good());
+  std::cout << std::flush;
+  std::cerr << progname << ": failed to read " << size << " bytes at offset " << offset << " of \"" << device_name << "\": ";
+  if (res == 0)
+    std::cerr << "unexpected end of file";
+  else
+    std::cerr << strerror(error);
+  std::cerr << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+void read_device(off_t offset, void* buf, size_t size)
+{
+  char* ptr = static_cast<char*>(buf);
+  while (size > 0)
+  {
+    ssize_t res = pread(device_fd, ptr, size, offset);
+    if (res <= 0)
+    {
+      if (res == -1 && errno == EINTR)
+        continue;
+      read_error(offset, size, res, errno);
+    }
+    ptr += res;
+    offset += res;
+    size -= res;
+  }
+  io_stats_read(ptr - static_cast<char*>(buf));
+}
+
+static unsigned char* get_cached_block(int block, unsigned char* block_buf)
+{
+  if (block_cache_lookup(block, block_buf))
+    return block_buf;
+  read_device(block_to_offset(block), block_buf, block_size_);
+  block_cache_insert(block, block_buf);
   return block_buf;
 }
+
+unsigned char* get_block(int block, unsigned char* block_buf)
+{
+  uint32_t source;
+  bool escaped;
+  if (journal_overlay_active && journal_overlay_lookup(block, source, escaped))
+  {
+    // Read the copy of the block in the journal instead.
+    get_cached_block(source, block_buf);
+    if (escaped)
+      journal_overlay_unescape(block_buf);
+    return block_buf;
+  }
+  return get_cached_block(block, block_buf);
+}
+
+unsigned char* get_blocks(int first_block, int count, unsigned char* buf)
+{
+  read_device(block_to_offset(first_block), buf, (size_t)count * block_size_);
+  if (journal_overlay_active)
+    journal_overlay_apply(first_block, count, buf);
+  return buf;
+}
+
+void get_blocks(int first_block, int count, unsigned char* const* block_bufs)
+{
+  ASSERT(count > 0 && count <= IOV_MAX);
+  std::vector<struct iovec> iov(count);
+  for (int i = 0; i < count; ++i)
+  {
+    iov[i].iov_base = block_bufs[i];
+    iov[i].iov_len = block_size_;
+  }
+  off_t offset = block_to_offset(first_block);
+  size_t size = (size_t)count * block_size_;
+  int first = 0;
+  while (first < count)
+  {
+    ssize_t res = preadv(device_fd, &iov[first], count - first, offset);
+    if (res <= 0)
+    {
+      if (res == -1 && errno == EINTR)
+        continue;
+      read_error(offset, size, res, errno);
+    }
+    offset += res;
+    size -= res;
+    // Skip the buffers that were completely filled and adjust the partially filled one.
+    while (first < count && (size_t)res >= iov[first].iov_len)
+      res -= iov[first++].iov_len;
+    if (first < count)
+    {
+      iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + res;
+      iov[first].iov_len -= res;
+    }
+  }
+  io_stats_read((size_t)count * block_size_);
+  if (journal_overlay_active)
+    journal_overlay_apply(first_block, count, block_bufs);
+}
@@ -1,6 +1,6 @@
 // ext3grep -- An ext3 file system investigation and undelete tool
 //
-//! @file get_block.h Declaration of function get_block.
+//! @file get_block.h Declaration of the block device I/O functions.
 //
 // Copyright (C) 2008, by
 // 
@@ -24,6 +24,31 @@
 #ifndef GET_BLOCK_H
 #define GET_BLOCK_H
 
+#ifndef USE_PCH
+#include <sys/types.h>	// Needed for off_t
+#include <cstddef>	// Needed for size_t
+#endif
+
+// All reads from the device go through the functions below.
+// They use pread(2) on device_fd and therefore do not depend on,
+// nor change, a shared file position: they can be called from
+// multiple threads at the same time.
+//
+// A read error (or a read beyond the end of the device) is fatal.
+
+// Read size bytes starting at byte offset of the device into buf.
+void read_device(off_t offset, void* buf, size_t size);
+
+// Read block into block_buf, which must be at least block_size_ bytes.
+// The block is looked up in, and added to, the block cache (see block_cache.h).
+// Like get_blocks, it reads the copy in the journal instead when --as-of is used (see journal_overlay.h).
 unsigned char* get_block(int block, unsigned char* block_buf);
 
+// Read count consecutive blocks, starting at first_block, into buf (count * block_size_ bytes).
+// This and the next function bypass the block cache.
+unsigned char* get_blocks(int first_block, int count, unsigned char* buf);
+
+// Read count consecutive blocks, starting at first_block, into the count buffers of block_bufs (one block each).
+void get_blocks(int first_block, int count, unsigned char* const* block_bufs);
+
 #endif // GET_BLOCK_H
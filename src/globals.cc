@@ -24,7 +24,6 @@
 #ifndef USE_PCH
 #include "sys.h"
 #include <stdint.h>
-#include <fstream>
 #include "ext3.h"
 #endif
 
@@ -53,9 +52,8 @@ Inode journal_inode;
 
 // Globally used variables.
 char const* progname;
-std::ifstream device;
-#if USE_MMAP
 int device_fd;
+#if USE_MMAP
 long page_size_;
 void** all_mmaps;
 int* refs_to_mmap;
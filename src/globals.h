@@ -26,7 +26,6 @@
 
 #ifndef USE_PCH
 #include <stdint.h>	// Needed for uint32_t
-#include <fstream>	// Needed for std::ifstream
 #include <string>	// Needed for std::string
 #endif
 
@@ -57,9 +56,8 @@ extern Inode journal_inode;
 
 // Globally used variables.
 extern char const* progname;
-extern std::ifstream device;
-#if USE_MMAP
 extern int device_fd;
+#if USE_MMAP
 extern long page_size_;
 extern void** all_mmaps;
 extern int* refs_to_mmap;
@@ -25,6 +25,7 @@
 #include "sys.h"
 #include <sys/types.h>
 #include <iomanip>
+#include <vector>
 #include "debug.h"
 #endif
 
@@ -35,7 +36,6 @@
 // Histogram
 //
 
-int const histsize = 100;
 static size_t S_min;
 static size_t S_max;
 static size_t S_bs;
@@ -63,7 +63,23 @@ void hist_add(size_t val)
   S_maxcount = std::max(S_maxcount, histo[(val - S_min) / S_bs]);
 }
 
-void hist_print(void)
+int hist_bucket(size_t val)
+{
+  ASSERT(val >= S_min && val < S_max);
+  return (val - S_min) / S_bs;
+}
+
+void hist_merge(std::vector<int> const& counts)
+{
+  ASSERT(counts.size() == (size_t)histsize);
+  for (int i = 0; i < histsize; ++i)
+  {
+    histo[i] += counts[i];
+    S_maxcount = std::max(S_maxcount, histo[i]);
+  }
+}
+
+void hist_print(hist_type type)
 {
   if (S_maxcount == 0)
   {
@@ -75,10 +91,10 @@ void hist_print(void)
   size_t total_count = 0;
   for (size_t val = S_min;; val += S_bs, ++i)
   {
-    if (commandline_histogram == hist_atime ||
-        commandline_histogram == hist_ctime ||
-	commandline_histogram == hist_mtime ||
-	commandline_histogram == hist_dtime)
+    if (type == hist_atime ||
+        type == hist_ctime ||
+	type == hist_mtime ||
+	type == hist_dtime)
     {
       time_t time_val = val;
       std::string time_str(ctime(&time_val));
@@ -97,3 +113,8 @@ void hist_print(void)
   std::cout << std::setw(8) << S_min << " - " << std::setfill(' ') << std::setw(8) << (S_max - 1) << ' ';
   std::cout << std::setfill(' ') << std::setw(8) << total_count << '\n';
 }
+
+void hist_print(void)
+{
+  hist_print(commandline_histogram);
+}
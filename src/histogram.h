@@ -31,7 +31,11 @@ enum hist_type {
   hist_ctime,           // Request histogram of file modification times.
   hist_mtime,           // Request histogram of inode modification times.
   hist_dtime,           // Request histogram of deletion times.
-  hist_group            // Request histogram of deletions per group.
+  hist_group,           // Request histogram of deletions per group.
+  hist_all              // Request all of the above histograms.
 };
 
+// The number of buckets of the histogram.
+int const histsize = 100;
+
 #endif // HISTOGRAM_H
@@ -60,17 +60,6 @@
 // Indirect blocks
 //
 
-void find_block_action(int blocknr, int, void* ptr)
-{
-  find_block_data_st& data(*reinterpret_cast<find_block_data_st*>(ptr));
-  if (blocknr == data.block_looking_for)
-    data.found_block = true;
-}
-
-#ifdef CPPGRAPH
-void iterate_over_all_blocks_of__with__find_block_action(void) { find_block_action(0, 0, NULL); }
-#endif
-
 void print_directory_action(int blocknr, int, void*)
 {
   static bool using_static_buffer = false;
@@ -44,12 +44,6 @@ unsigned int const hole_bit = 4;		// Call action() for holes (blocknr will be 0)
 
 void print_directory_action(int blocknr, int file_block_nr, void*);
 bool iterate_over_all_blocks_of(Inode const& inode, int inode_number, void (*action)(int, int, void*), void* data = NULL, unsigned int indirect_mask = direct_bit, bool diagnose = false);
-void find_block_action(int blocknr, int file_block_nr, void* ptr);
-
-struct find_block_data_st {
-  bool found_block;
-  int block_looking_for;
-};
 
 inline bool iterate_over_all_blocks_of(InodePointer inode, int inode_number, void (*action)(int, int, void*), void* data = NULL,
     unsigned int indirect_mask = direct_bit, bool diagnose = false)
@@ -32,6 +32,7 @@
 #include "forward_declarations.h"
 #include "init_consts.h"
 #include "conversion.h"
+#include "get_block.h"
 
 //-----------------------------------------------------------------------------
 //
@@ -130,8 +131,5 @@ void init_consts()
   ASSERT(EXT3_DESC_PER_BLOCK(&super_block) * sizeof(ext3_group_desc) == (size_t)block_size_);
   group_descriptor_table = new ext3_group_desc[groups_];
 
-  device.seekg(block_to_offset(group_descriptor_table_block));
-  ASSERT(device.good());
-  device.read(reinterpret_cast<char*>(group_descriptor_table), sizeof(ext3_group_desc) * groups_);
-  ASSERT(device.good());
+  read_device(block_to_offset(group_descriptor_table_block), group_descriptor_table, sizeof(ext3_group_desc) * groups_);
 }
@@ -28,17 +28,22 @@
 #include <unistd.h>
 #include <cerrno>
 #include <sstream>
+#include <fstream>
+#include <set>
 #endif
 
 #include "locate.h"
 #include "init_directories.h"
 #include "blocknr_vector_type.h"
+#include "globals.h"
 #include "Parent.h"
 #include "forward_declarations.h"
 #include "commandline.h"
 #include "get_block.h"
+#include "block_cache.h"
 #include "journal.h"
 #include "dir_inode_to_block.h"
+#include "cache_file.h"
 
 all_directories_type all_directories;
 inode_to_directory_type inode_to_directory;
@@ -357,6 +362,271 @@ bool find_inode_number_of_extended_directory_block(int blocknr, unsigned char* b
   return false;	// Done
 }
 
+// Write the result of stage 2 as text.
+static void write_stage2_text(std::string const& cache_stage2)
+{
+  std::ofstream cache;
+  cache.open(cache_stage2.c_str());
+  cache << "# Stage 2 data for " << device_name << ".\n";
+  cache << "# Inodes path and directory blocks.\n";
+  cache << "# INODE PATH BLOCK [BLOCK ...]\n";
+
+  for (inode_to_directory_type::iterator iter = inode_to_directory.begin(); iter != inode_to_directory.end(); ++iter)
+  {
+    cache << iter->first << " '" << iter->second->first << "'";
+    Directory& directory(iter->second->second);
+    if (directory.inode_number() != iter->first)
+    {
+      std::cerr << "ERROR: inode_to_directory entry with inode number " << iter->first <<
+	  " points to a Directory with inode number " << directory.inode_number() << " (path \"" << iter->second->first << "\")." << std::endl; 
+    }
+    ASSERT(directory.inode_number() == iter->first);
+    for (std::list<DirectoryBlock>::iterator iter2 = directory.blocks().begin(); iter2 != directory.blocks().end(); ++iter2)
+      cache << ' ' << iter2->block();
+    cache << '\n';
+  }
+
+  cache << "# END\n";
+  cache.close();
+}
+
+// The records of a binary stage2 cache file.
+struct Stage2Directory {
+  uint32_t inode;
+  uint32_t path_offset;		// Offset of the path in section 1.
+  uint32_t path_length;
+  uint32_t first_block;		// Index of the first block of this directory in section 2.
+  uint32_t number_of_blocks;
+};
+
+struct Stage2DirEntry {
+  uint32_t inode;
+  uint32_t name_offset;		// Offset of the name in section 5.
+  int32_t next;			// DirEntry::index.next.
+  uint8_t name_len;
+  uint8_t file_type;
+  uint8_t linked;
+  uint8_t padding;
+};
+
+// Write the result of stage 2 as binary cache file.
+// Section 0: all directories, in the order of inode_to_directory (Stage2Directory).
+// Section 1: the paths of the directories (char).
+// Section 2: the directory blocks of all directories (uint32_t).
+// Section 3: for each directory block the index of its first dir entry in section 4, plus a terminating index (uint32_t).
+// Section 4: the dir entries of all directory blocks, in the order of DirectoryBlock::dir_entries() (Stage2DirEntry).
+// Section 5: the names of the dir entries (char).
+//
+// The flags of the dir entries that depend on the inodes and the commandline options are recalculated when loading.
+static void write_stage2_binary(std::string const& cache_stage2)
+{
+  std::vector<Stage2Directory> directories;
+  std::string paths;
+  std::vector<uint32_t> blocks;
+  std::vector<uint32_t> first_entry;
+  std::vector<Stage2DirEntry> entries;
+  std::string names;
+  for (inode_to_directory_type::iterator iter = inode_to_directory.begin(); iter != inode_to_directory.end(); ++iter)
+  {
+    Directory& directory(iter->second->second);
+    ASSERT(directory.inode_number() == iter->first);
+    Stage2Directory stage2_directory;
+    stage2_directory.inode = iter->first;
+    stage2_directory.path_offset = paths.size();
+    stage2_directory.path_length = iter->second->first.size();
+    stage2_directory.first_block = blocks.size();
+    stage2_directory.number_of_blocks = directory.blocks().size();
+    directories.push_back(stage2_directory);
+    paths += iter->second->first;
+    for (std::list<DirectoryBlock>::iterator iter2 = directory.blocks().begin(); iter2 != directory.blocks().end(); ++iter2)
+    {
+      blocks.push_back(iter2->block());
+      first_entry.push_back(entries.size());
+      std::vector<DirEntry> const& dir_entries(iter2->dir_entries());
+      for (std::vector<DirEntry>::const_iterator iter3 = dir_entries.begin(); iter3 != dir_entries.end(); ++iter3)
+      {
+	ASSERT(iter3->index.cur == iter3 - dir_entries.begin());
+	Stage2DirEntry entry;
+	entry.inode = iter3->M_inode;
+	entry.name_offset = names.size();
+	entry.next = iter3->index.next;
+	entry.name_len = iter3->M_name.size();
+	entry.file_type = iter3->M_file_type;
+	entry.linked = iter3->linked;
+	entry.padding = 0;
+	entries.push_back(entry);
+	names += iter3->M_name;
+      }
+    }
+  }
+  first_entry.push_back(entries.size());
+  CacheFileWriter cache(cache_stage2, "stage2");
+  cache.add_section(directories.empty() ? NULL : &directories[0], directories.size() * sizeof(Stage2Directory));
+  cache.add_section(paths.data(), paths.size());
+  cache.add_section(blocks.empty() ? NULL : &blocks[0], blocks.size() * sizeof(uint32_t));
+  cache.add_section(&first_entry[0], first_entry.size() * sizeof(uint32_t));
+  cache.add_section(entries.empty() ? NULL : &entries[0], entries.size() * sizeof(Stage2DirEntry));
+  cache.add_section(names.data(), names.size());
+  cache.commit();
+}
+
+// Load the result of stage 2 from a text file.
+static void load_stage2_text(std::string const& cache_stage2)
+{
+  std::ifstream cache;
+  cache.open(cache_stage2.c_str());
+  if (!cache.is_open())
+  {
+    int error = errno;
+    std::cout << " error" << std::endl;
+    std::cerr << progname << ": failed to open " << cache_stage2 << ": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  int inode;
+  int blocknr;
+  char c;
+  // Skip initial comments.
+  for(;;)
+  {
+    cache.get(c);
+    if (c == '#')
+      cache.ignore(std::numeric_limits<int>::max(), '\n');
+    else
+    {
+      cache.putback(c);
+      break;
+    }
+  }
+  std::stringstream buf;
+  int count = 0;
+  while (cache >> inode)
+  {
+    cache.get(c);
+    ASSERT(c == ' ');
+    cache.get(c);
+    ASSERT(c == '\'');
+    buf.clear();
+    buf.str("");
+    cache.get(*buf.rdbuf(), '\n');
+    if (inode == EXT3_ROOT_INO)       // If the function extracts no elements, it calls setstate(failbit).
+      cache.clear();
+    cache.get(c);     // Extraction stops on end-of-file or on an element that compares equal to delim (which is not extracted).
+    ASSERT(c == '\n');
+    std::string::size_type pos = buf.str().find_last_of('\'');
+    ASSERT(pos != std::string::npos);
+    std::pair<all_directories_type::iterator, bool> res = all_directories.insert(all_directories_type::value_type(buf.str().substr(0, pos), Directory(inode)));
+    ASSERT(res.second);
+    std::pair<inode_to_directory_type::iterator, bool> res2 = inode_to_directory.insert(inode_to_directory_type::value_type(inode, res.first));
+    ASSERT(res2.second);
+    buf.seekg(pos + 1);
+    std::vector<uint32_t> block_numbers;
+    while(buf >> blocknr)
+    {
+      block_numbers.push_back(blocknr);
+      c = buf.get();
+      if (c != ' ')
+      {
+	ASSERT(buf.eof());
+	break;
+      }
+    }
+    dir_inode_to_block_cache[inode] = block_numbers;
+    std::list<DirectoryBlock>& blocks(res.first->second.blocks());
+    blocks.resize(block_numbers.size());
+    std::list<DirectoryBlock>::iterator directory_block_iter = blocks.begin();
+    for (std::vector<uint32_t>::iterator block_number_iter = block_numbers.begin();
+	block_number_iter != block_numbers.end(); ++block_number_iter, ++directory_block_iter)
+      directory_block_iter->read_block(*block_number_iter, directory_block_iter);
+    if (++count % 100 == 0)
+      std::cout << '.' << std::flush;
+  }
+  cache.close();
+}
+
+// Return true if the binary stage 2 cache file is consistent. Otherwise print why it is ignored and return false.
+static bool stage2_binary_is_valid(CacheFileReader const& cache)
+{
+  if (!cache.has_sections(6))
+    return cache.corrupt();
+  size_t number_of_directories, paths_size, number_of_blocks, number_of_first_entry, number_of_entries, names_size;
+  Stage2Directory const* directories = cache.section<Stage2Directory>(0, number_of_directories);
+  char const* paths = cache.section<char>(1, paths_size);
+  uint32_t const* blocks = cache.section<uint32_t>(2, number_of_blocks);
+  uint32_t const* first_entry = cache.section<uint32_t>(3, number_of_first_entry);
+  Stage2DirEntry const* entries = cache.section<Stage2DirEntry>(4, number_of_entries);
+  cache.section<char>(5, names_size);
+  if (number_of_first_entry != number_of_blocks + 1 || first_entry[0] != 0 || first_entry[number_of_blocks] != number_of_entries)
+    return cache.corrupt();
+  for (size_t b = 0; b < number_of_blocks; ++b)
+    if (blocks[b] >= block_count_ || first_entry[b] > first_entry[b + 1])
+      return cache.corrupt();
+  for (size_t e = 0; e < number_of_entries; ++e)
+    if (entries[e].inode > inode_count_ || entries[e].name_offset > names_size || entries[e].name_len > names_size - entries[e].name_offset)
+      return cache.corrupt();
+  // The directories are written in the order of inode_to_directory, so their inode numbers are strictly increasing.
+  std::set<std::string> unique_paths;
+  uint32_t previous_inode = 0;
+  for (size_t i = 0; i < number_of_directories; ++i)
+  {
+    Stage2Directory const& stage2_directory(directories[i]);
+    if (stage2_directory.inode <= previous_inode || stage2_directory.inode > inode_count_ ||
+        stage2_directory.path_offset > paths_size || stage2_directory.path_length > paths_size - stage2_directory.path_offset ||
+	stage2_directory.first_block > number_of_blocks || stage2_directory.number_of_blocks > number_of_blocks - stage2_directory.first_block ||
+	!unique_paths.insert(std::string(paths + stage2_directory.path_offset, stage2_directory.path_length)).second)
+      return cache.corrupt();
+    previous_inode = stage2_directory.inode;
+  }
+  return true;
+}
+
+// Load the result of stage 2 from a binary cache file that passed stage2_binary_is_valid.
+static void load_stage2_binary(CacheFileReader const& cache)
+{
+  size_t number_of_directories, paths_size, number_of_blocks, number_of_first_entry, number_of_entries, names_size;
+  Stage2Directory const* directories = cache.section<Stage2Directory>(0, number_of_directories);
+  char const* paths = cache.section<char>(1, paths_size);
+  uint32_t const* blocks = cache.section<uint32_t>(2, number_of_blocks);
+  uint32_t const* first_entry = cache.section<uint32_t>(3, number_of_first_entry);
+  Stage2DirEntry const* entries = cache.section<Stage2DirEntry>(4, number_of_entries);
+  char const* names = cache.section<char>(5, names_size);
+  for (size_t i = 0; i < number_of_directories; ++i)
+  {
+    Stage2Directory const& stage2_directory(directories[i]);
+    uint32_t const inode = stage2_directory.inode;
+    std::pair<all_directories_type::iterator, bool> res = all_directories.insert(all_directories_type::value_type(
+        std::string(paths + stage2_directory.path_offset, stage2_directory.path_length), Directory(inode)));
+    ASSERT(res.second);
+    std::pair<inode_to_directory_type::iterator, bool> res2 = inode_to_directory.insert(inode_to_directory_type::value_type(inode, res.first));
+    ASSERT(res2.second);
+    dir_inode_to_block_cache[inode].assign(blocks + stage2_directory.first_block, stage2_directory.number_of_blocks);
+    std::list<DirectoryBlock>& directory_blocks(res.first->second.blocks());
+    directory_blocks.resize(stage2_directory.number_of_blocks);
+    std::list<DirectoryBlock>::iterator directory_block_iter = directory_blocks.begin();
+    for (uint32_t b = stage2_directory.first_block; directory_block_iter != directory_blocks.end(); ++b, ++directory_block_iter)
+    {
+      directory_block_iter->set_block(blocks[b]);
+      std::vector<DirEntry>& dir_entries(directory_block_iter->dir_entries());
+      dir_entries.resize(first_entry[b + 1] - first_entry[b]);
+      for (uint32_t e = first_entry[b]; e < first_entry[b + 1]; ++e)
+      {
+	Stage2DirEntry const& entry(entries[e]);
+	DirEntry& dir_entry(dir_entries[e - first_entry[b]]);
+	dir_entry.M_directory_iterator = directory_block_iter;
+	dir_entry.M_directory = NULL;
+	dir_entry.M_file_type = entry.file_type;
+	dir_entry.M_inode = entry.inode;
+	dir_entry.M_name.assign(names + entry.name_offset, entry.name_len);
+	dir_entry.index.cur = e - first_entry[b];
+	dir_entry.index.next = entry.next;
+	dir_entry.linked = entry.linked;
+	dir_entry.calculate_flags();
+      }
+    }
+    if ((i + 1) % 100 == 0)
+      std::cout << '.' << std::flush;
+  }
+}
+
 void init_directories(void)
 {
   static bool initialized = false;
@@ -366,13 +636,19 @@ void init_directories(void)
 
   DoutEntering(dc::notice, "init_directories()");
 
-  std::string device_name_basename = device_name.substr(device_name.find_last_of('/') + 1);
-  std::string cache_stage2 = device_name_basename + ".ext3grep.stage2";
+  IOStage io_stage(io_stage_stage2);
+
+  std::string cache_stage2 = cache_filename("stage2");
+  CacheFileReader binary_cache;
   struct stat sb;
   bool have_cache = !(stat(cache_stage2.c_str(), &sb) == -1);
+  bool is_binary = false;
   if (have_cache)
   {
-    if (does_not_end_on_END(cache_stage2))
+    is_binary = is_binary_cache_file(cache_stage2);
+    if (is_binary)
+      have_cache = binary_cache.open(cache_stage2, "stage2") && stage2_binary_is_valid(binary_cache);
+    else if (does_not_end_on_END(cache_stage2))
       have_cache = false;
   }
   else if (errno != ENOENT)
@@ -568,104 +844,21 @@ void init_directories(void)
     std::cout << '\n';
 
     std::cout << "Writing analysis so far to '" << cache_stage2 << "'. Delete that file if you want to do this stage again.\n";
-    std::ofstream cache;
-    cache.open(cache_stage2.c_str());
-    cache << "# Stage 2 data for " << device_name << ".\n";
-    cache << "# Inodes path and directory blocks.\n";
-    cache << "# INODE PATH BLOCK [BLOCK ...]\n";
-
-    for (inode_to_directory_type::iterator iter = inode_to_directory.begin(); iter != inode_to_directory.end(); ++iter)
-    {
-      cache << iter->first << " '" << iter->second->first << "'";
-      Directory& directory(iter->second->second);
-      if (directory.inode_number() != iter->first)
-      {
-        std::cerr << "ERROR: inode_to_directory entry with inode number " << iter->first <<
-	    " points to a Directory with inode number " << directory.inode_number() << " (path \"" << iter->second->first << "\")." << std::endl; 
-      }
-      ASSERT(directory.inode_number() == iter->first);
-      for (std::list<DirectoryBlock>::iterator iter2 = directory.blocks().begin(); iter2 != directory.blocks().end(); ++iter2)
-        cache << ' ' << iter2->block();
-      cache << '\n';
-    }
-
-    cache << "# END\n";
-    cache.close();
+    if (commandline_cache_format == cache_format_binary)
+      write_stage2_binary(cache_stage2);
+    else
+      write_stage2_text(cache_stage2);
   }
   else
   {
     std::cout << "Loading " << cache_stage2 << "..." << std::flush;
-    std::ifstream cache;
-    cache.open(cache_stage2.c_str());
-    if (!cache.is_open())
-    {
-      int error = errno;
-      std::cout << " error" << std::endl;
-      std::cerr << progname << ": failed to open " << cache_stage2 << ": " << strerror(error) << std::endl;
-      exit(EXIT_FAILURE);
-    }
-    int inode;
-    int blocknr;
-    char c;
-    // Skip initial comments.
-    for(;;)
-    {
-      cache.get(c);
-      if (c == '#')
-        cache.ignore(std::numeric_limits<int>::max(), '\n');
-      else
-      {
-        cache.putback(c);
-        break;
-      }
-    }
     ASSERT(!dir_inode_to_block_cache);
     dir_inode_to_block_cache = new blocknr_vector_type [inode_count_ + 1];
     std::memset(dir_inode_to_block_cache, 0, sizeof(blocknr_vector_type) * (inode_count_ + 1));
-    std::stringstream buf;
-    int count = 0;
-    while (cache >> inode)
-    {
-      cache.get(c);
-      ASSERT(c == ' ');
-      cache.get(c);
-      ASSERT(c == '\'');
-      buf.clear();
-      buf.str("");
-      cache.get(*buf.rdbuf(), '\n');
-      if (inode == EXT3_ROOT_INO)	// If the function extracts no elements, it calls setstate(failbit).
-	cache.clear();
-      cache.get(c);	// Extraction stops on end-of-file or on an element that compares equal to delim (which is not extracted).
-      ASSERT(c == '\n');
-      std::string::size_type pos = buf.str().find_last_of('\'');
-      ASSERT(pos != std::string::npos);
-      std::pair<all_directories_type::iterator, bool> res = all_directories.insert(all_directories_type::value_type(buf.str().substr(0, pos), Directory(inode)));
-      ASSERT(res.second);
-      std::pair<inode_to_directory_type::iterator, bool> res2 = inode_to_directory.insert(inode_to_directory_type::value_type(inode, res.first));
-      ASSERT(res2.second);
-      buf.seekg(pos + 1);
-      std::vector<uint32_t> block_numbers;
-      while(buf >> blocknr)
-      {
-        block_numbers.push_back(blocknr);
-	c = buf.get();
-	if (c != ' ')
-	{
-	  ASSERT(buf.eof());
-	  break;
-	}
-      }
-      dir_inode_to_block_cache[inode] = block_numbers;
-      std::list<DirectoryBlock>& blocks(res.first->second.blocks());
-      blocks.resize(block_numbers.size());
-      std::list<DirectoryBlock>::iterator directory_block_iter = blocks.begin();
-      for (std::vector<uint32_t>::iterator block_number_iter = block_numbers.begin();
-          block_number_iter != block_numbers.end(); ++block_number_iter, ++directory_block_iter)
-	directory_block_iter->read_block(*block_number_iter, directory_block_iter);
-      if (++count % 100 == 0)
-        std::cout << '.' << std::flush;
-    }
-    cache.close();
+    if (is_binary)
+      load_stage2_binary(binary_cache);
+    else
+      load_stage2_text(cache_stage2);
     std::cout << " done\n";
   }
 }
@@ -104,18 +104,15 @@ void init_files(void)
         continue;
       // Find related journal information.
       JournalData journal_data(0);
-      block_to_descriptors_map_type::iterator iter = block_to_descriptors_map.find(directory_block.block());
-      if (iter != block_to_descriptors_map.end())
+      descriptor_index_iterator begin, end;
+      block_to_descriptors(directory_block.block(), begin, end);
+      for (descriptor_index_iterator descriptor_iter = end; descriptor_iter != begin;)
       {
-        std::vector<Descriptor*>& descriptors(iter->second);
-	for (std::vector<Descriptor*>::reverse_iterator descriptor_iter = descriptors.rbegin(); descriptor_iter != descriptors.rend(); ++descriptor_iter)
-	{
-	  Descriptor& descriptor(**descriptor_iter);
-	  if (!journal_data.last_tag_sequence && descriptor.descriptor_type() == dt_tag)
-	    journal_data.last_tag_sequence = descriptor.sequence();
-	  if (journal_data.last_tag_sequence)
-	    break;
-	}
+	Descriptor descriptor(*--descriptor_iter);
+	if (!journal_data.last_tag_sequence && descriptor.descriptor_type() == dt_tag)
+	  journal_data.last_tag_sequence = descriptor.sequence();
+	if (journal_data.last_tag_sequence)
+	  break;
       }
       journal_data_map.insert(journal_data_map_type::value_type(directory_block.block(), journal_data));
     }
@@ -127,8 +124,8 @@ void init_files(void)
       if (!is_in_journal(directory_block.block()))
         continue;
       ASSERT(is_journal(directory_block.block()));
-      block_in_journal_to_descriptors_map_type::iterator descriptors_iter = block_in_journal_to_descriptors_map.find(directory_block.block());
-      if (descriptors_iter == block_in_journal_to_descriptors_map.end())
+      Descriptor descriptor;
+      if (!block_in_journal_to_descriptor(directory_block.block(), descriptor))
       {
 	std::cout << std::flush;
 	std::cerr << "WARNING: Disregarding directory block " << directory_block.block() << " from the journal, "
@@ -137,7 +134,6 @@ void init_files(void)
 	    " We're disregarding it because ext3grep can't deal with journal blocks without a descriptor block." << std::endl;
         continue;
       }
-      Descriptor& descriptor(*descriptors_iter->second);
       ASSERT(descriptor.descriptor_type() == dt_tag);
       //DescriptorTag& descriptor_tag(static_cast<DescriptorTag&>(descriptor));
       //journal_data_map_type::iterator iter = journal_data_map.find(descriptor_tag.block());
@@ -25,7 +25,13 @@
 #include "sys.h"
 #include "debug.h"
 #include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <cerrno>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
 #include "ext3.h"
 #endif
 
@@ -33,8 +39,98 @@
 #include "globals.h"
 #include "conversion.h"
 #include "inode.h"
+#include "journal_overlay.h"
+#include "commandline.h"
 
 #if USE_MMAP
+//-----------------------------------------------------------------------------
+//
+// Mapping of inode tables
+//
+// The inode tables are mapped on demand by get_inode. The mapped groups
+// are kept in a list in order of use, most recently used first, and when
+// the address space used by the mappings would exceed --mmap-budget the
+// least recently used inode tables that aren't referenced by an
+// InodePointer are unmapped.
+//
+// When the groups are mapped in increasing order (a scan over all inodes),
+// the kernel is told to read ahead aggressively (MADV_SEQUENTIAL) and the
+// inode table of the next group is prefetched (POSIX_FADV_WILLNEED), so
+// that it is read while the current group is being processed.
+
+int inode_mmap_mru_group = -1;
+
+// The doubly linked LRU list of mapped groups.
+static std::vector<int> lru_prev;	// The next more recently used group, or -1.
+static std::vector<int> lru_next;	// The next less recently used group, or -1.
+static int lru_head = -1;		// The most recently used group.
+static int lru_tail = -1;		// The least recently used group.
+
+static size_t inode_mmap_bytes;		// The current size of all mappings.
+static int inode_mmap_last_mapped = -1;	// The group that was mapped last.
+
+struct InodeMmapStats {
+  uint64_t maps;
+  uint64_t unmaps;
+  uint64_t evictions;			// Unmaps because of --mmap-budget.
+  uint64_t prefetches;
+  size_t peak_bytes;
+};
+
+static InodeMmapStats inode_mmap_stats;
+
+// The size of the address space that we may use for inode tables.
+static size_t inode_mmap_budget(void)
+{
+  if (commandline_mmap_budget > 0)
+    return (size_t)commandline_mmap_budget * 1024 * 1024;
+  // One inode table is roughly 4 MB: 32768 inodes times 128 bytes.
+  // If we want to maximally use 1 GB of address space for those,
+  // we should map at most 1024/4 = 256 inode tables.
+  // On 64-bit machines, this can be infinitely higher.
+  return (sizeof(void*) == 4) ? (size_t)1024 * 1024 * 1024 : std::numeric_limits<size_t>::max();
+}
+
+static void lru_unlink(int group)
+{
+  if (lru_prev[group] == -1)
+    lru_head = lru_next[group];
+  else
+    lru_next[lru_prev[group]] = lru_next[group];
+  if (lru_next[group] == -1)
+    lru_tail = lru_prev[group];
+  else
+    lru_prev[lru_next[group]] = lru_prev[group];
+}
+
+static void lru_push_front(int group)
+{
+  lru_prev[group] = -1;
+  lru_next[group] = lru_head;
+  if (lru_head != -1)
+    lru_prev[lru_head] = group;
+  lru_head = group;
+  if (lru_tail == -1)
+    lru_tail = group;
+  inode_mmap_mru_group = group;
+}
+
+void inode_mmap_touch(int group)
+{
+  ASSERT(all_inodes[group]);
+  lru_unlink(group);
+  lru_push_front(group);
+}
+
+// The offset of the inode table of group in the mapping (the mapping starts at a page boundary).
+static off_t inode_table_page_offset(int group)
+{
+  int block_number = group_descriptor_table[group].bg_inode_table;
+  int const blocks_per_page = page_size_ / block_size_;
+  off_t page = block_number / blocks_per_page;
+  return block_to_offset(block_number) - page * page_size_;
+}
+
 void inode_unmap(int group)
 {
   if (all_inodes[group])
@@ -43,18 +139,17 @@ void inode_unmap(int group)
 
     ASSERT(refs_to_mmap[group] == 0 && nr_mmaps > 0);
     --nr_mmaps;
-    munmap(all_mmaps[group], inodes_per_group_ * inode_size_ + ((char*)all_inodes[group] - (char*)all_mmaps[group]));
+    size_t length = inodes_per_group_ * inode_size_ + inode_table_page_offset(group);
+    munmap(all_mmaps[group], length);
     all_inodes[group] = NULL;
+    inode_mmap_bytes -= length;
+    lru_unlink(group);
+    if (inode_mmap_mru_group == group)
+      inode_mmap_mru_group = -1;
+    ++inode_mmap_stats.unmaps;
   }
 }
 
-// Maximum number of simultaneously mmapped inode tables.
-// One inode table is roughly 4 MB: 32768 inodes times 128 bytes.
-// If we want to maximally use 1 GB of address space for those,
-// we should map at most 1024/4 = 256 inode tables.
-// On 64-bit machines, this can be infinitely higher.
-int const max_mmaps = (sizeof(void*) == 4) ? 256 : std::numeric_limits<int>::max();
-
 void inode_mmap(int group)
 {
   if (all_inodes[group])
@@ -62,30 +157,34 @@ void inode_mmap(int group)
 
   DoutEntering(dc::notice, "inode_mmap(" << group << ")");
 
-  if (nr_mmaps >= max_mmaps)
+  if (lru_prev.empty())
   {
-    // FIXME: This can be done more intelligent I guess.
-    // For now, just munmap all inode tables that are not in use.
-    for (int grp = 0; grp < groups_; ++grp)
-    {
-      if (!all_inodes[grp])		// Not mapped at all?
-        continue;
-      if (refs_to_mmap[grp] > 0)	// Referenced?
-        continue;
-      inode_unmap(grp);
-      if (nr_mmaps == 0)
-        break;
-    }
+    lru_prev.resize(groups_, -1);
+    lru_next.resize(groups_, -1);
   }
 
   int block_number = group_descriptor_table[group].bg_inode_table;
-  int const blocks_per_page = page_size_ / block_size_;
-  off_t page = block_number / blocks_per_page;
-  off_t page_aligned_offset = page * page_size_;
   off_t offset = block_to_offset(block_number);
+  off_t page_offset = inode_table_page_offset(group);
+  off_t page_aligned_offset = offset - page_offset;
+  size_t const length = inodes_per_group_ * inode_size_ + page_offset;
 
-  all_mmaps[group] = mmap(NULL, inodes_per_group_ * inode_size_ + (offset - page_aligned_offset),
-      PROT_READ, MAP_PRIVATE | MAP_NORESERVE, device_fd, page_aligned_offset);
+  // Unmap the least recently used inode tables that are not in use until the new one fits in the budget.
+  size_t const budget = inode_mmap_budget();
+  for (int victim = lru_tail; victim != -1 && inode_mmap_bytes + length > budget;)
+  {
+    int more_recent = lru_prev[victim];
+    if (refs_to_mmap[victim] == 0)
+    {
+      inode_unmap(victim);
+      ++inode_mmap_stats.evictions;
+    }
+    victim = more_recent;
+  }
+
+  // The mapping is private: when the journal overlay is active the blocks that have a copy in the journal are overwritten (copy-on-write).
+  all_mmaps[group] = mmap(NULL, length,
+      journal_overlay_active ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE | MAP_NORESERVE, device_fd, page_aligned_offset);
   if (all_mmaps[group] == MAP_FAILED)
   {
     int error = errno;
@@ -95,9 +194,39 @@ void inode_mmap(int group)
     ASSERT(all_mmaps[group] != MAP_FAILED);
   }
 
-  all_inodes[group] = reinterpret_cast<Inode const*>((char*)all_mmaps[group] + (offset - page_aligned_offset));
+  all_inodes[group] = reinterpret_cast<Inode const*>((char*)all_mmaps[group] + page_offset);
+  if (journal_overlay_active)
+  {
+    unsigned char* inode_table = (unsigned char*)all_mmaps[group] + page_offset;
+    journal_overlay_apply(block_number, inodes_per_group_ * inode_size_ / block_size_, inode_table);
+    mprotect(all_mmaps[group], length, PROT_READ);
+  }
   ASSERT(refs_to_mmap[group] == 0);
   ++nr_mmaps;
+  inode_mmap_bytes += length;
+  lru_push_front(group);
+  ++inode_mmap_stats.maps;
+  inode_mmap_stats.peak_bytes = std::max(inode_mmap_stats.peak_bytes, inode_mmap_bytes);
+
+  // Read ahead when the inode tables are being mapped in increasing order.
+  if (group == inode_mmap_last_mapped + 1)
+  {
+    madvise(all_mmaps[group], length, MADV_SEQUENTIAL);
+    if (group + 1 < groups_ && !all_inodes[group + 1])
+    {
+      posix_fadvise(device_fd, block_to_offset(group_descriptor_table[group + 1].bg_inode_table),
+          inodes_per_group_ * inode_size_, POSIX_FADV_WILLNEED);
+      ++inode_mmap_stats.prefetches;
+    }
+  }
+  inode_mmap_last_mapped = group;
+}
+
+void print_inode_mmap_stats(void)
+{
+  std::cout << "Inode table mappings: " << inode_mmap_stats.maps << " maps, " << inode_mmap_stats.unmaps << " unmaps (" <<
+      inode_mmap_stats.evictions << " because of the budget), " << inode_mmap_stats.prefetches << " prefetches, peak " <<
+      (inode_mmap_stats.peak_bytes + 512 * 1024) / (1024 * 1024) << " MiB mapped.\n";
 }
 #endif
 
@@ -35,6 +35,9 @@
 #if USE_MMAP
 void inode_mmap(int group);
 void inode_unmap(int group);
+void inode_mmap_touch(int group);
+void print_inode_mmap_stats(void);
+extern int inode_mmap_mru_group;	// The group of the last get_inode, or -1.
 #endif
 
 class InodePointer {
@@ -121,6 +124,8 @@ inline InodePointer get_inode(uint32_t inode)
 #if USE_MMAP
   if (all_inodes[group] == NULL)
     inode_mmap(group);
+  else if (group != inode_mmap_mru_group)
+    inode_mmap_touch(group);		// Move group to the front of the LRU list.
 #else
   if (block_bitmap[group] == NULL)
     load_meta_data(group);
@@ -0,0 +1,298 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file inode_index.cc Implementation of the inode index.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <sys/stat.h>
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "ext3.h"
+#include "debug.h"
+#endif
+
+#include "inode_index.h"
+#include "inode_scan.h"
+#include "cache_file.h"
+#include "commandline.h"
+#include "forward_declarations.h"
+#include "globals.h"
+#include "bitmap.h"
+#include "block_cache.h"
+
+//-----------------------------------------------------------------------------
+//
+// The inode index
+//
+// A histogram only needs a few fields of each inode, but computing one
+// means reading all inode tables. The index stores those fields of all
+// inodes in columns, so that every histogram, for any field and any
+// --after/--before range, can be computed from memory.
+//
+// Inodes without any time stamp can't contribute to any histogram and
+// are left out, which keeps the index small. The index is stored in the
+// cache file <device>.ext3grep.inodes with the following sections:
+//
+// Section 0: the inode numbers, in increasing order (uint32_t).
+// Section 1 - 4: atime, ctime, mtime and dtime (uint32_t).
+// Section 5: mode (uint16_t).
+// Section 6: links_count (uint16_t).
+// Section 7: size (uint64_t).
+// Section 8: the inode_index_flags of each inode (uint8_t).
+
+enum inode_index_flags {
+  inode_index_allocated = 1,		// The inode is allocated in the inode bitmap.
+  inode_index_deleted = 2,		// Inode::is_deleted().
+  inode_index_valid_dtime = 4		// Inode::has_valid_dtime().
+};
+
+struct InodeIndexColumns {
+  std::vector<uint32_t> inode;
+  std::vector<uint32_t> atime;
+  std::vector<uint32_t> ctime;
+  std::vector<uint32_t> mtime;
+  std::vector<uint32_t> dtime;
+  std::vector<uint16_t> mode;
+  std::vector<uint16_t> links_count;
+  std::vector<uint64_t> size;
+  std::vector<uint8_t> flags;
+
+  void append(InodeIndexColumns const& columns);
+  void clear(void);
+};
+
+void InodeIndexColumns::append(InodeIndexColumns const& columns)
+{
+  inode.insert(inode.end(), columns.inode.begin(), columns.inode.end());
+  atime.insert(atime.end(), columns.atime.begin(), columns.atime.end());
+  ctime.insert(ctime.end(), columns.ctime.begin(), columns.ctime.end());
+  mtime.insert(mtime.end(), columns.mtime.begin(), columns.mtime.end());
+  dtime.insert(dtime.end(), columns.dtime.begin(), columns.dtime.end());
+  mode.insert(mode.end(), columns.mode.begin(), columns.mode.end());
+  links_count.insert(links_count.end(), columns.links_count.begin(), columns.links_count.end());
+  size.insert(size.end(), columns.size.begin(), columns.size.end());
+  flags.insert(flags.end(), columns.flags.begin(), columns.flags.end());
+}
+
+void InodeIndexColumns::clear(void)
+{
+  std::vector<uint32_t>().swap(inode);
+  std::vector<uint32_t>().swap(atime);
+  std::vector<uint32_t>().swap(ctime);
+  std::vector<uint32_t>().swap(mtime);
+  std::vector<uint32_t>().swap(dtime);
+  std::vector<uint16_t>().swap(mode);
+  std::vector<uint16_t>().swap(links_count);
+  std::vector<uint64_t>().swap(size);
+  std::vector<uint8_t>().swap(flags);
+}
+
+static CacheFileReader inode_index_cache;
+static InodeIndexColumns inode_index_columns;
+
+// The columns, pointing into inode_index_columns or into inode_index_cache.
+static size_t inode_index_size;
+static uint32_t const* index_inode;
+static uint32_t const* index_atime;
+static uint32_t const* index_ctime;
+static uint32_t const* index_mtime;
+static uint32_t const* index_dtime;
+static uint16_t const* index_mode;
+static uint8_t const* index_flags;
+
+// Add the inodes of a group that have a time stamp to the columns of that group. Called from a worker thread.
+static void inode_index_process_group(int group, unsigned char const* inode_table, int, void* data)
+{
+  InodeIndexColumns& columns((*static_cast<std::vector<InodeIndexColumns>*>(data))[group]);
+  for (int bit = 0; bit < inodes_per_group_; ++bit)
+  {
+    Inode const& inode(inode_table_entry(inode_table, bit));
+    if (!inode.atime() && !inode.ctime() && !inode.mtime() && !inode.dtime())
+      continue;
+    bitmap_ptr bmp = get_bitmap_mask(bit);
+    uint8_t flags = 0;
+    if ((inode_bitmap[group][bmp.index] & bmp.mask))
+      flags |= inode_index_allocated;
+    if (inode.is_deleted())
+      flags |= inode_index_deleted;
+    if (inode.has_valid_dtime())
+      flags |= inode_index_valid_dtime;
+    columns.inode.push_back(group * inodes_per_group_ + bit + 1);
+    columns.atime.push_back(inode.atime());
+    columns.ctime.push_back(inode.ctime());
+    columns.mtime.push_back(inode.mtime());
+    columns.dtime.push_back(inode.dtime());
+    columns.mode.push_back(inode.mode());
+    columns.links_count.push_back(inode.links_count());
+    columns.size.push_back(inode.size());
+    columns.flags.push_back(flags);
+  }
+}
+
+// Append the columns of a group to inode_index_columns, in group order.
+static void inode_index_commit_group(int group, void* data)
+{
+  InodeIndexColumns& columns((*static_cast<std::vector<InodeIndexColumns>*>(data))[group]);
+  inode_index_columns.append(columns);
+  columns.clear();
+  std::cout << '.' << std::flush;
+}
+
+// Return true if all columns of inode_index_cache have the same length and the inode numbers are
+// increasing (inode_index_histogram does a binary search on them). Otherwise the index must be built again.
+static bool inode_index_cache_is_valid(void)
+{
+  if (!inode_index_cache.has_sections(9))
+    return inode_index_cache.corrupt();
+  size_t size, count;
+  uint32_t const* inodes = inode_index_cache.section<uint32_t>(0, size);
+  inode_index_cache.section<uint32_t>(1, count);
+  bool valid = count == size;
+  inode_index_cache.section<uint32_t>(2, count);
+  valid = valid && count == size;
+  inode_index_cache.section<uint32_t>(3, count);
+  valid = valid && count == size;
+  inode_index_cache.section<uint32_t>(4, count);
+  valid = valid && count == size;
+  inode_index_cache.section<uint16_t>(5, count);
+  valid = valid && count == size;
+  inode_index_cache.section<uint16_t>(6, count);
+  valid = valid && count == size;
+  inode_index_cache.section<uint64_t>(7, count);
+  valid = valid && count == size;
+  inode_index_cache.section<uint8_t>(8, count);
+  valid = valid && count == size;
+  if (!valid)
+    return inode_index_cache.corrupt();
+  for (size_t i = 0; i < size; ++i)
+    if (inodes[i] == 0 || inodes[i] > inode_count_ || (i > 0 && inodes[i] <= inodes[i - 1]))
+      return inode_index_cache.corrupt();
+  return true;
+}
+
+void init_inode_index(void)
+{
+  static bool initialized = false;
+  if (initialized)
+    return;
+  initialized = true;
+
+  IOStage io_stage(io_stage_metadata);
+  std::string cache_inodes = cache_filename("inodes");
+  struct stat sb;
+  bool have_cache = !(stat(cache_inodes.c_str(), &sb) == -1);
+  if (have_cache)
+    have_cache = inode_index_cache.open(cache_inodes, "inodes") && inode_index_cache_is_valid();
+  else if (errno != ENOENT)
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to open \"" << cache_inodes << "\": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (have_cache)
+  {
+    std::cout << "Loading " << cache_inodes << "...\n";
+    size_t count;
+    index_inode = inode_index_cache.section<uint32_t>(0, inode_index_size);
+    index_atime = inode_index_cache.section<uint32_t>(1, count);
+    index_ctime = inode_index_cache.section<uint32_t>(2, count);
+    index_mtime = inode_index_cache.section<uint32_t>(3, count);
+    index_dtime = inode_index_cache.section<uint32_t>(4, count);
+    index_mode = inode_index_cache.section<uint16_t>(5, count);
+    index_flags = inode_index_cache.section<uint8_t>(8, count);
+    return;
+  }
+  std::cout << "Building inode index" << std::flush;
+  std::vector<InodeIndexColumns> groups(groups_);
+  scan_inode_tables(0, groups_, inode_index_process_group, inode_index_commit_group, &groups);
+  std::cout << " done\n";
+  std::cout << "Writing index to '" << cache_inodes << "'. Delete that file if you want to build it again.\n";
+  InodeIndexColumns& columns(inode_index_columns);
+  CacheFileWriter cache(cache_inodes, "inodes");
+  add_vector_section(cache, columns.inode);
+  add_vector_section(cache, columns.atime);
+  add_vector_section(cache, columns.ctime);
+  add_vector_section(cache, columns.mtime);
+  add_vector_section(cache, columns.dtime);
+  add_vector_section(cache, columns.mode);
+  add_vector_section(cache, columns.links_count);
+  add_vector_section(cache, columns.size);
+  add_vector_section(cache, columns.flags);
+  cache.commit();
+  inode_index_size = columns.inode.size();
+  if (inode_index_size > 0)
+  {
+    index_inode = &columns.inode[0];
+    index_atime = &columns.atime[0];
+    index_ctime = &columns.ctime[0];
+    index_mtime = &columns.mtime[0];
+    index_dtime = &columns.dtime[0];
+    index_mode = &columns.mode[0];
+    index_flags = &columns.flags[0];
+  }
+}
+
+void inode_index_histogram(hist_type type, std::vector<int>& counts)
+{
+  init_inode_index();
+  ASSERT(counts.size() == (size_t)histsize);
+  // Restrict the range of inodes to --group, if given.
+  size_t begin = 0;
+  size_t end = inode_index_size;
+  if (commandline_group != -1)
+  {
+    begin = std::lower_bound(index_inode, index_inode + inode_index_size, (uint32_t)commandline_group * inodes_per_group_ + 1) - index_inode;
+    end = std::lower_bound(index_inode, index_inode + inode_index_size, (uint32_t)(commandline_group + 1) * inodes_per_group_ + 1) - index_inode;
+  }
+  uint32_t const* time_column =
+      (type == hist_atime) ? index_atime : (type == hist_ctime) ? index_ctime : (type == hist_mtime) ? index_mtime : index_dtime;
+  for (size_t i = begin; i < end; ++i)
+  {
+    uint8_t flags = index_flags[i];
+    if (commandline_deleted && !(flags & inode_index_deleted))
+      continue;
+    if ((type == hist_dtime || type == hist_group) && !(flags & inode_index_valid_dtime))
+      continue;
+    if (commandline_directory && (index_mode[i] & 0xf000) != 0x4000)
+      continue;
+    if (commandline_allocated && !(flags & inode_index_allocated))
+      continue;
+    if (commandline_unallocated && (flags & inode_index_allocated))
+      continue;
+    time_t xtime = time_column[i];
+    if (type == hist_group)
+    {
+      if (commandline_after && commandline_after > xtime)
+	continue;
+      if (commandline_before && xtime >= commandline_before)
+	continue;
+      ++counts[hist_bucket((index_inode[i] - 1) / inodes_per_group_)];
+    }
+    else if (xtime && commandline_after <= xtime && xtime < commandline_before)
+      ++counts[hist_bucket(xtime)];
+  }
+}
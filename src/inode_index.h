@@ -0,0 +1,44 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file inode_index.h Declaration of the inode index.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INODE_INDEX_H
+#define INODE_INDEX_H
+
+#ifndef USE_PCH
+#include <vector>
+#endif
+
+#include "histogram.h"
+
+// Build the index of the time stamps, mode, link count, size and state of
+// every inode that has a time stamp, or load it from the cache file
+// <device>.ext3grep.inodes when that exists.
+void init_inode_index(void);
+
+// Add the inodes that pass the filters (--group, --deleted, --directory,
+// --allocated, --unallocated, --after and --before) to counts, which has
+// histsize elements, for the histogram of 'type'. hist_init must have been
+// called for that type.
+void inode_index_histogram(hist_type type, std::vector<int>& counts);
+
+#endif // INODE_INDEX_H
@@ -0,0 +1,73 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file inode_scan.cc Implementation of function scan_inode_tables.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <vector>
+#include "debug.h"
+#endif
+
+#include "inode_scan.h"
+#include "scan_groups.h"
+#include "get_block.h"
+#include "load_meta_data.h"
+
+struct InodeScan {
+  void (*process)(int group, unsigned char const* inode_table, int thread, void* data);
+  void (*commit)(int group, void* data);
+  void* data;
+  std::vector<std::vector<unsigned char> > buffers;	// The inode table buffer of each worker thread.
+};
+
+// Read the inode table of group and pass it to the process function of the scan. Called from a worker thread.
+static void inode_scan_process_group(int group, int thread, void* data)
+{
+  InodeScan& scan(*static_cast<InodeScan*>(data));
+  std::vector<unsigned char>& buffer(scan.buffers[thread]);
+  if (buffer.empty())
+    buffer.resize((size_t)inodes_per_group_ * inode_size_);
+  int const blocks = (size_t)inodes_per_group_ * inode_size_ / block_size_;
+  get_blocks(group_descriptor_table[group].bg_inode_table, blocks, &buffer[0]);
+  scan.process(group, &buffer[0], thread, scan.data);
+}
+
+// Pass group to the commit function of the scan. Called in group order.
+static void inode_scan_commit_group(int group, void* data)
+{
+  InodeScan& scan(*static_cast<InodeScan*>(data));
+  scan.commit(group, scan.data);
+}
+
+void scan_inode_tables(int first_group, int end_group,
+    void (*process)(int group, unsigned char const* inode_table, int thread, void* data),
+    void (*commit)(int group, void* data), void* data)
+{
+  // load_meta_data isn't thread-safe.
+  load_meta_data(first_group, end_group);
+  InodeScan scan;
+  scan.process = process;
+  scan.commit = commit;
+  scan.data = data;
+  scan.buffers.resize(scan_groups_threads());
+  scan_groups(first_group, end_group, inode_scan_process_group, commit ? inode_scan_commit_group : NULL, &scan);
+}
@@ -0,0 +1,50 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file inode_scan.h Declaration of function scan_inode_tables.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INODE_SCAN_H
+#define INODE_SCAN_H
+
+#ifndef USE_PCH
+#include "ext3.h"	// Needed for Inode
+#endif
+
+#include "globals.h"
+
+// Call process(group, inode_table, thread, data) for every group in the range [first_group, end_group)
+// from the worker threads of scan_groups (see scan_groups.h), where inode_table is the whole inode
+// table of the group, read with a single get_blocks into a buffer of the worker thread.
+// Use inode_table_entry to access the inodes in it.
+//
+// commit(group, data) is called in increasing group order from the calling thread, and may be NULL.
+// The bitmaps of the groups are loaded before the scan starts.
+void scan_inode_tables(int first_group, int end_group,
+    void (*process)(int group, unsigned char const* inode_table, int thread, void* data),
+    void (*commit)(int group, void* data), void* data);
+
+// Return the inode with index 'bit' in inode_table.
+inline Inode const& inode_table_entry(unsigned char const* inode_table, int bit)
+{
+  return *reinterpret_cast<Inode const*>(inode_table + bit * inode_size_);
+}
+
+#endif // INODE_SCAN_H
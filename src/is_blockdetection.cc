@@ -24,6 +24,7 @@
 #ifndef USE_PCH
 #include "sys.h"
 #include <sstream>
+#include <pthread.h>
 #include "debug.h"
 #endif
 
@@ -119,170 +120,298 @@ void print_buf_to(std::ostream& os, char const* buf, int len)
   }
 }
 
+// Protects accepted_filenames against concurrent access by is_directory from worker threads.
+static pthread_mutex_t accepted_filenames_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Add accept to accepted_filenames and print a warning, unless it was already added.
+static void reject_filename(Accept const& accept, int blocknr, bool certainly_linked)
+{
+  pthread_mutex_lock(&accepted_filenames_mutex);
+  // Add this entry to avoid us printing this again.
+  bool inserted = accepted_filenames.insert(accept).second;
+  pthread_mutex_unlock(&accepted_filenames_mutex);
+  if (!inserted)
+    return;
+  std::cout << std::flush;
+  if (certainly_linked)
+    std::cerr << "\nWARNING: Rejecting possible directory (block " << blocknr << ") because an entry contains legal but unlikely characters.\n";
+  else // Aparently we're looking for deleted entries.
+    std::cerr << "\nWARNING: Rejecting a dir_entry (block " << blocknr << ") because it contains legal but unlikely characters.\n";
+  std::cerr     << "         Use --ls --block " << blocknr << " to examine this possible directory block.\n";
+  std::cerr     << "         If it looks like a directory to you, and '" << accept.filename() << "'\n";
+  std::cerr     << "         looks like a filename that might belong in that directory, then add\n";
+  std::cerr     << "         --accept='" << accept.filename() << "' as commandline parameter AND remove both stage* files!" << std::endl;
+}
+
+void DeferredWarnings::add_text(std::string const& text)
+{
+  Warning warning;
+  warning.rejection = false;
+  warning.text = text;
+  M_warnings.push_back(warning);
+}
+
+void DeferredWarnings::add_rejection(std::string const& escaped_name, int blocknr, bool certainly_linked)
+{
+  Warning warning;
+  warning.rejection = true;
+  warning.text = escaped_name;
+  warning.blocknr = blocknr;
+  warning.certainly_linked = certainly_linked;
+  M_warnings.push_back(warning);
+}
+
+void DeferredWarnings::print(size_t begin, size_t end) const
+{
+  for (size_t i = begin; i < end; ++i)
+  {
+    Warning const& warning(M_warnings[i]);
+    if (warning.rejection)
+      reject_filename(Accept(warning.text, false), warning.blocknr, warning.certainly_linked);
+    else
+    {
+      std::cout << std::flush;
+      std::cerr << warning.text;
+      std::cerr << std::flush;
+    }
+  }
+}
+
 // Return true if this block looks like it contains a directory.
-is_directory_type is_directory(unsigned char* block, int blocknr, DirectoryBlockStats& stats, bool start_block, bool certainly_linked, int offset)
+// Return false if the directory entry at the start of block can't be valid.
+// This rejects most blocks that are not directory blocks (zeroes, text, random data)
+// before is_directory looks at them entry by entry: it only tests conditions that
+// is_directory tests too, combined without branches.
+bool may_be_directory_block(unsigned char const* block)
+{
+  ext3_dir_entry_2 const* dir_entry = reinterpret_cast<ext3_dir_entry_2 const*>(block);
+  unsigned int const rec_len = dir_entry->rec_len;
+  unsigned int const name_len = dir_entry->name_len;
+  return !((rec_len & EXT3_DIR_ROUND) |
+           (name_len == 0) |
+           (rec_len < EXT3_DIR_REC_LEN(name_len)) |
+           (rec_len > (unsigned int)block_size_) |
+           (dir_entry->inode > inode_count_));
+}
+
+// Return true if the filename of the entry contains unlikely characters, but none that are illegal, and has been rejected.
+// This prints (or defers) a warning the first time such a filename is rejected.
+static bool reject_unlikely_filename(ext3_dir_entry_2 const* dir_entry, int blocknr, DirectoryBlockStats& stats, bool certainly_linked)
+{
+  std::ostringstream escaped_name;
+  print_buf_to(escaped_name, dir_entry->name, dir_entry->name_len);
+  Accept const accept(escaped_name.str(), false);
+  pthread_mutex_lock(&accepted_filenames_mutex);
+  std::set<Accept>::iterator accept_iter = accepted_filenames.find(accept);
+  bool found = accept_iter != accepted_filenames.end();
+  bool accepted = found && accept_iter->accepted();
+  pthread_mutex_unlock(&accepted_filenames_mutex);
+  if (!found)
+  {
+    if (stats.deferred_warnings())
+      stats.deferred_warnings()->add_rejection(escaped_name.str(), blocknr, certainly_linked);
+    else
+      reject_filename(accept, blocknr, certainly_linked);
+  }
+  return !accepted;
+}
+
+// Print (or defer) a warning about a directory entry with a zero inode and a sensible filename.
+static void warn_zero_inode(ext3_dir_entry_2 const* dir_entry, int blocknr, int offset, DirectoryBlockStats& stats)
+{
+  bool non_ascii = false;
+  for (int c = 0; c < dir_entry->name_len; ++c)
+    if (is_filename_char(dir_entry->name[c]) == fnct_non_ascii)
+      non_ascii = true;
+  DelayedWarning delayed_warning;
+  delayed_warning.stream() << "WARNING: zero inode (name: ";
+  if (non_ascii)
+    delayed_warning.stream() << "*contains non-ASCII characters* ";
+  delayed_warning.stream() << "\"";
+  print_buf_to(delayed_warning.stream(), dir_entry->name, dir_entry->name_len);
+  delayed_warning.stream() << "\"; block: " << blocknr << "; offset 0x" << std::hex << offset << std::dec << ")\n";
+  if (stats.deferred_warnings())
+    stats.deferred_warnings()->add_text(delayed_warning.str());
+  else
+  {
+    std::cout << std::flush;
+    std::cerr << delayed_warning.str();
+    std::cerr << std::flush;
+  }
+}
+
+// Return true if the directory entry at offset passes the checks of its structure: everything that
+// is_directory checks, except for the filename (when the inode isn't zero) and the "." and ".." entries.
+static bool is_valid_dir_entry(unsigned char const* block, int offset)
 {
-  ASSERT(!start_block || offset == 0);
   // Must be aligned to 4 bytes.
   if ((offset & EXT3_DIR_ROUND))
-    return isdir_no;
+    return false;
   // A minimal ext3_dir_entry_2 must fit.
   if (offset + EXT3_DIR_REC_LEN(1) > block_size_)
-    return isdir_no;
-  ext3_dir_entry_2* dir_entry = reinterpret_cast<ext3_dir_entry_2*>(block + offset);
-  // The first block has the "." and ".." directories at the start.
-  bool is_start = false;
-  if (offset == 0)
-  {
-    ext3_dir_entry_2* parent_dir_entry = reinterpret_cast<ext3_dir_entry_2*>(block + EXT3_DIR_REC_LEN(1));
-    is_start = (dir_entry->name_len == 1 &&
-                dir_entry->name[0] == '.' &&
-		dir_entry->rec_len == EXT3_DIR_REC_LEN(1) &&
-		(!feature_incompat_filetype || dir_entry->file_type == EXT3_FT_DIR) &&
-		parent_dir_entry->name_len == 2 &&
-		parent_dir_entry->name[0] == '.' &&
-		parent_dir_entry->name[1] == '.' &&
-		(!feature_incompat_filetype || parent_dir_entry->file_type == EXT3_FT_DIR));
-  }      
-  if (start_block)
-  {
-    // If a start block is requested, return isdir_no when it is NOT isdir_start,
-    // even though it might still really be isdir_extended, in order to speed
-    // up the test.
-    if (!is_start)
-      return isdir_no;
-  }
+    return false;
+  ext3_dir_entry_2 const* dir_entry = reinterpret_cast<ext3_dir_entry_2 const*>(block + offset);
   // The inode is not overwritten when a directory is deleted (except
   // for the first inode of an extended directory block).
   // So even for deleted directories we can check the inode range.
-  DelayedWarning delayed_warning;
-  if (dir_entry->inode == 0 && dir_entry->name_len > 0)
-  {
-    // If the inode is zero and the filename makes no sense, reject the directory.
-    bool non_ascii = false;
+  // If the inode is zero and the filename makes no sense, reject the directory.
+  if (dir_entry->inode == 0)
     for (int c = 0; c < dir_entry->name_len; ++c)
-    {
-      filename_char_type result = is_filename_char(dir_entry->name[c]);
-      if (result == fnct_illegal)
-	return isdir_no;
-      if (result == fnct_non_ascii)
-	non_ascii = true;
-    }
-    // If the inode is zero, but the filename makes sense, print a warning
-    // only when the inode really wasn't expected to be zero. Do not reject
-    // the directory though.
-    if (certainly_linked && (offset != 0 || start_block) &&
-        (blocknr != 4745500 && blocknr != 6546132 && blocknr != 6549681 && blocknr != 6550057 && blocknr != 6582345 && blocknr != 6582333 && blocknr != 6583272))
-    {
-      delayed_warning.stream() << "WARNING: zero inode (name: ";
-      if (non_ascii)
-        delayed_warning.stream() << "*contains non-ASCII characters* ";
-      delayed_warning.stream() << "\"";
-      print_buf_to(delayed_warning.stream(), dir_entry->name, dir_entry->name_len);
-      delayed_warning.stream() << "\"; block: " << blocknr << "; offset 0x" << std::hex << offset << std::dec << ")\n";
-    }
-  }
+      if (is_filename_char(dir_entry->name[c]) == fnct_illegal)
+	return false;
   if (dir_entry->inode > inode_count_)
-    return isdir_no;	// Inode out of range.
+    return false;	// Inode out of range.
   // File names are at least 1 character long.
   if (dir_entry->name_len == 0)
-    return isdir_no;
+    return false;
   // The record length must make sense.
   if ((dir_entry->rec_len & EXT3_DIR_ROUND) ||
       dir_entry->rec_len < EXT3_DIR_REC_LEN(dir_entry->name_len) ||
       offset + dir_entry->rec_len > block_size_)
-    return isdir_no;
+    return false;
   // Add some extra paranoia in the case that the whole block appears to exist of a single direntry (for an extended block).
   if (dir_entry->rec_len == block_size_ &&
       ((feature_incompat_filetype && dir_entry->file_type == EXT3_FT_UNKNOWN) ||
        dir_entry->file_type >= EXT3_FT_MAX ||
        dir_entry->name_len == 1 ||
        (dir_entry->name[0] == '_' && dir_entry->name[1] == 'Z')))	// Symbol table entry?
-    return isdir_no;
-  // The record length must point to the end of the block or chain to it.
-  offset += dir_entry->rec_len;
-  // NOT USED; int previous_number_of_entries = stats.number_of_entries();
-  if (offset != block_size_ && is_directory(block, blocknr, stats, false, certainly_linked, offset) == isdir_no)
-    return isdir_no;
+    return false;
+  return true;
+}
+
+// Return true if the filename of the directory entry at offset is acceptable, printing (or deferring) the
+// warnings of is_directory about it. is_valid_dir_entry must have returned true for this entry.
+static bool accept_filename(unsigned char const* block, int blocknr, int offset, DirectoryBlockStats& stats, bool start_block, bool certainly_linked)
+{
+  ext3_dir_entry_2 const* dir_entry = reinterpret_cast<ext3_dir_entry_2 const*>(block + offset);
   // The file name may only exist of certain characters.
-  bool illegal = false;
-  bool ok = true;
   int number_of_weird_characters = 0;
   for (int c = 0; c < dir_entry->name_len; ++c)
   {
     filename_char_type fnct = is_filename_char(dir_entry->name[c]);
+    if (fnct == fnct_illegal)
+      return false;
     if (fnct != fnct_ok)
-    {
-      if (fnct == fnct_illegal)
-      {
-        ok = false;
-        illegal = true;
-	break;
-      }
       ++number_of_weird_characters;
-      stats.increment_unlikely_character_count(dir_entry->name[c]);
-    }
   }
   // If the user asks for a specific block, don't suppress anything.
   if (commandline_block != -1)
     number_of_weird_characters = 0;
-#if 1
   // Accept everything at this point, except filenames existing of a single unlikely character.
   // If --accept-all is given, accept even those.
-  if (!commandline_accept_all && dir_entry->name_len == 1 && number_of_weird_characters > 0)
-    ok = false;
-#else
-  // Setting ok to false means we reject this entry. Also setting illegal will reject it silently.
-  // The larger the number of previous entries, the larger the chance that this is really a good dir entry.
-  // Therefore, accept weird characters to a certain extend.
-  if (number_of_weird_characters > previous_number_of_entries || number_of_weird_characters > dir_entry->name_len / 2)
-    ok = false;
-  // If a filenames exists of exclusively weird characters (most notably filenames of length 1), don't believe this can be a real entry.
-  if (!illegal && number_of_weird_characters == dir_entry->name_len)
+  bool ok = !(!commandline_accept_all && dir_entry->name_len == 1 && number_of_weird_characters > 0);
+  if (!ok && stats.classify())
   {
-    if (dir_entry->name_len > 1)
+    // Classifying blocks for the block type map: the result may not depend on --accept
+    // or on previous rejections, so accept the entry, but count it.
+    stats.increment_number_of_unlikely_entries();
+    ok = true;
+  }
+  // If the inode is zero, but the filename makes sense, print a warning
+  // only when the inode really wasn't expected to be zero. Do not reject
+  // the directory though.
+  if (ok && dir_entry->inode == 0 && certainly_linked && (offset != 0 || start_block) &&
+      (blocknr != 4745500 && blocknr != 6546132 && blocknr != 6549681 && blocknr != 6550057 && blocknr != 6582345 && blocknr != 6582333 && blocknr != 6583272))
+    warn_zero_inode(dir_entry, blocknr, offset, stats);
+  if (!ok && reject_unlikely_filename(dir_entry, blocknr, stats, certainly_linked))
+    return false;
+  stats.increment_number_of_entries();
+  return true;
+}
+
+// Return isdir_start or isdir_extended if the chain of directory entries from offset to the end of the block
+// looks like a directory, or isdir_no when it doesn't. If start_block is set, only accept a directory start block.
+//
+// First the structure of all entries is checked, following the rec_len chain to the end of the block.
+// Only then the filenames are checked, from the last entry back to the first: a rejected filename
+// rejects the whole block and the entries before it are not looked at anymore.
+is_directory_type is_directory(unsigned char* block, int blocknr, DirectoryBlockStats& stats, bool start_block, bool certainly_linked, int offset)
+{
+  ASSERT(!start_block || offset == 0);
+  // The first block has the "." and ".." directories at the start.
+  bool is_start = false;
+  if (offset == 0)
+  {
+    if (!may_be_directory_block(block))
+      return isdir_no;
+    ext3_dir_entry_2* dir_entry = reinterpret_cast<ext3_dir_entry_2*>(block);
+    ext3_dir_entry_2* parent_dir_entry = reinterpret_cast<ext3_dir_entry_2*>(block + EXT3_DIR_REC_LEN(1));
+    is_start = (dir_entry->name_len == 1 &&
+		dir_entry->name[0] == '.' &&
+		dir_entry->rec_len == EXT3_DIR_REC_LEN(1) &&
+		(!feature_incompat_filetype || dir_entry->file_type == EXT3_FT_DIR) &&
+		parent_dir_entry->name_len == 2 &&
+		parent_dir_entry->name[0] == '.' &&
+		parent_dir_entry->name[1] == '.' &&
+		(!feature_incompat_filetype || parent_dir_entry->file_type == EXT3_FT_DIR));
+    // If a start block is requested, return isdir_no when it is NOT isdir_start,
+    // even though it might still really be isdir_extended, in order to speed
+    // up the test.
+    if (start_block && !is_start)
+      return isdir_no;
+  }
+  // The offsets of the entries in the chain.
+  int entry_offset[EXT3_MAX_BLOCK_SIZE / EXT3_DIR_REC_LEN(1) + 1];
+  int number_of_entries = 0;
+  do
+  {
+    if (!is_valid_dir_entry(block, offset))
+      return isdir_no;
+    entry_offset[number_of_entries++] = offset;
+    // The record length must point to the end of the block or chain to it.
+    offset += reinterpret_cast<ext3_dir_entry_2*>(block + offset)->rec_len;
+  }
+  while (offset != block_size_);
+  // Check the filenames, starting with the last entry.
+  while (number_of_entries > 0)
+    if (!accept_filename(block, blocknr, entry_offset[--number_of_entries], stats, start_block, certainly_linked))
+      return isdir_no;
+  return is_start ? isdir_start : isdir_extended;
+}
+
+DirectoryChains::DirectoryChains(unsigned char const* block, int blocknr) : M_block(block), M_blocknr(blocknr)
+{
+  // The chain of an entry continues at a higher offset, so a single sweep from the end of the block
+  // to the start finds all offsets from which the structure of the chain is valid.
+  for (int offset = block_size_ - EXT3_DIR_PAD; offset >= 0; offset -= EXT3_DIR_PAD)
+  {
+    chain_state state = chain_invalid;
+    if (is_valid_dir_entry(block, offset))
     {
-      // But you never know, so let the user know about it.
-      std::cout << "Note: Rejecting '";
-      print_buf_to(std::cout, dir_entry->name, dir_entry->name_len);
-      std::cout << "' as possibly legal filename.\n";
+      int next = offset + reinterpret_cast<ext3_dir_entry_2 const*>(block + offset)->rec_len;
+      if (next == block_size_ || M_state[next / EXT3_DIR_PAD] != chain_invalid)
+	state = chain_unknown;
     }
-    illegal = true;
-    ok = false;
+    M_state[offset / EXT3_DIR_PAD] = state;
   }
-#endif
-  if (ok && delayed_warning)
+}
+
+bool DirectoryChains::is_directory(int offset)
+{
+  if ((offset & EXT3_DIR_ROUND) || M_state[offset / EXT3_DIR_PAD] == chain_invalid)
+    return false;
+  // Find the entries of the chain of which the filenames weren't checked yet.
+  int entry_offset[EXT3_MAX_BLOCK_SIZE / EXT3_DIR_REC_LEN(1) + 1];
+  int number_of_entries = 0;
+  while (offset != block_size_ && M_state[offset / EXT3_DIR_PAD] == chain_unknown)
   {
-    std::cout << std::flush;
-    std::cerr << delayed_warning.str();
-    std::cerr << std::flush;
+    entry_offset[number_of_entries++] = offset;
+    offset += reinterpret_cast<ext3_dir_entry_2 const*>(M_block + offset)->rec_len;
   }
-  if (!ok && !illegal)
+  bool result = offset == block_size_ || M_state[offset / EXT3_DIR_PAD] == chain_valid;
+  // Check them starting with the last entry, like is_directory does. Once a filename is rejected,
+  // the chains of all entries before it are rejected too.
+  while (number_of_entries > 0)
   {
-    std::ostringstream escaped_name;
-    print_buf_to(escaped_name, dir_entry->name, dir_entry->name_len);
-    Accept const accept(escaped_name.str(), false);
-    std::set<Accept>::iterator accept_iter = accepted_filenames.find(accept);
-    if (accept_iter != accepted_filenames.end())
-      ok = accept_iter->accepted();
-    else
+    offset = entry_offset[--number_of_entries];
+    if (result)
     {
-      // Add this entry to avoid us printing this again.
-      accepted_filenames.insert(accept);
-      std::cout << std::flush;
-      if (certainly_linked)
-	std::cerr << "\nWARNING: Rejecting possible directory (block " << blocknr << ") because an entry contains legal but unlikely characters.\n";
-      else // Aparently we're looking for deleted entries.
-	std::cerr << "\nWARNING: Rejecting a dir_entry (block " << blocknr << ") because it contains legal but unlikely characters.\n";
-      std::cerr     << "         Use --ls --block " << blocknr << " to examine this possible directory block.\n";
-      std::cerr     << "         If it looks like a directory to you, and '" << escaped_name.str() << "'\n";
-      std::cerr     << "         looks like a filename that might belong in that directory, then add\n";
-      std::cerr     << "         --accept='" << escaped_name.str() << "' as commandline parameter AND remove both stage* files!" << std::endl;
+      DirectoryBlockStats stats;
+      result = accept_filename(M_block, M_blocknr, offset, stats, false, false);
     }
+    M_state[offset / EXT3_DIR_PAD] = result ? chain_valid : chain_rejected;
   }
-  if (ok)
-    stats.increment_number_of_entries();
-  return ok ? (is_start ? isdir_start : isdir_extended) : isdir_no;
+  return result;
 }
 
 // Returns true if the block is inside an inode table,
@@ -27,6 +27,8 @@
 #ifndef USE_PCH
 #include <stdint.h>	// Needed for uint32_t
 #include <iosfwd>	// Needed for std::ostream
+#include <string>	// Needed for std::string
+#include <vector>	// Needed for std::vector
 #endif
 
 #include "inode.h"	// Needed for InodePointer
@@ -38,16 +40,75 @@ enum is_directory_type {
   isdir_extended        // Block is a directory not containing "." and "..".
 };
 
+// Warnings of is_directory that are not printed immediately.
+// Used when is_directory is called from a worker thread (see scan_groups): the warnings
+// are then printed by the main thread, in the same order as a serial run would print them.
+class DeferredWarnings {
+  private:
+    struct Warning {
+      bool rejection;		// Set if this is the warning about a rejected filename.
+      std::string text;		// The warning, or the escaped filename if rejection is set.
+      int blocknr;		// Only used if rejection is set.
+      bool certainly_linked;	// Idem.
+    };
+    std::vector<Warning> M_warnings;
+
+  public:
+    // The number of warnings added so far.
+    size_t size(void) const { return M_warnings.size(); }
+
+    // Add a warning that is printed as-is.
+    void add_text(std::string const& text);
+    // Add a rejected filename: it is added to accepted_filenames when printed, but only printed if it wasn't there yet.
+    void add_rejection(std::string const& escaped_name, int blocknr, bool certainly_linked);
+
+    // Print warnings [begin, end). Must be called from the main thread.
+    void print(size_t begin, size_t end) const;
+    void clear(void) { M_warnings.clear(); }
+};
+
 class DirectoryBlockStats {
   private:
     int M_number_of_entries;			// Number of entries in chain to the end.
-    __u8 M_unlikely_character_count[256];	// Character count of filenames.
+    DeferredWarnings* M_deferred_warnings;	// If non-NULL, is_directory adds its warnings to this object instead of printing them.
+    bool M_classify;				// If true, is_directory accepts entries with unlikely characters regardless of --accept.
+    int M_number_of_unlikely_entries;		// Number of such entries, when M_classify is set.
   public:
-    DirectoryBlockStats(void) { std::memset(this, 0, sizeof(DirectoryBlockStats)); }
+    DirectoryBlockStats(void) : M_number_of_entries(0), M_deferred_warnings(NULL), M_classify(false), M_number_of_unlikely_entries(0) { }
 
     int number_of_entries(void) const { return M_number_of_entries; }
     void increment_number_of_entries(void) { ++M_number_of_entries; }
-    void increment_unlikely_character_count(__u8 c) { ++M_unlikely_character_count[c]; }
+
+    DeferredWarnings* deferred_warnings(void) const { return M_deferred_warnings; }
+    void defer_warnings_to(DeferredWarnings* deferred_warnings) { M_deferred_warnings = deferred_warnings; }
+
+    bool classify(void) const { return M_classify; }
+    void set_classify(void) { M_classify = true; }
+    int number_of_unlikely_entries(void) const { return M_number_of_unlikely_entries; }
+    void increment_number_of_unlikely_entries(void) { ++M_number_of_unlikely_entries; }
+};
+
+// Finds the deleted directory entries of a block in linear time.
+//
+// is_directory(offset) returns the same as is_directory(block, blocknr, stats, false, false, offset) != isdir_no,
+// and prints the same warnings, provided that the block isn't changed. The structure of the chains from all
+// offsets is checked once, in the constructor. The filenames are checked when needed, and at most once.
+class DirectoryChains {
+  private:
+    enum chain_state {
+      chain_invalid,		// The structure of the chain is invalid.
+      chain_unknown,		// The structure of the chain is valid, the filenames weren't checked yet.
+      chain_valid,		// The chain is valid.
+      chain_rejected		// The structure of the chain is valid, but a filename was rejected.
+    };
+    unsigned char const* M_block;
+    int M_blocknr;
+    unsigned char M_state[EXT3_MAX_BLOCK_SIZE / EXT3_DIR_PAD];	// The chain_state for each offset / EXT3_DIR_PAD.
+
+  public:
+    DirectoryChains(unsigned char const* block, int blocknr);
+
+    bool is_directory(int offset);
 };
 
 // Return true if this inode is a directory.
@@ -104,5 +165,7 @@ bool is_inode(int block);
 bool is_allocated(int inode);
 int inode_to_block(ext3_super_block const& super_block, int inode);
 void print_buf_to(std::ostream& os, char const* buf, int len);
+// Cheap test that rejects most blocks that is_directory would reject (see is_blockdetection.cc).
+bool may_be_directory_block(unsigned char const* block);
 
 #endif // IS_BLOCKDETECTION_H
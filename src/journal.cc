@@ -24,7 +24,13 @@
 #ifndef USE_PCH
 #include "sys.h"
 #include <stdint.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include "ext3.h"
 #include "debug.h"
 #endif
@@ -36,16 +42,23 @@
 #include "superblock.h"
 #include "indirect_blocks.h"
 #include "get_block.h"
+#include "read_ahead.h"
+#include "cache_file.h"
+#include "block_cache.h"
 #include "commandline.h"
+#include "journal_overlay.h"
 
 //-----------------------------------------------------------------------------
 //
 // Journal
 //
 
-class Descriptor;
-static void add_block_descriptor(uint32_t block, Descriptor*);
-static void add_block_in_journal_descriptor(Descriptor* descriptor);
+static double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
 
 std::ostream& operator<<(std::ostream& os, descriptor_type_nt descriptor_type)
 {
@@ -67,95 +80,237 @@ std::ostream& operator<<(std::ostream& os, descriptor_type_nt descriptor_type)
   return os;
 }
 
-class DescriptorTag : public Descriptor {
+// class JournalDescriptors
+//
+// All descriptors of the journal, stored as a struct of arrays: descriptor 'index'
+// consists of M_block[index], M_sequence[index], M_type[index], M_data[index] and
+// M_flags[index]. The blocks revoked by all revoke descriptors are stored together
+// in M_revoked_blocks.
+//
+// The descriptors are appended in the order in which they are found in the journal
+// and then sorted once, on sequence number, by sort(). After that the index of a
+// descriptor (see class Descriptor) doesn't change anymore.
+
+class JournalDescriptors {
   private:
-    uint32_t M_blocknr;		// Block number on the file system.
-    uint32_t M_flags;
+    std::vector<uint32_t> M_block;		// Block number in the journal.
+    std::vector<uint32_t> M_sequence;
+    std::vector<unsigned char> M_type;		// A descriptor_type_nt.
+    std::vector<uint32_t> M_data;		// dt_tag: block number on the file system; dt_revoke: index into M_revoked_blocks.
+    std::vector<uint32_t> M_flags;		// dt_tag: the tag flags; dt_revoke: the number of revoked blocks.
+    std::vector<uint32_t> M_revoked_blocks;
+
   public:
-    DescriptorTag(uint32_t block, uint32_t sequence, journal_block_tag_t* block_tag) :
-        Descriptor(block, sequence), M_blocknr(be2le(block_tag->t_blocknr)), M_flags(be2le(block_tag->t_flags)) { }
-    virtual descriptor_type_nt descriptor_type(void) const { return dt_tag; }
-    virtual void print_blocks(void) const;
-    virtual void add_block_descriptors(void) { add_block_descriptor(M_blocknr, this); add_block_in_journal_descriptor(this); }
-    uint32_t block(void) const { return M_blocknr; }
+    void clear(void);
+    uint32_t size(void) const { return M_block.size(); }
+    void add_tag(uint32_t block, uint32_t sequence, journal_block_tag_t const* block_tag);
+    void add_revoke(uint32_t block, uint32_t sequence, journal_revoke_header_t const* revoke_header);
+    void add_commit(uint32_t block, uint32_t sequence) { add(block, sequence, dt_commit, 0, 0); }
+    void sort(void);
+    size_t memory_usage(void) const;
+
+    // The number of sections used by write and load.
+    static int const number_of_sections = 6;
+    // Append the descriptors to a stage0 cache file.
+    void write(CacheFileWriter& cache) const;
+    // Load the descriptors from a stage0 cache file, starting at section first_section.
+    // Returns false, leaving no descriptors, if the sections are inconsistent.
+    bool load(CacheFileReader const& cache, int first_section);
+
+    uint32_t block(uint32_t index) const { return M_block[index]; }
+    uint32_t sequence(uint32_t index) const { return M_sequence[index]; }
+    descriptor_type_nt type(uint32_t index) const { return static_cast<descriptor_type_nt>(M_type[index]); }
+    uint32_t tag_block(uint32_t index) const { return M_data[index]; }
+    uint32_t tag_flags(uint32_t index) const { return M_flags[index]; }
+    uint32_t number_of_revoked_blocks(uint32_t index) const { return M_flags[index]; }
+    uint32_t revoked_block(uint32_t index, uint32_t i) const { return M_revoked_blocks[M_data[index] + i]; }
+
+  private:
+    void add(uint32_t block, uint32_t sequence, descriptor_type_nt type, uint32_t data, uint32_t flags);
 };
 
-void DescriptorTag::print_blocks(void) const
+static JournalDescriptors journal_descriptors;
+
+void JournalDescriptors::clear(void)
 {
-  std::cout << ' ' << Descriptor::block() << '=' << M_blocknr;
-  if ((M_flags & (JFS_FLAG_ESCAPE|JFS_FLAG_DELETED)))
-  {
-    std::cout << '(';
-    uint32_t flags = M_flags;
-    if ((flags & JFS_FLAG_ESCAPE))
-    {
-      std::cout << "ESCAPED";
-      flags &= ~JFS_FLAG_ESCAPE;
-    }
-    if (flags)
-      std::cout << '|';
-    if ((flags & JFS_FLAG_DELETED))
-    {
-      std::cout << "DELETED";
-      flags &= ~JFS_FLAG_DELETED;
-    }
-    std::cout << ')';
-  }
+  M_block.clear();
+  M_sequence.clear();
+  M_type.clear();
+  M_data.clear();
+  M_flags.clear();
+  M_revoked_blocks.clear();
 }
 
-class DescriptorRevoke : public Descriptor {
-  private:
-    std::vector<uint32_t> M_blocks;
-  public:
-    DescriptorRevoke(uint32_t block, uint32_t sequence, journal_revoke_header_t* revoke_header);
-    virtual descriptor_type_nt descriptor_type(void) const { return dt_revoke; }
-    virtual void print_blocks(void) const;
-    virtual void add_block_descriptors(void);
-};
+void JournalDescriptors::add(uint32_t block, uint32_t sequence, descriptor_type_nt type, uint32_t data, uint32_t flags)
+{
+  M_block.push_back(block);
+  M_sequence.push_back(sequence);
+  M_type.push_back(type);
+  M_data.push_back(data);
+  M_flags.push_back(flags);
+}
 
-void DescriptorRevoke::add_block_descriptors(void)
+void JournalDescriptors::add_tag(uint32_t block, uint32_t sequence, journal_block_tag_t const* block_tag)
 {
-  for (std::vector<uint32_t>::iterator iter = M_blocks.begin(); iter != M_blocks.end(); ++iter)
-    add_block_descriptor(*iter, this);
-  add_block_in_journal_descriptor(this);
+  add(block, sequence, dt_tag, be2le(block_tag->t_blocknr), be2le(block_tag->t_flags));
 }
 
-DescriptorRevoke::DescriptorRevoke(uint32_t block, uint32_t sequence, journal_revoke_header_t* revoke_header) : Descriptor(block, sequence)
+void JournalDescriptors::add_revoke(uint32_t block, uint32_t sequence, journal_revoke_header_t const* revoke_header)
 {
   uint32_t count = be2le(revoke_header->r_count);
   ASSERT(sizeof(journal_revoke_header_t) <= count && count <= (size_t)block_size_);
   count -= sizeof(journal_revoke_header_t);
   ASSERT(count % sizeof(__be32) == 0);
   count /= sizeof(__be32);
-  __be32* ptr = reinterpret_cast<__be32*>((unsigned char*)revoke_header + sizeof(journal_revoke_header_t));
+  add(block, sequence, dt_revoke, M_revoked_blocks.size(), count);
+  __be32 const* ptr = reinterpret_cast<__be32 const*>((unsigned char const*)revoke_header + sizeof(journal_revoke_header_t));
   for (uint32_t b = 0; b < count; ++b)
-    M_blocks.push_back(be2le(ptr[b]));
+    M_revoked_blocks.push_back(be2le(ptr[b]));
 }
 
-void DescriptorRevoke::print_blocks(void) const
+struct DescriptorSequencePred {
+  std::vector<uint32_t> const& M_sequence;
+  DescriptorSequencePred(std::vector<uint32_t> const& sequence) : M_sequence(sequence) { }
+  bool operator()(uint32_t index1, uint32_t index2) const { return M_sequence[index1] < M_sequence[index2]; }
+};
+
+template<typename T>
+static void apply_order(std::vector<T>& column, std::vector<uint32_t> const& order)
 {
-  for (std::vector<uint32_t>::const_iterator iter = M_blocks.begin(); iter != M_blocks.end(); ++iter)
-    std::cout << ' ' << *iter;
+  std::vector<T> result(order.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    result[i] = column[order[i]];
+  column.swap(result);
 }
 
-class DescriptorCommit : public Descriptor {
-  public:
-    DescriptorCommit(uint32_t block, uint32_t sequence) : Descriptor(block, sequence) { }
-    virtual descriptor_type_nt descriptor_type(void) const { return dt_commit; }
-    virtual void print_blocks(void) const { }
-    virtual void add_block_descriptors(void) { add_block_in_journal_descriptor(this); };
-};
+void JournalDescriptors::sort(void)
+{
+  std::vector<uint32_t> order(size());
+  for (uint32_t index = 0; index < order.size(); ++index)
+    order[index] = index;
+  std::sort(order.begin(), order.end(), DescriptorSequencePred(M_sequence));
+  apply_order(M_block, order);
+  apply_order(M_sequence, order);
+  apply_order(M_type, order);
+  apply_order(M_data, order);
+  apply_order(M_flags, order);
+}
+
+size_t JournalDescriptors::memory_usage(void) const
+{
+  return (M_block.capacity() + M_sequence.capacity() + M_data.capacity() + M_flags.capacity() + M_revoked_blocks.capacity()) * sizeof(uint32_t) +
+      M_type.capacity();
+}
 
+void JournalDescriptors::write(CacheFileWriter& cache) const
+{
+  add_vector_section(cache, M_block);
+  add_vector_section(cache, M_sequence);
+  add_vector_section(cache, M_type);
+  add_vector_section(cache, M_data);
+  add_vector_section(cache, M_flags);
+  add_vector_section(cache, M_revoked_blocks);
+}
+
+bool JournalDescriptors::load(CacheFileReader const& cache, int first_section)
+{
+  load_vector_section(cache, first_section, M_block);
+  load_vector_section(cache, first_section + 1, M_sequence);
+  load_vector_section(cache, first_section + 2, M_type);
+  load_vector_section(cache, first_section + 3, M_data);
+  load_vector_section(cache, first_section + 4, M_flags);
+  load_vector_section(cache, first_section + 5, M_revoked_blocks);
+  bool valid = M_sequence.size() == size() && M_type.size() == size() && M_data.size() == size() && M_flags.size() == size();
+  for (uint32_t index = 0; valid && index < size(); ++index)
+  {
+    if (M_type[index] > dt_commit)
+      valid = false;
+    else if (M_type[index] == dt_revoke)
+      valid = M_data[index] <= M_revoked_blocks.size() && M_flags[index] <= M_revoked_blocks.size() - M_data[index];
+  }
+  if (!valid)
+    clear();
+  return valid;
+}
+
+uint32_t Descriptor::block(void) const
+{
+  return journal_descriptors.block(M_index);
+}
+
+uint32_t Descriptor::sequence(void) const
+{
+  return journal_descriptors.sequence(M_index);
+}
+
+descriptor_type_nt Descriptor::descriptor_type(void) const
+{
+  return journal_descriptors.type(M_index);
+}
+
+uint32_t Descriptor::tag_block(void) const
+{
+  ASSERT(descriptor_type() == dt_tag);
+  return journal_descriptors.tag_block(M_index);
+}
+
+void Descriptor::print_blocks(void) const
+{
+  switch (descriptor_type())
+  {
+    case dt_tag:
+    {
+      std::cout << ' ' << block() << '=' << tag_block();
+      uint32_t flags = journal_descriptors.tag_flags(M_index);
+      if ((flags & (JFS_FLAG_ESCAPE|JFS_FLAG_DELETED)))
+      {
+	std::cout << '(';
+	if ((flags & JFS_FLAG_ESCAPE))
+	{
+	  std::cout << "ESCAPED";
+	  flags &= ~JFS_FLAG_ESCAPE;
+	}
+	if (flags)
+	  std::cout << '|';
+	if ((flags & JFS_FLAG_DELETED))
+	{
+	  std::cout << "DELETED";
+	  flags &= ~JFS_FLAG_DELETED;
+	}
+	std::cout << ')';
+      }
+      break;
+    }
+    case dt_revoke:
+    {
+      uint32_t count = journal_descriptors.number_of_revoked_blocks(M_index);
+      for (uint32_t i = 0; i < count; ++i)
+	std::cout << ' ' << journal_descriptors.revoked_block(M_index, i);
+      break;
+    }
+    case dt_commit:
+    case dt_unknown:
+      break;
+  }
+}
+
+// The descriptors of a transaction are the tag and revoke descriptors in [M_first, M_end)
+// (the commit descriptors in that range have the same sequence number, but aren't part of it).
 class Transaction {
   private:
     int M_block;
     int M_sequence;
     bool M_committed;
-    std::vector<Descriptor*> M_descriptor;
+    uint32_t M_first;
+    uint32_t M_end;
   public:
-    void init(int block, int sequence) { M_block = block; M_sequence = sequence; M_committed = false; }
+    void init(int block, int sequence, uint32_t index) { M_block = block; M_sequence = sequence; M_committed = false; M_first = M_end = index; }
     void set_committed(void) { ASSERT(!M_committed); M_committed = true; }
-    void append(Descriptor* descriptor) { M_descriptor.push_back(descriptor); }
+    void append(uint32_t index) { ASSERT(index >= M_end); M_end = index + 1; }
+    void assign(int block, int sequence, bool committed, uint32_t first, uint32_t end)
+        { M_block = block; M_sequence = sequence; M_committed = committed; M_first = first; M_end = end; }
+    uint32_t first(void) const { return M_first; }
+    uint32_t end(void) const { return M_end; }
 
     void print_descriptors(void) const;
     int block(void) const { return M_block; }
@@ -166,14 +321,10 @@ class Transaction {
 
 bool Transaction::contains_tag_for_block(int block)
 {
-  for (std::vector<Descriptor*>::iterator iter = M_descriptor.begin(); iter != M_descriptor.end(); ++iter)
+  for (uint32_t index = M_first; index < M_end; ++index)
   {
-    if ((*iter)->descriptor_type() == dt_tag)
-    {
-      DescriptorTag& tag(*static_cast<DescriptorTag*>(*iter));
-      if (tag.block() == (uint32_t)block)
-        return true;
-    }
+    if (journal_descriptors.type(index) == dt_tag && journal_descriptors.tag_block(index) == (uint32_t)block)
+      return true;
   }
   return false;
 }
@@ -181,138 +332,207 @@ bool Transaction::contains_tag_for_block(int block)
 void Transaction::print_descriptors(void) const
 {
   descriptor_type_nt dt = dt_unknown;
-  for (std::vector<Descriptor*>::const_iterator iter = M_descriptor.begin(); iter != M_descriptor.end(); ++iter)
+  for (uint32_t index = M_first; index < M_end; ++index)
   {
-    if ((*iter)->descriptor_type() != dt)
+    Descriptor descriptor(index);
+    if (descriptor.descriptor_type() == dt_commit)
+      continue;
+    if (descriptor.descriptor_type() != dt)
     {
       if (dt != dt_unknown)
 	std::cout << '\n';
-      dt = (*iter)->descriptor_type();
+      dt = descriptor.descriptor_type();
       std::cout << dt << ':';
     }
-    (*iter)->print_blocks();
+    descriptor.print_blocks();
   }
   std::cout << '\n';
 }
 
-std::vector<Descriptor*> all_descriptors;
 typedef std::map<int, Transaction> sequence_transaction_map_type;
 sequence_transaction_map_type sequence_transaction_map;
-block_to_descriptors_map_type block_to_descriptors_map;
-block_in_journal_to_descriptors_map_type block_in_journal_to_descriptors_map;
 block_to_dir_inode_map_type block_to_dir_inode_map;
 
+// The index of the descriptors by the file system block that they reference: each tag
+// and every block revoked by a revoke descriptor. Sorted by block and then by descriptor index.
+static std::vector<uint32_t> block_index_block;
+static std::vector<uint32_t> block_index_descriptor;
+// The index of the tag and revoke descriptors by their block number in the journal, sorted by block.
+static std::vector<uint32_t> journal_block_index_block;
+static std::vector<uint32_t> journal_block_index_descriptor;
+
 static unsigned int number_of_descriptors;
 static uint32_t min_sequence;
 uint32_t max_sequence;
 
-static void add_block_descriptor(uint32_t block, Descriptor* descriptor)
+// Sort entries (pairs of block and descriptor index) and store them in block_column and descriptor_column.
+static void build_descriptor_index(std::vector<std::pair<uint32_t, uint32_t> >& entries,
+    std::vector<uint32_t>& block_column, std::vector<uint32_t>& descriptor_column)
 {
-  block_to_descriptors_map_type::iterator iter = block_to_descriptors_map.find(block);
-  if (iter == block_to_descriptors_map.end())
+  std::sort(entries.begin(), entries.end());
+  block_column.resize(entries.size());
+  descriptor_column.resize(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i)
   {
-    std::pair<block_to_descriptors_map_type::iterator, bool> res =
-        block_to_descriptors_map.insert(block_to_descriptors_map_type::value_type(block, std::vector<Descriptor*>()));
-    ASSERT(res.second);
-    res.first->second.push_back(descriptor);
+    block_column[i] = entries[i].first;
+    descriptor_column[i] = entries[i].second;
   }
-  else
-    iter->second.push_back(descriptor);
 }
 
-static void add_block_in_journal_descriptor(Descriptor* descriptor)
+void block_to_descriptors(uint32_t block, descriptor_index_iterator& begin, descriptor_index_iterator& end)
+{
+  std::vector<uint32_t> const& blocks(block_index_block);
+  std::vector<uint32_t>::const_iterator lower = std::lower_bound(blocks.begin(), blocks.end(), block);
+  std::vector<uint32_t>::const_iterator upper = std::upper_bound(lower, blocks.end(), block);
+  begin = block_index_descriptor.begin() + (lower - blocks.begin());
+  end = block_index_descriptor.begin() + (upper - blocks.begin());
+}
+
+bool block_in_journal_to_descriptor(uint32_t block, Descriptor& descriptor)
 {
-  std::pair<block_in_journal_to_descriptors_map_type::iterator, bool> res =
-      block_in_journal_to_descriptors_map.insert(block_in_journal_to_descriptors_map_type::value_type(descriptor->block(), descriptor));
-  ASSERT(res.second);
+  std::vector<uint32_t> const& blocks(journal_block_index_block);
+  std::vector<uint32_t>::const_iterator iter = std::lower_bound(blocks.begin(), blocks.end(), block);
+  if (iter == blocks.end() || *iter != block)
+    return false;
+  descriptor = Descriptor(journal_block_index_descriptor[iter - blocks.begin()]);
+  return true;
 }
 
 void print_block_descriptors(uint32_t block)
 {
-  block_to_descriptors_map_type::iterator iter = block_to_descriptors_map.find(block);
-  if (iter == block_to_descriptors_map.end())
+  descriptor_index_iterator begin, end;
+  block_to_descriptors(block, begin, end);
+  if (begin == end)
   {
     std::cout << "There are no descriptors in the journal referencing block " << block << ".\n";
     return;
   }
   std::cout << "Journal descriptors referencing block " << block << ":\n";
-  for (std::vector<Descriptor*>::iterator iter2 = iter->second.begin(); iter2 != iter->second.end(); ++iter2)
+  for (descriptor_index_iterator iter = begin; iter != end; ++iter)
   {
-    std::cout << (*iter2)->sequence() << ' ' << (*iter2)->block() << '\n';
+    Descriptor descriptor(*iter);
+    std::cout << descriptor.sequence() << ' ' << descriptor.block() << '\n';
   }
 }
 
 uint32_t find_largest_journal_sequence_number(int block)
 {
-  block_to_descriptors_map_type::iterator iter = block_to_descriptors_map.find(block);
-  if (iter == block_to_descriptors_map.end())
+  descriptor_index_iterator begin, end;
+  block_to_descriptors(block, begin, end);
+  if (begin == end)
     return 0;
-  return (*iter->second.rbegin())->sequence();
+  return Descriptor(end[-1]).sequence();
 }
 
-bool action_tag_count(uint32_t, uint32_t sequence, journal_block_tag_t*, void*)
+static void update_sequence_range(uint32_t sequence)
 {
   min_sequence = std::min(sequence, min_sequence);
   max_sequence = std::max(sequence, max_sequence);
-  ++number_of_descriptors;
-  return false;
 }
 
-bool action_revoke_count(uint32_t, uint32_t sequence, journal_revoke_header_t*, void*)
+bool action_tag_fill(uint32_t block, uint32_t sequence, journal_block_tag_t* block_tag, void*)
 {
-  min_sequence = std::min(sequence, min_sequence);
-  max_sequence = std::max(sequence, max_sequence);
-  ++number_of_descriptors;
+  update_sequence_range(sequence);
+  journal_descriptors.add_tag(block, sequence, block_tag);
   return false;
 }
 
-bool action_commit_count(uint32_t, uint32_t sequence, void*)
+bool action_revoke_fill(uint32_t block, uint32_t sequence, journal_revoke_header_t* revoke_header, void*)
 {
-  min_sequence = std::min(sequence, min_sequence);
-  max_sequence = std::max(sequence, max_sequence);
-  ++number_of_descriptors;
+  update_sequence_range(sequence);
+  journal_descriptors.add_revoke(block, sequence, revoke_header);
   return false;
 }
 
-void count_descriptors(void)
+bool action_commit_fill(uint32_t block, uint32_t sequence, void*)
 {
-  number_of_descriptors = 0;
-  min_sequence = 0xffffffff;
-  max_sequence = 0;
-  iterate_over_journal(action_tag_count, action_revoke_count, action_commit_count, NULL);
+  update_sequence_range(sequence);
+  journal_descriptors.add_commit(block, sequence);
+  return false;
 }
 
-bool action_tag_fill(uint32_t block, uint32_t sequence, journal_block_tag_t* block_tag, void* data)
+// The result of analysing a copy of an inode table block in the journal.
+struct JournalInodeCopy {
+  __le32 lasttime;					// The largest time stamp found in the block.
+  std::vector<std::pair<int, int> > directory_blocks;	// The blocks of the (not deleted) directory inodes in the block, and their inode number.
+  std::vector<int> corrupted_directories;		// Directory inodes with reused or corrupted (double/triple) indirect blocks.
+};
+
+typedef std::map<uint32_t, JournalInodeCopy> journal_inode_copies_type;	// Indexed by block number in the journal.
+
+struct CollectDirectoryBlocksData {
+  JournalInodeCopy* inode_copy;
+  int inode_number;
+};
+
+static void collect_directory_block_action(int blocknr, int, void* data)
 {
-  uint32_t& descriptor_count = *reinterpret_cast<uint32_t*>(data);
-  all_descriptors[descriptor_count++] = new DescriptorTag(block, sequence, block_tag);
-  return false;
+  CollectDirectoryBlocksData& collect_data(*reinterpret_cast<CollectDirectoryBlocksData*>(data));
+  collect_data.inode_copy->directory_blocks.push_back(std::pair<int, int>(blocknr, collect_data.inode_number));
 }
 
-bool action_revoke_fill(uint32_t block, uint32_t sequence, journal_revoke_header_t* revoke_header, void* data)
+#ifdef CPPGRAPH
+void iterate_over_all_blocks_of__with__collect_directory_block_action(void) { collect_directory_block_action(0, 0, NULL); }
+#endif
+
+// Analyse block_buf, a copy of inode table block block_nr.
+static void analyse_journal_inode_copy(uint32_t block_nr, unsigned char const* block_buf, JournalInodeCopy& inode_copy)
 {
-  uint32_t& descriptor_count = *reinterpret_cast<uint32_t*>(data);
-  all_descriptors[descriptor_count++] = new DescriptorRevoke(block, sequence, revoke_header);
-  return false;
+  Inode const* inode = reinterpret_cast<Inode const*>(block_buf);
+  CollectDirectoryBlocksData collect_data;
+  collect_data.inode_copy = &inode_copy;
+  collect_data.inode_number = block_to_inode(block_nr);
+  // Run over all inodes in the journal block.
+  __le32 lasttime = 0;
+  for (unsigned int i = 0; i < block_size_ / sizeof(Inode); i += inode_size_ / sizeof(Inode), ++collect_data.inode_number)
+  {
+    if (inode[i].atime() > lasttime || lasttime == 0)
+      lasttime = inode[i].atime(); 
+    if (inode[i].ctime() > lasttime)
+      lasttime = inode[i].ctime();
+    if (inode[i].mtime() > lasttime)
+      lasttime = inode[i].mtime();
+    if (inode[i].dtime() > lasttime)
+      lasttime = inode[i].dtime();
+
+    // Skip non-directories.
+    if (!is_directory(inode[i]))
+      continue;
+    // Skip deleted inodes.
+    if (inode[i].is_deleted())
+      continue;
+#ifdef CPPGRAPH
+    // Tell cppgraph that we call collect_directory_block_action from here.
+    iterate_over_all_blocks_of__with__collect_directory_block_action();
+#endif
+    // Run over all blocks of the directory inode.
+    bool reused_or_corrupted_indirect_block7 =
+        iterate_over_all_blocks_of(inode[i], collect_data.inode_number, collect_directory_block_action, &collect_data);
+    if (reused_or_corrupted_indirect_block7)
+      inode_copy.corrupted_directories.push_back(collect_data.inode_number);
+  }
+  inode_copy.lasttime = lasttime;
 }
 
-bool action_commit_fill(uint32_t block, uint32_t sequence, void* data)
+// Called by iterate_over_journal for the data block of each tag, while the journal is being read.
+bool action_tag_data_fill(uint32_t block, uint32_t block_nr, unsigned char const* block_buf, void* data)
 {
-  uint32_t& descriptor_count = *reinterpret_cast<uint32_t*>(data);
-  all_descriptors[descriptor_count++] = new DescriptorCommit(block, sequence);
+  // Invalid block numbers are reported by init_journal.
+  if (is_block_number(block_nr) && is_inode(block_nr))
+  {
+    journal_inode_copies_type& inode_copies(*reinterpret_cast<journal_inode_copies_type*>(data));
+    analyse_journal_inode_copy(block_nr, block_buf, inode_copies[block]);
+  }
   return false;
 }
 
-struct AllDescriptorsPred {
-  bool operator()(Descriptor* d1, Descriptor* d2) const { return d1->sequence() < d2->sequence(); }
-};
-
 static int smallest_block_nr;
 static int largest_block_nr;
 static bitmap_t* journal_block_bitmap = NULL;
 static int min_journal_block;
 static int max_journal_block;		// One more than largest block belonging to the journal.
 static bitmap_t* is_indirect_block_in_journal_bitmap = NULL;
+static uint32_t* journal_block_map = NULL;	// Journal block number to file system block number.
 
 void find_blocknr_range_action(int blocknr, int, void*)
 {
@@ -326,10 +546,13 @@ void find_blocknr_range_action(int blocknr, int, void*)
 void iterate_over_all_blocks_of__with__find_blocknr_range_action(void) { find_blocknr_range_action(0, 0, NULL); }
 #endif
 
-void fill_journal_bitmap_action(int blocknr, int, void*)
+void fill_journal_bitmap_action(int blocknr, int file_block_nr, void*)
 {
   bitmap_ptr bmp = get_bitmap_mask(blocknr - min_journal_block);
   journal_block_bitmap[bmp.index] |= bmp.mask;
+  // file_block_nr is -1 for indirect blocks.
+  if (file_block_nr >= 0 && file_block_nr < journal_maxlen_)
+    journal_block_map[file_block_nr] = blocknr;
 }
 
 #ifdef CPPGRAPH
@@ -360,10 +583,238 @@ void directory_inode_action(int blocknr, int, void* data)
 void iterate_over_all_blocks_of__with__directory_inode_action(void) { directory_inode_action(0, 0, NULL); }
 #endif
 
+// The number of bitmap_t in journal_block_bitmap and is_indirect_block_in_journal_bitmap.
+static int journal_bitmap_size(int min_block, int max_block)
+{
+  return (max_block - min_block + 8 * sizeof(bitmap_t) - 1) / (8 * sizeof(bitmap_t));
+}
+
+static int journal_bitmap_size(void)
+{
+  return journal_bitmap_size(min_journal_block, max_journal_block);
+}
+
+static void print_journal_summary(time_t oldtime)
+{
+  std::cout << "The oldest inode block that is still in the journal, appears to be from " << oldtime << " = " << std::ctime(&oldtime);
+  if (wrapped_journal_sequence)
+  {
+    static bool printed = false;
+    if (!printed)
+    {
+      printed = true;
+      std::cout << "Journal transaction " << wrapped_journal_sequence << " wraps around, some data blocks might have been lost of this transaction.\n";
+    }
+  }
+  std::cout << "Number of descriptors in journal: " << number_of_descriptors << "; min / max sequence numbers: " << min_sequence << " / " << max_sequence << '\n';
+}
+
+static void print_corrupted_directory_note(int journal_block, int inode_number)
+{
+  std::cout << "Note: Block " << journal_block << " in the journal contains a copy of inode " << inode_number <<
+      " which is a directory, but this directory has reused or corrupted (double/triple) indirect blocks.\n";
+}
+
+// Stage 0 is the parsing of the journal by init_journal.
+// Its result is stored in a binary cache file with the following sections:
+//
+// Section 0: Stage0Info.
+// Section 1: a copy of journal_super_block, to detect that the journal changed.
+// Section 2: journal_block_map (uint32_t).
+// Section 3: journal_block_bitmap (bitmap_t).
+// Section 4: is_indirect_block_in_journal_bitmap (bitmap_t).
+// Section 5 - 10: journal_descriptors (see JournalDescriptors::write).
+// Section 11 - 14: block_index_block, block_index_descriptor, journal_block_index_block and journal_block_index_descriptor (uint32_t).
+// Section 15: sequence_transaction_map (Stage0Transaction).
+// Section 16: block_to_dir_inode_map (pairs of block and inode number).
+// Section 17: directory inodes with reused or corrupted indirect blocks (pairs of journal block and inode number).
+
+struct Stage0Info {
+  int32_t min_journal_block;
+  int32_t max_journal_block;
+  uint32_t journal_maxlen;
+  uint32_t wrapped_journal_sequence;
+  uint32_t min_sequence;
+  uint32_t max_sequence;
+  int64_t oldtime;
+};
+
+struct Stage0Transaction {
+  int32_t block;
+  int32_t sequence;
+  uint32_t committed;
+  uint32_t first;
+  uint32_t end;
+};
+
+int const stage0_first_descriptor_section = 5;
+int const stage0_first_index_section = stage0_first_descriptor_section + JournalDescriptors::number_of_sections;
+
+static void write_stage0(std::string const& cache_stage0, time_t oldtime, std::vector<std::pair<int, int> > const& corrupted_directories)
+{
+  Stage0Info info;
+  std::memset(&info, 0, sizeof(info));
+  info.min_journal_block = min_journal_block;
+  info.max_journal_block = max_journal_block;
+  info.journal_maxlen = journal_maxlen_;
+  info.wrapped_journal_sequence = wrapped_journal_sequence;
+  info.min_sequence = min_sequence;
+  info.max_sequence = max_sequence;
+  info.oldtime = oldtime;
+  // The cache is an optimization only: if it can't be written, CacheFileWriter warns and we continue with what is in memory.
+  CacheFileWriter cache(cache_stage0, "stage0");
+  if (!cache.is_open())
+    return;
+  std::vector<Stage0Transaction> transactions;
+  transactions.reserve(sequence_transaction_map.size());
+  for (sequence_transaction_map_type::iterator iter = sequence_transaction_map.begin(); iter != sequence_transaction_map.end(); ++iter)
+  {
+    Stage0Transaction transaction;
+    transaction.block = iter->second.block();
+    transaction.sequence = iter->second.sequence();
+    transaction.committed = iter->second.committed();
+    transaction.first = iter->second.first();
+    transaction.end = iter->second.end();
+    transactions.push_back(transaction);
+  }
+  std::vector<std::pair<int, int> > dir_inodes(block_to_dir_inode_map.begin(), block_to_dir_inode_map.end());
+  int size = journal_bitmap_size();
+  cache.add_section(&info, sizeof(info));
+  cache.add_section(&journal_super_block, sizeof(journal_super_block));
+  cache.add_section(journal_block_map, journal_maxlen_ * sizeof(uint32_t));
+  cache.add_section(journal_block_bitmap, size * sizeof(bitmap_t));
+  cache.add_section(is_indirect_block_in_journal_bitmap, size * sizeof(bitmap_t));
+  journal_descriptors.write(cache);
+  add_vector_section(cache, block_index_block);
+  add_vector_section(cache, block_index_descriptor);
+  add_vector_section(cache, journal_block_index_block);
+  add_vector_section(cache, journal_block_index_descriptor);
+  add_vector_section(cache, transactions);
+  add_vector_section(cache, dir_inodes);
+  add_vector_section(cache, corrupted_directories);
+  cache.commit();
+}
+
+// Return true if block_column is sorted (without duplicates if unique) and every element of
+// descriptor_column, which must have the same size, is the index of a descriptor.
+static bool is_valid_descriptor_index(std::vector<uint32_t> const& block_column, std::vector<uint32_t> const& descriptor_column, bool unique)
+{
+  if (block_column.size() != descriptor_column.size())
+    return false;
+  for (size_t i = 0; i < block_column.size(); ++i)
+    if (descriptor_column[i] >= journal_descriptors.size() ||
+        (i > 0 && (block_column[i] < block_column[i - 1] || (unique && block_column[i] == block_column[i - 1]))))
+      return false;
+  return true;
+}
+
+// Load the result of stage 0 from cache_stage0, if it exists and belongs to the current journal.
+static bool load_stage0(std::string const& cache_stage0)
+{
+  struct stat sb;
+  if (stat(cache_stage0.c_str(), &sb) == -1)
+  {
+    if (errno != ENOENT)
+    {
+      int error = errno;
+      std::cout << std::flush;
+      std::cerr << progname << ": failed to open \"" << cache_stage0 << "\": " << strerror(error) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return false;
+  }
+  CacheFileReader cache;
+  if (!cache.open(cache_stage0, "stage0"))
+    return false;
+  if (!cache.has_sections(stage0_first_index_section + 7))
+    return cache.corrupt();
+  size_t count;
+  Stage0Info const* info = cache.section<Stage0Info>(0, count);
+  if (count != 1)
+    info = NULL;
+  journal_superblock_t const* cached_journal_super_block = cache.section<journal_superblock_t>(1, count);
+  if (!info || count != 1 || std::memcmp(cached_journal_super_block, &journal_super_block, sizeof(journal_super_block)) != 0 ||
+      info->journal_maxlen != (uint32_t)journal_maxlen_)
+  {
+    std::cout << "Ignoring \"" << cache_stage0 << "\": the journal has changed.\n";
+    return false;
+  }
+  // Check everything that is used as a size or an index before changing any global state.
+  if (info->min_journal_block < 0 || info->min_journal_block >= info->max_journal_block)
+    return cache.corrupt();
+  int size = journal_bitmap_size(info->min_journal_block, info->max_journal_block);
+  uint32_t const* block_map = cache.section<uint32_t>(2, count);
+  if (count != (size_t)journal_maxlen_)
+    return cache.corrupt();
+  bitmap_t const* block_bitmap = cache.section<bitmap_t>(3, count);
+  if (count != (size_t)size)
+    return cache.corrupt();
+  bitmap_t const* indirect_bitmap = cache.section<bitmap_t>(4, count);
+  if (count != (size_t)size)
+    return cache.corrupt();
+  size_t number_of_transactions;
+  Stage0Transaction const* transactions = cache.section<Stage0Transaction>(stage0_first_index_section + 4, number_of_transactions);
+  if (!journal_descriptors.load(cache, stage0_first_descriptor_section))
+    return cache.corrupt();
+  load_vector_section(cache, stage0_first_index_section, block_index_block);
+  load_vector_section(cache, stage0_first_index_section + 1, block_index_descriptor);
+  load_vector_section(cache, stage0_first_index_section + 2, journal_block_index_block);
+  load_vector_section(cache, stage0_first_index_section + 3, journal_block_index_descriptor);
+  bool valid = is_valid_descriptor_index(block_index_block, block_index_descriptor, false) &&
+               is_valid_descriptor_index(journal_block_index_block, journal_block_index_descriptor, true);
+  for (size_t i = 0; valid && i < number_of_transactions; ++i)
+    valid = transactions[i].first <= transactions[i].end && transactions[i].end <= journal_descriptors.size() &&
+            (i == 0 || transactions[i - 1].sequence < transactions[i].sequence);
+  if (!valid)
+  {
+    journal_descriptors.clear();
+    block_index_block.clear();
+    block_index_descriptor.clear();
+    journal_block_index_block.clear();
+    journal_block_index_descriptor.clear();
+    return cache.corrupt();
+  }
+  std::cout << "Loading " << cache_stage0 << "...\n";
+  min_journal_block = info->min_journal_block;
+  max_journal_block = info->max_journal_block;
+  std::cout << "Minimum / maximum journal block: " << min_journal_block << " / " << max_journal_block << '\n';
+  wrapped_journal_sequence = info->wrapped_journal_sequence;
+  min_sequence = info->min_sequence;
+  max_sequence = info->max_sequence;
+  journal_block_map = new uint32_t [journal_maxlen_];
+  std::memcpy(journal_block_map, block_map, journal_maxlen_ * sizeof(uint32_t));
+  journal_block_bitmap = new bitmap_t [size];
+  std::memcpy(journal_block_bitmap, block_bitmap, size * sizeof(bitmap_t));
+  is_indirect_block_in_journal_bitmap = new bitmap_t [size];
+  std::memcpy(is_indirect_block_in_journal_bitmap, indirect_bitmap, size * sizeof(bitmap_t));
+  number_of_descriptors = journal_descriptors.size();
+  for (size_t i = 0; i < number_of_transactions; ++i)
+  {
+    Stage0Transaction const& transaction(transactions[i]);
+    sequence_transaction_map_type::iterator iter =
+        sequence_transaction_map.insert(sequence_transaction_map.end(), sequence_transaction_map_type::value_type(transaction.sequence, Transaction()));
+    iter->second.assign(transaction.block, transaction.sequence, transaction.committed, transaction.first, transaction.end);
+  }
+  std::pair<int, int> const* dir_inodes = cache.section<std::pair<int, int> >(stage0_first_index_section + 5, count);
+  for (size_t i = 0; i < count; ++i)
+    block_to_dir_inode_map.insert(block_to_dir_inode_map.end(), dir_inodes[i]);
+  std::pair<int, int> const* corrupted_directories = cache.section<std::pair<int, int> >(stage0_first_index_section + 6, count);
+  for (size_t i = 0; i < count; ++i)
+    print_corrupted_directory_note(corrupted_directories[i].first, corrupted_directories[i].second);
+  print_journal_summary(info->oldtime);
+  return true;
+}
+
 void init_journal(void)
 {
   DoutEntering(dc::notice, "init_journal()");
 
+  IOStage io_stage(io_stage_journal);
+
+  std::string cache_stage0 = cache_filename("stage0");
+  if (load_stage0(cache_stage0))
+    return;
+
   // Determine which blocks belong to the journal.
   ASSERT(is_allocated(super_block.s_journal_inum));	// Maybe this is the way to detect external journals?
   InodePointer journal_inode = get_inode(super_block.s_journal_inum);
@@ -382,7 +833,7 @@ void init_journal(void)
   max_journal_block = largest_block_nr + 1;
   std::cout << "Minimum / maximum journal block: " << min_journal_block << " / " << max_journal_block << '\n';
   // Allocate and fill the bitmaps.
-  int size = (max_journal_block - min_journal_block + 8 * sizeof(bitmap_t) - 1) / (8 * sizeof(bitmap_t));
+  int size = journal_bitmap_size();
   is_indirect_block_in_journal_bitmap = new bitmap_t [size];
   memset(is_indirect_block_in_journal_bitmap, 0, size * sizeof(bitmap_t));
 #ifdef CPPGRAPH
@@ -394,6 +845,9 @@ void init_journal(void)
   ASSERT(!reused_or_corrupted_indirect_block5);
   journal_block_bitmap = new bitmap_t [size];
   memset(journal_block_bitmap, 0, size * sizeof(bitmap_t));
+  // Also fill journal_block_map, so that journal_block_to_real_block doesn't need to read indirect blocks.
+  journal_block_map = new uint32_t [journal_maxlen_];
+  memset(journal_block_map, 0, journal_maxlen_ * sizeof(uint32_t));
 #ifdef CPPGRAPH
   // Tell cppgraph that we call fill_journal_bitmap_action from here.
   iterate_over_all_blocks_of__with__fill_journal_bitmap_action();
@@ -403,30 +857,44 @@ void init_journal(void)
   ASSERT(!reused_or_corrupted_indirect_block6);
   // Initialize the Descriptors.
   std::cout << "Loading journal descriptors..." << std::flush;
+  double start_time = now();
   wrapped_journal_sequence = 0;
-  count_descriptors();
-  all_descriptors.clear();
-  all_descriptors.resize(number_of_descriptors);
-  uint32_t descriptor_count = 0;
-  iterate_over_journal(action_tag_fill, action_revoke_fill, action_commit_fill, &descriptor_count);
-  ASSERT(all_descriptors.size() == number_of_descriptors);
-  ASSERT(number_of_descriptors == 0 || all_descriptors[number_of_descriptors - 1]->descriptor_type() != dt_unknown);
+  min_sequence = 0xffffffff;
+  max_sequence = 0;
+  journal_descriptors.clear();
+  // Read the journal once, collecting all descriptors and analysing the copies of inode table blocks as they pass by.
+  journal_inode_copies_type inode_copies;
+  iterate_over_journal(action_tag_fill, action_revoke_fill, action_commit_fill, &inode_copies, action_tag_data_fill);
+  number_of_descriptors = journal_descriptors.size();
+  double read_time = now();
   // Sort the descriptors in ascending sequence number.
   std::cout << " sorting..." << std::flush;
-  std::sort(all_descriptors.begin(), all_descriptors.end(), AllDescriptorsPred());
-  for (std::vector<Descriptor*>::iterator iter = all_descriptors.begin(); iter != all_descriptors.end(); ++iter)
+  journal_descriptors.sort();
+  double sort_time = now();
+  std::vector<std::pair<uint32_t, uint32_t> > block_index_entries;
+  std::vector<std::pair<uint32_t, uint32_t> > journal_block_index_entries;
+  for (uint32_t index = 0; index < number_of_descriptors; ++index)
   {
-    int sequence = (*iter)->sequence();
+    Descriptor descriptor(index);
+    int sequence = descriptor.sequence();
     std::pair<sequence_transaction_map_type::iterator, bool> res =
         sequence_transaction_map.insert(sequence_transaction_map_type::value_type(sequence, Transaction()));
-    switch((*iter)->descriptor_type())
+    switch(descriptor.descriptor_type())
     {
       case dt_tag:
       case dt_revoke:
-        if (res.second)						// Did we just create this Transaction object?
-	  res.first->second.init((*iter)->block(), sequence);	// Initialize it.
-	res.first->second.append(*iter);
-	(*iter)->add_block_descriptors();
+        if (res.second)							// Did we just create this Transaction object?
+	  res.first->second.init(descriptor.block(), sequence, index);	// Initialize it.
+	res.first->second.append(index);
+	if (descriptor.descriptor_type() == dt_tag)
+	  block_index_entries.push_back(std::pair<uint32_t, uint32_t>(descriptor.tag_block(), index));
+	else
+	{
+	  uint32_t count = journal_descriptors.number_of_revoked_blocks(index);
+	  for (uint32_t i = 0; i < count; ++i)
+	    block_index_entries.push_back(std::pair<uint32_t, uint32_t>(journal_descriptors.revoked_block(index, i), index));
+	}
+	journal_block_index_entries.push_back(std::pair<uint32_t, uint32_t>(descriptor.block(), index));
         break;
       case dt_commit:
         if (res.second)						// Did we just create this Transaction object?
@@ -436,87 +904,78 @@ void init_journal(void)
 	  res.first->second.set_committed();
         break;
       case dt_unknown:
-        ASSERT((*iter)->descriptor_type() != dt_unknown);	// Fail; this should really never happen.
+        ASSERT(descriptor.descriptor_type() != dt_unknown);	// Fail; this should really never happen.
 	break;
     }
   }
-  static unsigned char block_buf[EXT3_MAX_BLOCK_SIZE];
-  Inode const* inode = reinterpret_cast<Inode const*>(block_buf);
+  build_descriptor_index(block_index_entries, block_index_block, block_index_descriptor);
+  build_descriptor_index(journal_block_index_entries, journal_block_index_block, journal_block_index_descriptor);
+  // Every journal block contains at most one descriptor.
+  ASSERT(std::adjacent_find(journal_block_index_block.begin(), journal_block_index_block.end()) == journal_block_index_block.end());
+  double transactions_time = now();
   // Run over all descriptors, in increasing sequence number.
   time_t oldtime = 0;
-  for (std::vector<Descriptor*>::iterator iter = all_descriptors.begin(); iter != all_descriptors.end(); ++iter)
+  std::vector<std::pair<int, int> > corrupted_directory_notes;
+  for (uint32_t index = 0; index < number_of_descriptors; ++index)
   {
+    Descriptor tag(index);
     // Skip non-tags.
-    if ((*iter)->descriptor_type() != dt_tag)
+    if (tag.descriptor_type() != dt_tag)
       continue;
-    DescriptorTag* tag = static_cast<DescriptorTag*>(*iter);
     // Only process those that contain inodes.
-    uint32_t block_nr = tag->block();
+    uint32_t block_nr = tag.tag_block();
     if (!is_block_number(block_nr))
     {
       std::cout << block_nr << " is not a block number.\n";
-      std::cout << "Sequence number: " << tag->sequence() << "; ";
-      tag->print_blocks();
+      std::cout << "Sequence number: " << tag.sequence() << "; ";
+      tag.print_blocks();
       std::cout << '\n';
       exit(EXIT_FAILURE);
     }
     if (is_inode(block_nr))
     {
-      int inode_number = block_to_inode(block_nr);
-      // Run over all inodes in the journal block.
-      get_block(tag->Descriptor::block(), block_buf);
-      __le32 lasttime = 0;
-      for (unsigned int i = 0; i < block_size_ / sizeof(Inode); i += inode_size_ / sizeof(Inode), ++inode_number)
+      journal_inode_copies_type::iterator inode_copy = inode_copies.find(tag.block());
+      if (inode_copy == inode_copies.end())
       {
-        // REMOVE THIS:
-	// print the inode number:
-	//std::cout << "INODE IN JOURNAL: " << inode_number << std::endl;
-	if (inode[i].atime() > lasttime || lasttime == 0)
-	  lasttime = inode[i].atime(); 
-	if (inode[i].ctime() > lasttime)
-	  lasttime = inode[i].ctime();
-	if (inode[i].mtime() > lasttime)
-	  lasttime = inode[i].mtime();
-	if (inode[i].dtime() > lasttime)
-	  lasttime = inode[i].dtime();
-
-        // Skip non-directories.
-	if (!is_directory(inode[i]))
-	  continue;
-        // Skip deleted inodes.
-        if (inode[i].is_deleted())
-	  continue;
-#ifdef CPPGRAPH
-        // Tell cppgraph that we call directory_inode_action from here.
-        iterate_over_all_blocks_of__with__directory_inode_action();
-#endif
-	// Run over all blocks of the directory inode.
-	bool reused_or_corrupted_indirect_block7 = iterate_over_all_blocks_of(inode[i], inode_number, directory_inode_action, &inode_number);
-	if (reused_or_corrupted_indirect_block7)
-	{
-	  std::cout << "Note: Block " << tag->Descriptor::block() << " in the journal contains a copy of inode " << inode_number <<
-	      " which is a directory, but this directory has reused or corrupted (double/triple) indirect blocks.\n";
-	}
+        // The journal wrapped around before iterate_over_journal reached this block.
+	static unsigned char block_buf[EXT3_MAX_BLOCK_SIZE];
+	get_block(tag.block(), block_buf);
+	inode_copy = inode_copies.insert(journal_inode_copies_type::value_type(tag.block(), JournalInodeCopy())).first;
+	analyse_journal_inode_copy(block_nr, block_buf, inode_copy->second);
+      }
+      std::vector<std::pair<int, int> >& directory_blocks(inode_copy->second.directory_blocks);
+      for (std::vector<std::pair<int, int> >::iterator iter2 = directory_blocks.begin(); iter2 != directory_blocks.end(); ++iter2)
+        directory_inode_action(iter2->first, 0, &iter2->second);
+      std::vector<int>& corrupted_directories(inode_copy->second.corrupted_directories);
+      for (std::vector<int>::iterator iter2 = corrupted_directories.begin(); iter2 != corrupted_directories.end(); ++iter2)
+      {
+	print_corrupted_directory_note(tag.block(), *iter2);
+	corrupted_directory_notes.push_back(std::pair<int, int>(tag.block(), *iter2));
       }
       // Normally a lasttime != 0 should do. But I ran into a case where the supposedly inode block
       // didn't contain inodes at all, but block numbers?! Therefore, check that lasttime > inode_count_,
       // which will be the case in 99.999% of the cases for a real time_t.
+      __le32 lasttime = inode_copy->second.lasttime;
       if ((uint32_t)lasttime > inode_count_ && (__le32_to_cpu(lasttime) < (uint32_t)oldtime || oldtime == 0))
 	oldtime = __le32_to_cpu(lasttime);
     }
   }
+  double inode_copies_time = now();
   std::cout << " done\n";
-  std::cout << "The oldest inode block that is still in the journal, appears to be from " << oldtime << " = " << std::ctime(&oldtime);
-  if (wrapped_journal_sequence)
+  print_journal_summary(oldtime);
+  std::cout << "Writing journal index to '" << cache_stage0 << "'. Delete that file if you want to parse the journal again.\n";
+  write_stage0(cache_stage0, oldtime, corrupted_directory_notes);
+  if (commandline_stats)
   {
-    static bool printed = false;
-    if (!printed)
-    {
-      printed = true;
-      std::cout << "Journal transaction " << wrapped_journal_sequence << " wraps around, some data blocks might have been lost of this transaction.\n";
-    }
+    std::ostringstream timing;	// Don't change the format flags of std::cout.
+    timing << std::fixed << std::setprecision(3) << "Journal timing: reading " << (read_time - start_time) <<
+        " s, sorting " << (sort_time - read_time) << " s, transactions " << (transactions_time - sort_time) <<
+	" s, inode copies " << (inode_copies_time - transactions_time) << " s.\n";
+    timing << "Journal descriptors: " << (journal_descriptors.memory_usage() +
+        (block_index_block.capacity() + block_index_descriptor.capacity() +
+	 journal_block_index_block.capacity() + journal_block_index_descriptor.capacity()) * sizeof(uint32_t)) << " bytes.\n";
+    std::cout << timing.str();
   }
-  std::cout << "Number of descriptors in journal: " << number_of_descriptors << "; min / max sequence numbers: " << min_sequence << " / " << max_sequence << '\n';
 }
 
 bool is_in_journal(int blocknr)
@@ -550,65 +1009,55 @@ bool is_indirect_block_in_journal(int blocknr)
 
 int journal_block_contains_inodes(int blocknr)
 {
-  block_in_journal_to_descriptors_map_type::iterator iter = block_in_journal_to_descriptors_map.find(blocknr);
-  if (iter == block_in_journal_to_descriptors_map.end())
+  Descriptor descriptor;
+  if (!block_in_journal_to_descriptor(blocknr, descriptor))
     return 0;
-  Descriptor& descriptor(*iter->second);
   if (descriptor.descriptor_type() != dt_tag)
     return 0;
-  DescriptorTag& descriptor_tag(static_cast<DescriptorTag&>(descriptor));
-  return is_inode(descriptor_tag.block()) ? descriptor_tag.block() : 0;
+  return is_inode(descriptor.tag_block()) ? descriptor.tag_block() : 0;
 }
 
 // This is the only function that accepts "journal block numbers",
 // as opposed to "file system block numbers".
 int journal_block_to_real_block(int blocknr)
 {
-  static unsigned char block_buf[EXT3_MAX_BLOCK_SIZE];
+  ASSERT(journal_block_map);
   ASSERT(blocknr >= 0 && blocknr < journal_maxlen_);
-  if (blocknr < 12)
-    return journal_inode.block()[blocknr];
-  blocknr -= 12;
-  int const vpb = block_size_ / sizeof(__le32);	// Values Per Block.
-  if (blocknr < vpb)
-  {
-    get_block(journal_inode.block()[EXT3_IND_BLOCK], block_buf);
-    __le32* indirect_block = reinterpret_cast<__le32*>(block_buf);
-    return indirect_block[blocknr];
-  }
-  blocknr -= vpb;
-  if (blocknr < vpb * vpb)
-  {
-    get_block(journal_inode.block()[EXT3_DIND_BLOCK], block_buf);
-    __le32* double_indirect_block = reinterpret_cast<__le32*>(block_buf);
-    get_block(double_indirect_block[blocknr / vpb], block_buf);
-    __le32* indirect_block = reinterpret_cast<__le32*>(block_buf);
-    return indirect_block[blocknr % vpb];
-  }
-  blocknr -= vpb * vpb;
-  ASSERT(blocknr < vpb * vpb * vpb);
-  get_block(journal_inode.block()[EXT3_TIND_BLOCK], block_buf);
-  __le32* tripple_indirect_block = reinterpret_cast<__le32*>(block_buf);
-  get_block(tripple_indirect_block[blocknr / (vpb * vpb)], block_buf);
-  __le32* double_indirect_block = reinterpret_cast<__le32*>(block_buf);
-  get_block(double_indirect_block[(blocknr / vpb) % vpb], block_buf);
-  __le32* indirect_block = reinterpret_cast<__le32*>(block_buf);
-  return indirect_block[blocknr % vpb];
+  return journal_block_map[blocknr];
+}
+
+// Return the next block read by read_ahead that is journal block jbn.
+static unsigned char* next_journal_block(ReadAhead& read_ahead, uint32_t jbn)
+{
+  int block;
+  unsigned char* block_buf;
+  while ((block_buf = read_ahead.next_block(block)) && (uint32_t)block != journal_block_map[jbn])
+    ;	// Skip blocks that were only read to fill a gap.
+  ASSERT(block_buf);
+  return block_buf;
 }
 
 void iterate_over_journal(
     bool (*action_tag)(uint32_t block, uint32_t sequence, journal_block_tag_t*, void* data),
     bool (*action_revoke)(uint32_t block, uint32_t sequence, journal_revoke_header_t*, void* data),
     bool (*action_commit)(uint32_t block, uint32_t sequence, void* data),
-    void* data)
+    void* data,
+    bool (*action_tag_data)(uint32_t block, uint32_t block_nr, unsigned char const* block_buf, void* data))
 {
   uint32_t jbn = be2le(journal_super_block.s_first);
-  static unsigned char block_buf[EXT3_MAX_BLOCK_SIZE];
-  while(jbn < (uint32_t)journal_maxlen_)
+  uint32_t const maxlen = journal_maxlen_;
+  // Read the journal sequentially, from jbn till the end, in as few ranges as possible.
+  // The gaps, if the journal isn't contiguous, are normally the indirect blocks of the journal inode.
+  ReadAhead read_ahead;
+  for (uint32_t j = jbn; j < maxlen; ++j)
+    read_ahead.add_block(journal_block_map[j]);
+  read_ahead.start();
+  std::vector<uint32_t> tag_block_nrs;
+  while(jbn < maxlen)
   {
     // bn is the real block number inside the journal.
-    uint32_t bn = journal_block_to_real_block(jbn);
-    unsigned char* block = get_block(bn, block_buf);
+    uint32_t bn = journal_block_map[jbn];
+    unsigned char* block = next_journal_block(read_ahead, jbn);
     journal_header_t* descriptor = reinterpret_cast<journal_header_t*>(block);
     if (be2le(descriptor->h_magic) == JFS_MAGIC_NUMBER)
     {
@@ -620,23 +1069,33 @@ void iterate_over_journal(
 	{
 	  journal_block_tag_t* ptr = reinterpret_cast<journal_block_tag_t*>((unsigned char*)descriptor + sizeof(journal_header_t));
 	  uint32_t flags;
+	  uint32_t first_data_jbn = jbn + 1;
+	  tag_block_nrs.clear();
 	  do
 	  {
 	    ++jbn;
-	    if (jbn >= (uint32_t)journal_maxlen_)
+	    if (jbn >= maxlen)
 	    {
 	      // This could be cheched by checking that the wrapped around block starts with JFS_MAGIC_NUMBER (which thus overwrote the data block).
 	      wrapped_journal_sequence = sequence;
 	      return;
 	    }
-	    else if (action_tag(journal_block_to_real_block(jbn), sequence, ptr, data))
+	    else if (action_tag(journal_block_map[jbn], sequence, ptr, data))
 	      return;
+	    tag_block_nrs.push_back(be2le(ptr->t_blocknr));
 	    flags = be2le(ptr->t_flags);
 	    if (!(flags & JFS_FLAG_SAME_UUID))
 	      ptr = reinterpret_cast<journal_block_tag_t*>((char*)ptr + 16);
 	    ++ptr;
 	  }
 	  while(!(flags & JFS_FLAG_LAST_TAG));
+	  // The data blocks follow the descriptor block. Reading them invalidates descriptor.
+	  if (action_tag_data)
+	  {
+	    for (uint32_t data_jbn = first_data_jbn; data_jbn <= jbn; ++data_jbn)
+	      if (action_tag_data(journal_block_map[data_jbn], tag_block_nrs[data_jbn - first_data_jbn], next_journal_block(read_ahead, data_jbn), data))
+		return;
+	  }
 	  break;
 	}
 	case JFS_COMMIT_BLOCK:
@@ -739,25 +1198,146 @@ void handle_commandline_journal_transaction(void)
   }
 }
 
+void init_journal_as_of(uint32_t sequence)
+{
+  // Collect the copies of each block in, and the revokes by, committed transactions.
+  std::vector<JournalBlockCopy> copies;
+  copies.reserve(block_index_block.size());
+  sequence_transaction_map_type::const_iterator transaction = sequence_transaction_map.end();
+  for (size_t i = 0; i < block_index_block.size(); ++i)
+  {
+    uint32_t index = block_index_descriptor[i];
+    Descriptor descriptor(index);
+    if (transaction == sequence_transaction_map.end() || transaction->first != (int)descriptor.sequence())
+      transaction = sequence_transaction_map.find(descriptor.sequence());
+    if (transaction == sequence_transaction_map.end() || !transaction->second.committed())
+      continue;
+    JournalBlockCopy copy;
+    copy.block = block_index_block[i];
+    copy.sequence = descriptor.sequence();
+    if (descriptor.descriptor_type() == dt_tag)
+    {
+      copy.source = descriptor.block();
+      copy.escaped = (journal_descriptors.tag_flags(index) & JFS_FLAG_ESCAPE);
+    }
+    else
+    {
+      copy.source = 0;
+      copy.escaped = false;
+    }
+    copies.push_back(copy);
+  }
+  init_journal_overlay(copies, sequence);
+  std::cout << "Using the file system as of journal transaction " << sequence << ": " <<
+      journal_overlay_size() << " blocks are read from the journal.\n";
+  if (sequence < min_sequence || sequence > max_sequence)
+    std::cout << "Note: the sequence numbers found are in the range [" << min_sequence << ", " << max_sequence << "].\n";
+}
+
+// A copy of an inode table block in the journal.
+struct InodeCopy {
+  uint32_t block_nr;		// The inode table block that was copied.
+  uint32_t sequence;		// The sequence number of the transaction that contains the copy.
+  uint32_t block;		// The block in the journal that contains the copy.
+};
+
+struct InodeCopyBlockNrPred {
+  bool operator()(InodeCopy const& copy1, InodeCopy const& copy2) const { return copy1.block_nr < copy2.block_nr; }
+};
+
+// All copies of inode table blocks in the journal, sorted by inode table block and then from the highest to the lowest
+// descriptor index (that is, sequence number). This is the order in which get_inodes_from_journal returns them.
+// There is one entry per tag, so the index is never larger than the journal.
+static std::vector<InodeCopy> inode_copy_index;
+static bool inode_copy_index_initialized = false;
+// If not empty, the inodes of inode_copy_index[i] are stored at inode_copy_data[i * inodes_per_block].
+static std::vector<Inode> inode_copy_data;
+
+// Order InodeCopy indices by their journal block.
+struct InodeCopyBlockPred {
+  bool operator()(uint32_t index1, uint32_t index2) const
+  {
+    return inode_copy_index[index1].block < inode_copy_index[index2].block;
+  }
+};
+
+// Read all journal blocks that contain inode copies in one sequential pass and store the copies in inode_copy_data,
+// provided that they fit in --journal-inode-cache; otherwise they are read on demand.
+static void preload_inode_copies(void)
+{
+  size_t const number_of_copies = inode_copy_index.size();
+  uint32_t const inodes_per_block = block_size_ / inode_size_;
+  if (number_of_copies == 0 ||
+      number_of_copies * inodes_per_block * sizeof(Inode) > (size_t)commandline_journal_inode_cache * 1024 * 1024)
+    return;
+  std::vector<uint32_t> order(number_of_copies);
+  for (uint32_t i = 0; i < number_of_copies; ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), InodeCopyBlockPred());
+  ReadAhead read_ahead;
+  for (uint32_t i = 0; i < number_of_copies; ++i)
+    if (i == 0 || inode_copy_index[order[i]].block != inode_copy_index[order[i - 1]].block)
+      read_ahead.add_block(inode_copy_index[order[i]].block);
+  read_ahead.start();
+  inode_copy_data.resize(number_of_copies * inodes_per_block);
+  int block = -1;
+  unsigned char* block_buf = NULL;
+  for (uint32_t i = 0; i < number_of_copies; ++i)
+  {
+    InodeCopy const& copy(inode_copy_index[order[i]]);
+    while ((uint32_t)block != copy.block)
+    {
+      block_buf = read_ahead.next_block(block);
+      ASSERT(block_buf);
+    }
+    for (uint32_t slot = 0; slot < inodes_per_block; ++slot)
+      std::memcpy(&inode_copy_data[(size_t)order[i] * inodes_per_block + slot], block_buf + slot * inode_size_, sizeof(Inode));
+  }
+}
+
+static void init_inode_copy_index(void)
+{
+  inode_copy_index_initialized = true;
+  for (uint32_t index = number_of_descriptors; index-- > 0;)
+  {
+    Descriptor descriptor(index);
+    if (descriptor.descriptor_type() != dt_tag)
+      continue;
+    uint32_t block_nr = descriptor.tag_block();
+    if (!is_inode(block_nr))
+      continue;
+    InodeCopy copy;
+    copy.block_nr = block_nr;
+    copy.sequence = descriptor.sequence();
+    copy.block = descriptor.block();
+    inode_copy_index.push_back(copy);
+  }
+  std::stable_sort(inode_copy_index.begin(), inode_copy_index.end(), InodeCopyBlockNrPred());
+  preload_inode_copies();
+}
+
 void get_inodes_from_journal(int inode, std::vector<std::pair<int, Inode> >& inodes)
 {
-  uint32_t block = inode_to_block(super_block, inode);
-  int offset = (inode - block_to_inode(block)) * inode_size_;
-  block_to_descriptors_map_type::iterator descriptors_iter = block_to_descriptors_map.find(block);
-  if (descriptors_iter != block_to_descriptors_map.end())
+  if (!inode_copy_index_initialized)
+    init_inode_copy_index();
+  if (inode < 1 || (uint32_t)inode > inode_count_)
+    return;
+  InodeCopy key;
+  key.block_nr = inode_to_block(super_block, inode);
+  uint32_t const slot = inode - block_to_inode(key.block_nr);
+  uint32_t const inodes_per_block = block_size_ / inode_size_;
+  std::pair<std::vector<InodeCopy>::iterator, std::vector<InodeCopy>::iterator> range =
+      std::equal_range(inode_copy_index.begin(), inode_copy_index.end(), key, InodeCopyBlockNrPred());
+  for (std::vector<InodeCopy>::iterator iter = range.first; iter != range.second; ++iter)
   {
-    std::vector<Descriptor*>& descriptors(descriptors_iter->second);
-    for (std::vector<Descriptor*>::reverse_iterator descriptor_iter = descriptors.rbegin(); descriptor_iter != descriptors.rend(); ++descriptor_iter)
+    if (!inode_copy_data.empty())
+      inodes.push_back(std::pair<int, Inode>(iter->sequence, inode_copy_data[(iter - inode_copy_index.begin()) * inodes_per_block + slot]));
+    else
     {
-      Descriptor& descriptor(**descriptor_iter);
-      if (descriptor.descriptor_type() != dt_tag)
-        continue;
-      DescriptorTag& tag(static_cast<DescriptorTag&>(descriptor));
-      ASSERT(tag.block() == block);
       static unsigned char block_buf[EXT3_MAX_BLOCK_SIZE];
-      get_block(descriptor.block(), block_buf);
-      Inode const* inode_ptr = reinterpret_cast<Inode const*>(block_buf + offset);
-      inodes.push_back(std::pair<int, Inode>(descriptor.sequence(), *inode_ptr));
+      get_block(iter->block, block_buf);
+      Inode const* inode_ptr = reinterpret_cast<Inode const*>(block_buf + slot * inode_size_);
+      inodes.push_back(std::pair<int, Inode>(iter->sequence, *inode_ptr));
     }
   }
 }
@@ -37,30 +37,36 @@ enum descriptor_type_nt {
   dt_commit
 };
 
+// All journal descriptors are stored in one struct of arrays (see class JournalDescriptors in journal.cc),
+// in ascending sequence number. A Descriptor is merely an index into those arrays.
 class Descriptor {
   private:
-    uint32_t const M_block;			// Block number in the journal.
-    uint32_t const M_sequence;
+    uint32_t M_index;
   public:
-    Descriptor(uint32_t block, uint32_t sequence) : M_block(block), M_sequence(sequence) { }
-    uint32_t block(void) const { return M_block; }
-    uint32_t sequence(void) const { return M_sequence; }
-    virtual descriptor_type_nt descriptor_type(void) const = 0;
-    virtual void print_blocks(void) const = 0;
-    virtual void add_block_descriptors(void) = 0;
-  protected:
-    virtual ~Descriptor() { }
+    Descriptor(void) : M_index(0) { }
+    explicit Descriptor(uint32_t index) : M_index(index) { }
+    uint32_t index(void) const { return M_index; }
+    uint32_t block(void) const;			// Block number in the journal.
+    uint32_t sequence(void) const;
+    descriptor_type_nt descriptor_type(void) const;
+    uint32_t tag_block(void) const;		// Block number on the file system (dt_tag only).
+    void print_blocks(void) const;
 };
 
-typedef std::map<int, Descriptor*> block_in_journal_to_descriptors_map_type;
-extern block_in_journal_to_descriptors_map_type block_in_journal_to_descriptors_map;
+typedef std::vector<uint32_t>::const_iterator descriptor_index_iterator;
+
+// Set [begin, end) to the indices of the descriptors that reference file system block 'block', in ascending sequence number.
+void block_to_descriptors(uint32_t block, descriptor_index_iterator& begin, descriptor_index_iterator& end);
+// Set descriptor to the tag or revoke descriptor that is stored in journal block 'block' and return true, or return false if there is none.
+bool block_in_journal_to_descriptor(uint32_t block, Descriptor& descriptor);
+
 typedef std::map<int, int> block_to_dir_inode_map_type;
 extern block_to_dir_inode_map_type block_to_dir_inode_map;
-typedef std::map<int, std::vector<Descriptor*> > block_to_descriptors_map_type;
-extern block_to_descriptors_map_type block_to_descriptors_map;
 extern uint32_t max_sequence;
 
 uint32_t find_largest_journal_sequence_number(int block);
 void get_inodes_from_journal(int inode, std::vector<std::pair<int, Inode> >& inodes);
+// Activate the journal overlay (--as-of): read every block as it was after transaction 'sequence' (see journal_overlay.h).
+void init_journal_as_of(uint32_t sequence);
 
 #endif // JOURNAL_H
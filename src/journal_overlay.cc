@@ -0,0 +1,141 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file journal_overlay.cc Implementation of the journal overlay (--as-of).
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "ext3.h"
+#include "debug.h"
+#endif
+
+#include "journal_overlay.h"
+#include "endian_conversion.h"
+#include "get_block.h"
+#include "globals.h"
+
+bool journal_overlay_active = false;
+uint32_t journal_overlay_sequence;
+
+// The interval index: all copies and revokes, sorted by block and then by sequence number (see JournalBlockCopy::operator<).
+// The state of block B as of sequence S is given by the last entry of B with a sequence number at or before S.
+static std::vector<uint32_t> overlay_block;
+static std::vector<uint32_t> overlay_sequence;
+static std::vector<uint32_t> overlay_source;
+static std::vector<bool> overlay_escaped;
+
+static size_t overlay_size;
+
+void init_journal_overlay(std::vector<JournalBlockCopy>& copies, uint32_t sequence)
+{
+  std::sort(copies.begin(), copies.end());
+  size_t size = copies.size();
+  overlay_block.resize(size);
+  overlay_sequence.resize(size);
+  overlay_source.resize(size);
+  overlay_escaped.resize(size);
+  for (size_t i = 0; i < size; ++i)
+  {
+    overlay_block[i] = copies[i].block;
+    overlay_sequence[i] = copies[i].sequence;
+    overlay_source[i] = copies[i].source;
+    overlay_escaped[i] = copies[i].escaped;
+  }
+  std::vector<JournalBlockCopy>().swap(copies);
+  journal_overlay_sequence = sequence;
+  journal_overlay_active = true;
+  overlay_size = 0;
+  for (size_t i = 0; i < size;)
+  {
+    uint32_t source;
+    bool escaped;
+    if (journal_overlay_lookup(overlay_block[i], source, escaped))
+      ++overlay_size;
+    i = std::upper_bound(overlay_block.begin() + i, overlay_block.end(), overlay_block[i]) - overlay_block.begin();
+  }
+}
+
+bool journal_overlay_lookup(uint32_t block, uint32_t& source, bool& escaped)
+{
+  std::vector<uint32_t> const& blocks(overlay_block);
+  std::vector<uint32_t> const& sequences(overlay_sequence);
+  std::vector<uint32_t>::const_iterator lower = std::lower_bound(blocks.begin(), blocks.end(), block);
+  if (lower == blocks.end() || *lower != block)
+    return false;
+  std::vector<uint32_t>::const_iterator upper = std::upper_bound(lower, blocks.end(), block);
+  // The entries of block are sorted by sequence number: find the last one at or before the as-of sequence.
+  std::vector<uint32_t>::const_iterator first = sequences.begin() + (lower - blocks.begin());
+  std::vector<uint32_t>::const_iterator last = sequences.begin() + (upper - blocks.begin());
+  std::vector<uint32_t>::const_iterator iter = std::upper_bound(first, last, journal_overlay_sequence);
+  if (iter == first)
+    return false;			// Only copies after the as-of sequence.
+  size_t index = iter - sequences.begin() - 1;
+  if (overlay_source[index] == 0)
+    return false;			// Revoked: the copies in the journal are not valid anymore.
+  source = overlay_source[index];
+  escaped = overlay_escaped[index];
+  return true;
+}
+
+void journal_overlay_unescape(unsigned char* block_buf)
+{
+  *reinterpret_cast<__be32*>(block_buf) = be2le((__be32)JFS_MAGIC_NUMBER);
+}
+
+void journal_overlay_apply(int first_block, int count, unsigned char* buf)
+{
+  std::vector<uint32_t> const& blocks(overlay_block);
+  std::vector<uint32_t>::const_iterator iter = std::lower_bound(blocks.begin(), blocks.end(), (uint32_t)first_block);
+  uint32_t const end_block = first_block + count;
+  while (iter != blocks.end() && *iter < end_block)
+  {
+    uint32_t block = *iter;
+    uint32_t source;
+    bool escaped;
+    if (journal_overlay_lookup(block, source, escaped))
+      get_block(block, buf + (size_t)(block - first_block) * block_size_);
+    iter = std::upper_bound(iter, blocks.end(), block);
+  }
+}
+
+void journal_overlay_apply(int first_block, int count, unsigned char* const* block_bufs)
+{
+  std::vector<uint32_t> const& blocks(overlay_block);
+  std::vector<uint32_t>::const_iterator iter = std::lower_bound(blocks.begin(), blocks.end(), (uint32_t)first_block);
+  uint32_t const end_block = first_block + count;
+  while (iter != blocks.end() && *iter < end_block)
+  {
+    uint32_t block = *iter;
+    uint32_t source;
+    bool escaped;
+    if (journal_overlay_lookup(block, source, escaped))
+      get_block(block, block_bufs[block - first_block]);
+    iter = std::upper_bound(iter, blocks.end(), block);
+  }
+}
+
+size_t journal_overlay_size(void)
+{
+  return overlay_size;
+}
@@ -0,0 +1,85 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file journal_overlay.h Declaration of the journal overlay (--as-of).
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef JOURNAL_OVERLAY_H
+#define JOURNAL_OVERLAY_H
+
+#ifndef USE_PCH
+#include <stdint.h>
+#include <vector>
+#endif
+
+// The journal overlay.
+//
+// When --as-of seq is given, every block is read as it was after the
+// transaction with sequence number 'seq': from its newest copy in the
+// journal in a committed transaction at or before 'seq', or from the
+// device when there is no such copy or when it was revoked by a later
+// transaction at or before 'seq' (just like a journal replay).
+//
+// The overlay is applied by get_block(), get_blocks() and when loading
+// inode tables, so every query runs against that historical state.
+// The super block and the group descriptor table are not overlaid.
+
+// A copy of file system block 'block' in the journal, written by the transaction
+// with sequence number 'sequence' to file system block 'source'. If 'source'
+// is zero then the transaction revoked 'block' instead.
+struct JournalBlockCopy {
+  uint32_t block;
+  uint32_t sequence;
+  uint32_t source;
+  bool escaped;		// The first four bytes of the copy were zeroed because they were equal to JFS_MAGIC_NUMBER.
+
+  // Order by block, then by sequence number; a revoke comes after a copy of the same transaction.
+  bool operator<(JournalBlockCopy const& copy) const
+  {
+    if (block != copy.block)
+      return block < copy.block;
+    if (sequence != copy.sequence)
+      return sequence < copy.sequence;
+    return source != 0 && copy.source == 0;
+  }
+};
+
+extern bool journal_overlay_active;
+extern uint32_t journal_overlay_sequence;
+
+// Build the index from copies (which is cleared) and activate the overlay as of sequence.
+void init_journal_overlay(std::vector<JournalBlockCopy>& copies, uint32_t sequence);
+
+// Return true and set source (and escaped) to the copy in the journal of block as of journal_overlay_sequence, if any.
+bool journal_overlay_lookup(uint32_t block, uint32_t& source, bool& escaped);
+
+// Restore the first four bytes of an escaped copy.
+void journal_overlay_unescape(unsigned char* block_buf);
+
+// Replace the blocks of [first_block, first_block + count), just read into buf (count * block_size_ bytes), that have a copy in the journal.
+void journal_overlay_apply(int first_block, int count, unsigned char* buf);
+
+// Same, but for blocks that were read into the count buffers of block_bufs (one block each).
+void journal_overlay_apply(int first_block, int count, unsigned char* const* block_bufs);
+
+// Return the number of blocks that have a copy in the journal, or were revoked, at or before the as-of sequence.
+size_t journal_overlay_size(void);
+
+#endif // JOURNAL_OVERLAY_H
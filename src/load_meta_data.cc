@@ -23,11 +23,24 @@
 
 #ifndef USE_PCH
 #include "sys.h"
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
 #include "debug.h"
 #endif
 
 #include "globals.h"
 #include "conversion.h"
+#include "get_block.h"
+#include "journal_overlay.h"
+#include "inode.h"
+#include "read_ahead.h"
+#include "cache_file.h"
+#include "commandline.h"
+#include "load_meta_data.h"
 
 //-----------------------------------------------------------------------------
 //
@@ -46,10 +59,9 @@ void load_inodes(int group)
   int block_number = group_descriptor_table[group].bg_inode_table;
   // Load all inodes of this group into memory.
   char* inode_table = new char[inodes_per_group_ * inode_size_];
-  device.seekg(block_to_offset(block_number));
-  ASSERT(device.good());
-  device.read(inode_table, inodes_per_group_ * inode_size_);
-  ASSERT(device.good());
+  read_device(block_to_offset(block_number), inode_table, inodes_per_group_ * inode_size_);
+  if (journal_overlay_active)
+    journal_overlay_apply(block_number, inodes_per_group_ * inode_size_ / block_size_, reinterpret_cast<unsigned char*>(inode_table));
   all_inodes[group] = new Inode[inodes_per_group_];
   // Copy the first 128 bytes of each inode into all_inodes[group].
   for (int i = 0; i < inodes_per_group_; ++i)
@@ -72,20 +84,170 @@ void load_meta_data(int group)
   if (block_bitmap[group])	// Already loaded?
     return;
   DoutEntering(dc::notice, "load_meta_data(" << group << ")");
-  // Load block bitmap.
   block_bitmap[group] = new bitmap_t[block_size_ / sizeof(bitmap_t)];
-  device.seekg(block_to_offset(group_descriptor_table[group].bg_block_bitmap));
-  ASSERT(device.good());
-  device.read(reinterpret_cast<char*>(block_bitmap[group]), block_size_);
-  ASSERT(device.good());
-  // Load inode bitmap.
   inode_bitmap[group] = new bitmap_t[block_size_ / sizeof(bitmap_t)];
-  device.seekg(block_to_offset(group_descriptor_table[group].bg_inode_bitmap));
-  ASSERT(device.good());
-  device.read(reinterpret_cast<char*>(inode_bitmap[group]), block_size_);
-  ASSERT(device.good());
+  int const block_bitmap_block = group_descriptor_table[group].bg_block_bitmap;
+  int const inode_bitmap_block = group_descriptor_table[group].bg_inode_bitmap;
+  if (inode_bitmap_block == block_bitmap_block + 1)
+  {
+    // The usual layout: load both bitmaps with a single system call.
+    unsigned char* bufs[2] = { reinterpret_cast<unsigned char*>(block_bitmap[group]), reinterpret_cast<unsigned char*>(inode_bitmap[group]) };
+    get_blocks(block_bitmap_block, 2, bufs);
+  }
+  else
+  {
+    // Load block bitmap.
+    get_block(block_bitmap_block, reinterpret_cast<unsigned char*>(block_bitmap[group]));
+    // Load inode bitmap.
+    get_block(inode_bitmap_block, reinterpret_cast<unsigned char*>(inode_bitmap[group]));
+  }
 #if !USE_MMAP
   // Load all inodes into memory.
   load_inodes(group);
 #endif
 }
+
+// A bitmap block that must be loaded, and where to.
+struct MetaDataBlock {
+  int block;
+  bitmap_t* bitmap;
+  bool operator<(MetaDataBlock const& meta_data_block) const { return block < meta_data_block.block; }
+};
+
+// The metadata snapshot (--metadata-snapshot) is a binary cache file with two sections:
+// the block bitmaps and the inode bitmaps of all groups, one block per group.
+
+static bool load_meta_data_snapshot(std::string const& cache_meta, int first_group, int end_group)
+{
+  struct stat sb;
+  if (stat(cache_meta.c_str(), &sb) == -1)
+  {
+    if (errno != ENOENT)
+    {
+      int error = errno;
+      std::cout << std::flush;
+      std::cerr << progname << ": failed to open \"" << cache_meta << "\": " << strerror(error) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return false;
+  }
+  CacheFileReader cache;
+  if (!cache.open(cache_meta, "meta"))
+    return false;
+  if (!cache.has_sections(2))
+    return cache.corrupt();
+  size_t block_bitmaps_size, inode_bitmaps_size;
+  char const* block_bitmaps = cache.section<char>(0, block_bitmaps_size);
+  char const* inode_bitmaps = cache.section<char>(1, inode_bitmaps_size);
+  if (block_bitmaps_size != (size_t)groups_ * block_size_ || inode_bitmaps_size != (size_t)groups_ * block_size_)
+    return cache.corrupt();
+  for (int group = first_group; group < end_group; ++group)
+  {
+    if (block_bitmap[group])
+      continue;
+    block_bitmap[group] = new bitmap_t[block_size_ / sizeof(bitmap_t)];
+    inode_bitmap[group] = new bitmap_t[block_size_ / sizeof(bitmap_t)];
+    std::memcpy(block_bitmap[group], block_bitmaps + (size_t)group * block_size_, block_size_);
+    std::memcpy(inode_bitmap[group], inode_bitmaps + (size_t)group * block_size_, block_size_);
+  }
+  return true;
+}
+
+static void write_meta_data_snapshot(std::string const& cache_meta)
+{
+  CacheFileWriter cache(cache_meta, "meta");
+  if (!cache.is_open())
+    return;
+  std::vector<char> bitmaps((size_t)groups_ * block_size_);
+  for (int group = 0; group < groups_; ++group)
+    std::memcpy(&bitmaps[(size_t)group * block_size_], block_bitmap[group], block_size_);
+  add_vector_section(cache, bitmaps);
+  for (int group = 0; group < groups_; ++group)
+    std::memcpy(&bitmaps[(size_t)group * block_size_], inode_bitmap[group], block_size_);
+  add_vector_section(cache, bitmaps);
+  cache.commit();
+}
+
+void load_meta_data(int first_group, int end_group)
+{
+  std::string cache_meta;
+  if (commandline_metadata_snapshot)
+  {
+    cache_meta = cache_filename("meta");
+    if (load_meta_data_snapshot(cache_meta, first_group, end_group))
+    {
+#if !USE_MMAP
+      for (int group = first_group; group < end_group; ++group)
+	if (!all_inodes[group])
+	  load_inodes(group);
+#endif
+      return;
+    }
+  }
+  // Collect the bitmap blocks of all groups that aren't loaded yet, in the order of the device.
+  std::vector<MetaDataBlock> meta_data_blocks;
+  for (int group = first_group; group < end_group; ++group)
+  {
+    if (block_bitmap[group])
+      continue;
+    block_bitmap[group] = new bitmap_t[block_size_ / sizeof(bitmap_t)];
+    inode_bitmap[group] = new bitmap_t[block_size_ / sizeof(bitmap_t)];
+    MetaDataBlock meta_data_block;
+    meta_data_block.block = group_descriptor_table[group].bg_block_bitmap;
+    meta_data_block.bitmap = block_bitmap[group];
+    meta_data_blocks.push_back(meta_data_block);
+    meta_data_block.block = group_descriptor_table[group].bg_inode_bitmap;
+    meta_data_block.bitmap = inode_bitmap[group];
+    meta_data_blocks.push_back(meta_data_block);
+  }
+  std::sort(meta_data_blocks.begin(), meta_data_blocks.end());
+  // Stream them, reading bitmaps that are close together (ie, all of them with flex_bg) with a single read.
+  ReadAhead read_ahead;
+  for (size_t i = 0; i < meta_data_blocks.size(); ++i)
+    if (i == 0 || meta_data_blocks[i].block != meta_data_blocks[i - 1].block)
+      read_ahead.add_block(meta_data_blocks[i].block);
+  read_ahead.start();
+  int block;
+  unsigned char* block_ptr;
+  std::vector<MetaDataBlock>::iterator next = meta_data_blocks.begin();
+  while ((block_ptr = read_ahead.next_block(block)))
+  {
+    // Copy the block to every bitmap that it is (a block can be used for more than one bitmap of a corrupt file system).
+    // ReadAhead reads with get_blocks, which already applied the journal overlay (--as-of).
+    for (; next != meta_data_blocks.end() && next->block == block; ++next)
+      std::memcpy(next->bitmap, block_ptr, block_size_);
+  }
+  ASSERT(next == meta_data_blocks.end());
+#if !USE_MMAP
+  // Load all inodes into memory.
+  for (int group = first_group; group < end_group; ++group)
+    if (!all_inodes[group])
+      load_inodes(group);
+#endif
+  if (commandline_metadata_snapshot && first_group == 0 && end_group == groups_)
+  {
+    std::cout << "Writing metadata snapshot to '" << cache_meta << "'. Delete that file if you want to read the bitmaps again.\n";
+    write_meta_data_snapshot(cache_meta);
+  }
+}
+
+// Load the bitmaps and inode tables that were loaded before the journal overlay was activated again.
+void reload_meta_data(void)
+{
+  for (int group = 0; group < groups_; ++group)
+  {
+    if (block_bitmap[group])
+    {
+      get_block(group_descriptor_table[group].bg_block_bitmap, reinterpret_cast<unsigned char*>(block_bitmap[group]));
+      get_block(group_descriptor_table[group].bg_inode_bitmap, reinterpret_cast<unsigned char*>(inode_bitmap[group]));
+#if !USE_MMAP
+      delete [] all_inodes[group];
+      load_inodes(group);
+#endif
+    }
+#if USE_MMAP
+    // The next get_inode will map the inode table again.
+    inode_unmap(group);
+#endif
+  }
+}
@@ -25,5 +25,9 @@
 #define LOAD_META_DATA_H
 
 void load_meta_data(int group);
+// Load the metadata of all groups in [first_group, end_group) that aren't loaded yet, sorting and
+// coalescing the reads of the bitmaps, or copy it from the metadata snapshot (--metadata-snapshot).
+void load_meta_data(int first_group, int end_group);
+void reload_meta_data(void);
 
 #endif // LOAD_META_DATA_H
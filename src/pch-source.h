@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <utime.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <regex.h>
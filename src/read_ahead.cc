@@ -0,0 +1,176 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file read_ahead.cc Implementation of class ReadAhead.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <pthread.h>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include "debug.h"
+#endif
+
+#include "read_ahead.h"
+#include "globals.h"
+#include "get_block.h"
+
+ReadAhead::ReadAhead(void) : M_range_begin(-1), M_range_end(-1), M_current_chunk(0), M_current_index(-1), M_started(false), M_stop(false)
+{
+  M_max_chunk_blocks = read_ahead_chunk_size / block_size_;
+  for (int i = 0; i < 2; ++i)
+  {
+    M_buffer[i].data = new unsigned char [M_max_chunk_blocks * block_size_];
+    M_buffer[i].full = false;
+  }
+  pthread_mutex_init(&M_mutex, NULL);
+  pthread_cond_init(&M_cond, NULL);
+}
+
+ReadAhead::~ReadAhead()
+{
+  stop();
+  pthread_cond_destroy(&M_cond);
+  pthread_mutex_destroy(&M_mutex);
+  for (int i = 0; i < 2; ++i)
+    delete [] M_buffer[i].data;
+}
+
+void ReadAhead::add_range(int first_block, int last_block)
+{
+  ASSERT(!M_started);
+  end_range();
+  for (int block = first_block; block < last_block; block += M_max_chunk_blocks)
+  {
+    Chunk chunk;
+    chunk.first_block = block;
+    chunk.count = std::min(M_max_chunk_blocks, last_block - block);
+    M_chunks.push_back(chunk);
+  }
+}
+
+void ReadAhead::add_blocks(int first_block, int last_block)
+{
+  ASSERT(!M_started);
+  if (M_range_begin != -1 && (first_block < M_range_end || first_block - M_range_end > read_ahead_max_gap))
+    end_range();
+  if (M_range_begin == -1)
+    M_range_begin = first_block;
+  M_range_end = last_block;
+}
+
+void ReadAhead::end_range(void)
+{
+  if (M_range_begin == -1)
+    return;
+  int first_block = M_range_begin;
+  M_range_begin = -1;
+  add_range(first_block, M_range_end);
+}
+
+void ReadAhead::start(void)
+{
+  ASSERT(!M_started);
+  end_range();
+  M_started = true;
+  if (M_chunks.empty())
+    return;
+  int error = pthread_create(&M_thread, NULL, &ReadAhead::reader_thread, this);
+  if (error)
+  {
+    std::cout << std::flush;
+    std::cerr << progname << ": failed to create read ahead thread: " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+void ReadAhead::stop(void)
+{
+  if (!M_started || M_chunks.empty())
+    return;
+  pthread_mutex_lock(&M_mutex);
+  M_stop = true;
+  pthread_cond_broadcast(&M_cond);
+  pthread_mutex_unlock(&M_mutex);
+  pthread_join(M_thread, NULL);
+  M_started = false;
+}
+
+void* ReadAhead::reader_thread(void* read_ahead)
+{
+  static_cast<ReadAhead*>(read_ahead)->read_chunks();
+  return NULL;
+}
+
+void ReadAhead::read_chunks(void)
+{
+  for (size_t chunk = 0; chunk < M_chunks.size(); ++chunk)
+  {
+    Buffer& buffer(M_buffer[chunk & 1]);
+    pthread_mutex_lock(&M_mutex);
+    // Wait till the buffer was released by next_block.
+    while (buffer.full && !M_stop)
+      pthread_cond_wait(&M_cond, &M_mutex);
+    bool stopped = M_stop;
+    pthread_mutex_unlock(&M_mutex);
+    if (stopped)
+      break;
+    get_blocks(M_chunks[chunk].first_block, M_chunks[chunk].count, buffer.data);
+    pthread_mutex_lock(&M_mutex);
+    buffer.chunk = chunk;
+    buffer.full = true;
+    pthread_cond_broadcast(&M_cond);
+    pthread_mutex_unlock(&M_mutex);
+  }
+}
+
+unsigned char* ReadAhead::next_block(int& block)
+{
+  ASSERT(M_started);
+  if (M_current_chunk == M_chunks.size())
+    return NULL;
+  if (M_current_index == -1 || ++M_current_index == M_chunks[M_current_chunk].count)
+  {
+    pthread_mutex_lock(&M_mutex);
+    if (M_current_index != -1)
+    {
+      // Release the buffer of the chunk that we're done with.
+      M_buffer[M_current_chunk & 1].full = false;
+      pthread_cond_broadcast(&M_cond);
+      if (++M_current_chunk == M_chunks.size())
+      {
+	pthread_mutex_unlock(&M_mutex);
+	return NULL;
+      }
+    }
+    // Wait till the next chunk was read.
+    Buffer& buffer(M_buffer[M_current_chunk & 1]);
+    while (!buffer.full)
+      pthread_cond_wait(&M_cond, &M_mutex);
+    ASSERT(buffer.chunk == M_current_chunk);
+    pthread_mutex_unlock(&M_mutex);
+    M_current_index = 0;
+  }
+  Chunk const& chunk(M_chunks[M_current_chunk]);
+  block = chunk.first_block + M_current_index;
+  return M_buffer[M_current_chunk & 1].data + M_current_index * block_size_;
+}
@@ -0,0 +1,118 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file read_ahead.h Declaration of class ReadAhead.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#ifndef USE_PCH
+#include <pthread.h>
+#include <cstddef>	// Needed for size_t
+#include <vector>
+#endif
+
+// The number of bytes read with a single system call by ReadAhead.
+size_t const read_ahead_chunk_size = 4 * 1024 * 1024;
+
+// The largest number of blocks between two calls to ReadAhead::add_blocks that
+// are read and skipped, rather than splitting the read.
+int const read_ahead_max_gap = 16;
+
+// class ReadAhead
+//
+// Stream a (large) number of blocks from the device.
+//
+// Usage:
+//
+//   ReadAhead read_ahead;
+//   read_ahead.add_range(first_block, last_block);	// Possibly more than once, or add_blocks.
+//   read_ahead.start();
+//   int block;
+//   unsigned char* block_buf;
+//   while ((block_buf = read_ahead.next_block(block)))
+//     ...
+//
+// The ranges are read in chunks of read_ahead_chunk_size bytes by a background
+// thread into two buffers: while the caller processes the blocks of one chunk,
+// the next chunk is being read. The pointer returned by next_block is valid
+// until the next call to next_block (or the destruction of the object).
+//
+// Scattered blocks are added with add_blocks. Blocks that follow the previously
+// added ones at most read_ahead_max_gap blocks further are read with a single
+// range, so next_block also returns the blocks in the gap; the caller must skip
+// those.
+
+class ReadAhead {
+  private:
+    struct Chunk {
+      int first_block;
+      int count;
+    };
+    struct Buffer {
+      unsigned char* data;
+      size_t chunk;		// The index into M_chunks of the chunk that is in data.
+      bool full;		// Set when data was read and not yet released by next_block.
+    };
+
+    std::vector<Chunk> M_chunks;	// All reads, in order.
+    int M_range_begin;			// The range that add_blocks is building, or -1 if none.
+    int M_range_end;
+    int M_max_chunk_blocks;		// The maximum number of blocks per chunk.
+    Buffer M_buffer[2];
+    size_t M_current_chunk;		// The chunk that the last block returned by next_block belongs to.
+    int M_current_index;		// The index of the last block returned by next_block within M_current_chunk.
+    bool M_started;
+    bool M_stop;			// Set when the reader thread must terminate.
+    pthread_t M_thread;
+    pthread_mutex_t M_mutex;
+    pthread_cond_t M_cond;
+
+  public:
+    ReadAhead(void);
+    ~ReadAhead();
+
+    // Add blocks [first_block, last_block) to the blocks to be read. Must be called before start().
+    void add_range(int first_block, int last_block);
+
+    // Add blocks [first_block, last_block) to the blocks to be read, filling the gap with the blocks
+    // of the previous call if that is at most read_ahead_max_gap blocks. Must be called before start().
+    void add_blocks(int first_block, int last_block);
+
+    // Add block 'block' to the blocks to be read, like add_blocks.
+    void add_block(int block) { add_blocks(block, block + 1); }
+
+    // Don't fill the gap between the blocks added so far and the next ones.
+    void end_range(void);
+
+    // Start reading.
+    void start(void);
+
+    // Return the next block and set block to its block number, or return NULL when all blocks were returned.
+    unsigned char* next_block(int& block);
+
+  private:
+    static void* reader_thread(void* read_ahead);
+    void read_chunks(void);
+    void stop(void);
+};
+
+#endif // READ_AHEAD_H
@@ -0,0 +1,177 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file scan_groups.cc Implementation of function scan_groups.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "debug.h"
+#endif
+
+#include "scan_groups.h"
+#include "commandline.h"
+#include "globals.h"
+
+int scan_groups_threads(void)
+{
+  if (commandline_threads > 0)
+    return commandline_threads;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return (cpus > 0) ? cpus : 1;
+}
+
+// The groups that still have to be processed by one worker thread.
+struct ScanGroupsRange {
+  int begin;
+  int end;
+};
+
+struct ScanGroups {
+  void (*process)(int group, int thread, void* data);
+  void* data;
+  int first_group;
+  pthread_mutex_t mutex;
+  pthread_cond_t group_done;		// Signalled whenever an element of done is set.
+  std::vector<ScanGroupsRange> ranges;	// The remaining work of each worker thread.
+  std::vector<bool> done;		// Set when process returned for group first_group + index.
+};
+
+struct ScanGroupsWorker {
+  ScanGroups* scan;
+  int thread;
+};
+
+// Get the next group to process for worker 'thread'. Returns false when there is no work left.
+// Must be called with scan.mutex locked.
+static bool take_group(ScanGroups& scan, int thread, int& group)
+{
+  ScanGroupsRange& range(scan.ranges[thread]);
+  if (range.begin == range.end)
+  {
+    // Steal the second half of the largest range of the other threads.
+    int victim = -1;
+    int largest = 0;
+    for (int t = 0; t < (int)scan.ranges.size(); ++t)
+    {
+      int size = scan.ranges[t].end - scan.ranges[t].begin;
+      if (size > largest)
+      {
+	largest = size;
+	victim = t;
+      }
+    }
+    if (victim == -1)
+      return false;
+    int middle = scan.ranges[victim].begin + largest / 2;
+    range.begin = middle;
+    range.end = scan.ranges[victim].end;
+    scan.ranges[victim].end = middle;
+  }
+  group = range.begin++;
+  return true;
+}
+
+static void* worker_thread(void* arg)
+{
+  ScanGroupsWorker* worker = static_cast<ScanGroupsWorker*>(arg);
+  ScanGroups& scan(*worker->scan);
+  pthread_mutex_lock(&scan.mutex);
+  int group;
+  while (take_group(scan, worker->thread, group))
+  {
+    pthread_mutex_unlock(&scan.mutex);
+    scan.process(group, worker->thread, scan.data);
+    pthread_mutex_lock(&scan.mutex);
+    scan.done[group - scan.first_group] = true;
+    pthread_cond_broadcast(&scan.group_done);
+  }
+  pthread_mutex_unlock(&scan.mutex);
+  return NULL;
+}
+
+void scan_groups(int first_group, int end_group,
+    void (*process)(int group, int thread, void* data),
+    void (*commit)(int group, void* data), void* data)
+{
+  int const number_of_groups = end_group - first_group;
+  int const number_of_threads = std::min(scan_groups_threads(), number_of_groups);
+
+  if (number_of_threads <= 1)
+  {
+    for (int group = first_group; group < end_group; ++group)
+    {
+      process(group, 0, data);
+      if (commit)
+	commit(group, data);
+    }
+    return;
+  }
+
+  ScanGroups scan;
+  scan.process = process;
+  scan.data = data;
+  scan.first_group = first_group;
+  pthread_mutex_init(&scan.mutex, NULL);
+  pthread_cond_init(&scan.group_done, NULL);
+  scan.done.resize(number_of_groups, false);
+  scan.ranges.resize(number_of_threads);
+  std::vector<ScanGroupsWorker> workers(number_of_threads);
+  std::vector<pthread_t> threads(number_of_threads);
+
+  // Give each thread a contiguous part of the groups, so that it reads the disk sequentially.
+  for (int thread = 0; thread < number_of_threads; ++thread)
+  {
+    scan.ranges[thread].begin = first_group + (long)number_of_groups * thread / number_of_threads;
+    scan.ranges[thread].end = first_group + (long)number_of_groups * (thread + 1) / number_of_threads;
+  }
+  for (int thread = 0; thread < number_of_threads; ++thread)
+  {
+    workers[thread].scan = &scan;
+    workers[thread].thread = thread;
+    int error = pthread_create(&threads[thread], NULL, &worker_thread, &workers[thread]);
+    if (error)
+    {
+      std::cout << std::flush;
+      std::cerr << progname << ": failed to create worker thread: " << strerror(error) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Commit the results in order.
+  for (int group = first_group; commit && group < end_group; ++group)
+  {
+    pthread_mutex_lock(&scan.mutex);
+    while (!scan.done[group - first_group])
+      pthread_cond_wait(&scan.group_done, &scan.mutex);
+    pthread_mutex_unlock(&scan.mutex);
+    commit(group, data);
+  }
+
+  for (int thread = 0; thread < number_of_threads; ++thread)
+    pthread_join(threads[thread], NULL);
+  pthread_cond_destroy(&scan.group_done);
+  pthread_mutex_destroy(&scan.mutex);
+}
@@ -0,0 +1,43 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file scan_groups.h Declaration of function scan_groups.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SCAN_GROUPS_H
+#define SCAN_GROUPS_H
+
+// Return the number of worker threads that scan_groups uses (--threads).
+int scan_groups_threads(void);
+
+// Call process(group, thread, data) for every group in the range [first_group, end_group),
+// where 'thread' is the index (0 ... scan_groups_threads() - 1) of the worker thread that
+// calls it. Each worker starts with a contiguous part of the range and steals half of the
+// remaining groups of another worker when it runs out of work.
+//
+// commit(group, data) is called from the calling thread, for every group in increasing
+// order, as soon as process finished for that group. Therefore process should only
+// store its results per group, and commit should do everything that depends on the order.
+// commit may be NULL when nothing depends on the order.
+void scan_groups(int first_group, int end_group,
+    void (*process)(int group, int thread, void* data),
+    void (*commit)(int group, void* data), void* data);
+
+#endif // SCAN_GROUPS_H
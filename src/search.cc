@@ -0,0 +1,327 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file search.cc Implementation of class SearchPattern.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USE_PCH
+#include "sys.h"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include "debug.h"
+#endif
+
+#include "search.h"
+#include "globals.h"
+
+// Use the SSE2 and AVX2 implementations on x86 when the compiler supports them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(HAVE_IMMINTRIN_H)
+#define SEARCH_X86 1
+#include <immintrin.h>
+#else
+#define SEARCH_X86 0
+#endif
+
+// Portable implementation.
+static unsigned char const* find_portable(unsigned char const* buf, size_t size, unsigned char const* pattern, size_t len)
+{
+  if (len == 0)
+    return buf;
+  if (size < len)
+    return NULL;
+  unsigned char const* const last = buf + size - len;	// The last possible start of a match.
+  unsigned char const* ptr = buf;
+  while (ptr <= last)
+  {
+    ptr = static_cast<unsigned char const*>(std::memchr(ptr, pattern[0], last - ptr + 1));
+    if (!ptr)
+      return NULL;
+    if (ptr[len - 1] == pattern[len - 1] && std::memcmp(ptr + 1, pattern + 1, len - 1) == 0)
+      return ptr;
+    ++ptr;
+  }
+  return NULL;
+}
+
+#if SEARCH_X86
+// Check the candidates in 'mask', which are the offsets relative to ptr where the first and last byte match.
+static inline unsigned char const* check_candidates(unsigned int mask, unsigned char const* ptr, unsigned char const* pattern, size_t len)
+{
+  while (mask)
+  {
+    int offset = __builtin_ctz(mask);
+    if (len <= 2 || std::memcmp(ptr + offset + 1, pattern + 1, len - 2) == 0)
+      return ptr + offset;
+    mask &= mask - 1;
+  }
+  return NULL;
+}
+
+__attribute__((target("sse2")))
+static unsigned char const* find_sse2(unsigned char const* buf, size_t size, unsigned char const* pattern, size_t len)
+{
+  if (len == 0)
+    return buf;
+  if (size < len)
+    return NULL;
+  __m128i const first = _mm_set1_epi8(pattern[0]);
+  __m128i const last = _mm_set1_epi8(pattern[len - 1]);
+  size_t const positions = size - len + 1;	// The number of possible starts of a match.
+  size_t i = 0;
+  for (; i + 16 <= positions; i += 16)
+  {
+    __m128i const block_first = _mm_loadu_si128(reinterpret_cast<__m128i const*>(buf + i));
+    __m128i const block_last = _mm_loadu_si128(reinterpret_cast<__m128i const*>(buf + i + len - 1));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+    unsigned char const* match = check_candidates(mask, buf + i, pattern, len);
+    if (match)
+      return match;
+  }
+  return find_portable(buf + i, size - i, pattern, len);
+}
+
+__attribute__((target("avx2")))
+static unsigned char const* find_avx2(unsigned char const* buf, size_t size, unsigned char const* pattern, size_t len)
+{
+  if (len == 0)
+    return buf;
+  if (size < len)
+    return NULL;
+  __m256i const first = _mm256_set1_epi8(pattern[0]);
+  __m256i const last = _mm256_set1_epi8(pattern[len - 1]);
+  size_t const positions = size - len + 1;
+  size_t i = 0;
+  for (; i + 32 <= positions; i += 32)
+  {
+    __m256i const block_first = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(buf + i));
+    __m256i const block_last = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(buf + i + len - 1));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+    unsigned char const* match = check_candidates(mask, buf + i, pattern, len);
+    if (match)
+      return match;
+  }
+  return find_sse2(buf + i, size - i, pattern, len);
+}
+#endif // SEARCH_X86
+
+bool search_implementation_supported(search_implementation implementation)
+{
+  switch (implementation)
+  {
+    case search_portable:
+      return true;
+#if SEARCH_X86
+    case search_sse2:
+      return __builtin_cpu_supports("sse2");
+    case search_avx2:
+      return __builtin_cpu_supports("avx2");
+#else
+    case search_sse2:
+    case search_avx2:
+      break;
+#endif
+  }
+  return false;
+}
+
+search_implementation best_search_implementation(void)
+{
+  static bool initialized = false;
+  static search_implementation best;
+  if (!initialized)
+  {
+    if (search_implementation_supported(search_avx2))
+      best = search_avx2;
+    else if (search_implementation_supported(search_sse2))
+      best = search_sse2;
+    else
+      best = search_portable;
+    initialized = true;
+  }
+  return best;
+}
+
+char const* search_implementation_name(search_implementation implementation)
+{
+  switch (implementation)
+  {
+    case search_portable:
+      return "portable";
+    case search_sse2:
+      return "sse2";
+    case search_avx2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+SearchPattern::SearchPattern(std::string const& pattern) : M_pattern(pattern)
+{
+  init(best_search_implementation());
+}
+
+SearchPattern::SearchPattern(std::string const& pattern, search_implementation implementation) : M_pattern(pattern)
+{
+  init(implementation);
+}
+
+void SearchPattern::init(search_implementation implementation)
+{
+  ASSERT(search_implementation_supported(implementation));
+  switch (implementation)
+  {
+#if SEARCH_X86
+    case search_avx2:
+      M_find = find_avx2;
+      return;
+    case search_sse2:
+      M_find = find_sse2;
+      return;
+#endif
+    default:
+      M_find = find_portable;
+      return;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//
+// MultiPatternSearch
+
+void MultiPatternSearch::add(std::string const& pattern, int id)
+{
+  ASSERT(!M_compiled && !pattern.empty());
+  Pattern p;
+  p.pattern = pattern;
+  p.id = id;
+  M_patterns.push_back(p);
+}
+
+void MultiPatternSearch::compile(void)
+{
+  ASSERT(!M_compiled);
+  // State 0 is the root. Use 0 as 'no transition' while building the trie,
+  // which is fine because no transition of the trie leads back to the root.
+  M_transitions.assign(256, 0);
+  M_match.assign(1, -1);
+  for (size_t i = 0; i < M_patterns.size(); ++i)
+  {
+    uint32_t state = 0;
+    std::string const& pattern(M_patterns[i].pattern);
+    for (std::string::const_iterator iter = pattern.begin(); iter != pattern.end(); ++iter)
+    {
+      uint32_t& next(M_transitions[state * 256 + static_cast<unsigned char>(*iter)]);
+      if (next == 0)
+      {
+	next = M_match.size();
+	M_transitions.resize(M_transitions.size() + 256, 0);
+	M_match.push_back(-1);
+      }
+      state = M_transitions[state * 256 + static_cast<unsigned char>(*iter)];	// 'next' might be invalidated by the resize.
+    }
+    // If the same pattern is given twice, only the first one is reported.
+    if (M_match[state] == -1)
+      M_match[state] = i;
+  }
+  // Calculate the suffix links breadth first and turn the trie into a complete DFA:
+  // a missing transition of a state is the same transition of its suffix link.
+  std::vector<uint32_t> suffix(M_match.size(), 0);
+  M_next_match.assign(M_match.size(), 0);
+  std::queue<uint32_t> queue;
+  for (int c = 0; c < 256; ++c)
+    if (M_transitions[c] != 0)
+      queue.push(M_transitions[c]);	// The suffix link of the states at depth 1 is the root.
+  while (!queue.empty())
+  {
+    uint32_t state = queue.front();
+    queue.pop();
+    uint32_t link = suffix[state];
+    M_next_match[state] = (M_match[link] != -1) ? link : M_next_match[link];
+    for (int c = 0; c < 256; ++c)
+    {
+      uint32_t& next(M_transitions[state * 256 + c]);
+      if (next != 0)
+      {
+	suffix[next] = M_transitions[link * 256 + c];
+	queue.push(next);
+      }
+      else
+	next = M_transitions[link * 256 + c];
+    }
+  }
+  M_compiled = true;
+}
+
+size_t MultiPatternSearch::find_all(unsigned char const* buf, size_t size, found_type found, void* data, bool resume)
+{
+  ASSERT(M_compiled);
+  size_t count = 0;
+  uint32_t const* transitions = &M_transitions[0];
+  uint32_t state = resume ? M_state : 0;
+  for (size_t i = 0; i < size; ++i)
+  {
+    state = transitions[state * 256 + buf[i]];
+    // Report the longest pattern that ends here, and all its suffixes that are patterns.
+    for (uint32_t s = (M_match[state] != -1) ? state : M_next_match[state]; s != 0; s = M_next_match[s])
+    {
+      found((long)(i + 1) - (long)M_patterns[M_match[s]].pattern.size(), M_match[s], data);
+      ++count;
+    }
+  }
+  M_state = state;
+  return count;
+}
+
+void load_search_patterns(std::string const& filename, MultiPatternSearch& search)
+{
+  std::ifstream file;
+  file.open(filename.c_str());
+  if (!file.is_open())
+  {
+    int error = errno;
+    std::cout << std::flush;
+    std::cerr << progname << ": --search-file: failed to open \"" << filename << "\": " << strerror(error) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line))
+  {
+    ++line_number;
+    // Accept files with DOS line endings.
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    if (line.empty())
+      continue;
+    search.add(line, line_number);
+  }
+  file.close();
+  if (search.size() == 0)
+  {
+    std::cout << std::flush;
+    std::cerr << progname << ": --search-file: \"" << filename << "\" does not contain any patterns." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  search.compile();
+}
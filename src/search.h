@@ -0,0 +1,142 @@
+// ext3grep -- An ext3 file system investigation and undelete tool
+//
+//! @file search.h Declaration of class SearchPattern.
+//
+// Copyright (C) 2008, by
+// 
+// Carlo Wood, Run on IRC <carlo@alinoe.com>
+// RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+// Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#ifndef USE_PCH
+#include <stdint.h>	// Needed for uint32_t
+#include <cstddef>	// Needed for size_t
+#include <string>
+#include <vector>
+#endif
+
+// The implementations of SearchPattern::find.
+enum search_implementation {
+  search_portable,		// memchr on the first byte, then memcmp.
+  search_sse2,			// Compare the first and last byte of the pattern 16 positions at a time.
+  search_avx2			// Idem, 32 positions at a time.
+};
+
+// Return true if the CPU that we run on supports 'implementation'.
+bool search_implementation_supported(search_implementation implementation);
+
+// Return the fastest implementation that the CPU that we run on supports.
+search_implementation best_search_implementation(void);
+
+// Return a human readable name of 'implementation'.
+char const* search_implementation_name(search_implementation implementation);
+
+// class SearchPattern
+//
+// A fixed string (as given with --search) that can be searched for in a buffer.
+//
+// The SIMD implementations find all positions where both the first and the last
+// byte of the pattern match, for 16 or 32 positions at once, and only compare the
+// remaining bytes of those candidates.
+
+class SearchPattern {
+  public:
+    typedef unsigned char const* (*find_type)(unsigned char const* buf, size_t size, unsigned char const* pattern, size_t len);
+
+  private:
+    std::string M_pattern;
+    find_type M_find;
+
+  public:
+    // Use best_search_implementation().
+    SearchPattern(std::string const& pattern);
+    // Use 'implementation', which must be supported.
+    SearchPattern(std::string const& pattern, search_implementation implementation);
+
+    // Return a pointer to the first occurance of the pattern in [buf, buf + size), or NULL if there is none.
+    unsigned char const* find(unsigned char const* buf, size_t size) const
+        { return M_find(buf, size, reinterpret_cast<unsigned char const*>(M_pattern.data()), M_pattern.size()); }
+
+    std::string const& pattern(void) const { return M_pattern; }
+
+  private:
+    void init(search_implementation implementation);
+};
+
+// class MultiPatternSearch
+//
+// A set of fixed strings (as given with --search-file) that are all searched for
+// in a single pass over a buffer, using an Aho-Corasick automaton.
+//
+// Usage:
+//
+// MultiPatternSearch search;
+// search.add("pattern1", 1);
+// search.add("pattern2", 2);
+// search.compile();
+// search.find_all(buf, size, found, data);	// Calls found(offset, index, data) for every match,
+//						// where search.id(index) is the id of the pattern.
+//
+// The automaton is a complete DFA: every state has a transition for every byte,
+// so that searching costs one table lookup per byte, independent of the number
+// of patterns.
+
+class MultiPatternSearch {
+  public:
+    typedef void (*found_type)(long offset, int index, void* data);
+
+  private:
+    struct Pattern {
+      std::string pattern;
+      int id;
+    };
+    std::vector<Pattern> M_patterns;
+    std::vector<uint32_t> M_transitions;	// M_transitions[state * 256 + byte] is the next state.
+    std::vector<int> M_match;			// The index into M_patterns of the pattern that ends in a state, or -1.
+    std::vector<uint32_t> M_next_match;		// The next state on the suffix link chain that has a match, or 0.
+    bool M_compiled;
+    uint32_t M_state;				// The state at the end of the last call to find_all.
+
+  public:
+    MultiPatternSearch(void) : M_compiled(false), M_state(0) { }
+
+    // Add a pattern with identifier 'id'. Must be called before compile().
+    void add(std::string const& pattern, int id);
+
+    // Build the automaton.
+    void compile(void);
+
+    // Call found(offset, index, data) for every occurance of every pattern that ends in [buf, buf + size),
+    // in the order of the end of the match. Returns the number of matches.
+    // If 'resume' is true, the buffer is the continuation of the buffer of the previous call and matches
+    // may start in that (or an earlier) buffer, in which case 'offset' is negative.
+    size_t find_all(unsigned char const* buf, size_t size, found_type found, void* data, bool resume = false);
+
+    // Accessors.
+    size_t size(void) const { return M_patterns.size(); }
+    std::string const& pattern(int index) const { return M_patterns[index].pattern; }
+    int id(int index) const { return M_patterns[index].id; }
+    size_t number_of_states(void) const { return M_match.size(); }
+};
+
+// Read the patterns for --search-file: one per line; empty lines are ignored.
+// The id of each pattern is its line number.
+void load_search_patterns(std::string const& filename, MultiPatternSearch& search);
+
+#endif // SEARCH_H